@@ -0,0 +1,420 @@
+//microbenchmarks, build with 'make bench'
+//rdt_session.c is included to reach its static decoders
+
+#include "rdt_session.c"
+#include "rdts_table.h"
+#include "rdts_shard.h"
+#include "rdts_io.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+//small enough to stay in cache, so decoding rather than memory is measured
+#define BENCH_FRAMES (8 * 1024)
+#define BENCH_ROUNDS 2000
+//sharded sessions: each shard sends this many messages on each of its sessions
+#define SHARD_SESSIONS 32
+#define SHARD_ROUNDS 20000
+//loopback echo through the I/O thread: each round writes a batch of packets on every
+//connection, then reads all of them back
+#define ECHO_CONNS 16
+#define ECHO_BATCH 32
+#define ECHO_PACKET 64
+#define ECHO_ROUNDS 1000
+
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//many small frames in random order: data, acks, data with a piggybacked ack, some windows
+static char *build_stream(uint32_t *len)
+{
+	char *buf = (char *)malloc(BENCH_FRAMES * (RDT_HEADER_MAX + 300));
+	char *p = buf;
+	uint64_t ack = 100;
+	uint32_t wnd = 4096;
+	int i;
+
+	srand(1);
+	for (i = 0; i < BENCH_FRAMES; i++) {
+		int kind = rand() % 4;
+		uint32_t data_len = kind == 0 ? 0 : (rand() % 8 == 0 ? 256 + rand() % 40 : 1 + rand() % 64);
+		uint64_t offset = kind < 2 ? (ack += rand() % 70000) : 0;
+
+		p += encode_header(p, offset, rand() % 16 == 0 ? &wnd : NULL, data_len);
+		memset(p, i, data_len);
+		p += data_len;
+	}
+
+	*len = p - buf;
+	return buf;
+}
+
+//one copy of the loop per decoder, so each can be inlined
+#define DECODE_ALL(name, fn)                                                                                 \
+static uint64_t name(const char *buf, uint32_t len, uint64_t *sum)                                           \
+{                                                                                                            \
+	const char *p = buf;                                                                                     \
+	uint64_t ack, frames = 0;                                                                                \
+	uint32_t window, data_size, pkg_len;                                                                     \
+	const char *pdata;                                                                                       \
+	int has_window;                                                                                          \
+	while (len > 0) {                                                                                        \
+		int r = fn((rdt_header_t *)p, len, &ack, &has_window, &window, &data_size, &pdata, &pkg_len);      \
+		assert(r == DECODE_HEADER_OK);                                                                       \
+		*sum += ack + window + data_size + (pdata - p);                                                      \
+		p += pkg_len;                                                                                        \
+		len -= pkg_len;                                                                                      \
+		frames++;                                                                                            \
+	}                                                                                                        \
+	return frames;                                                                                           \
+}
+
+DECODE_ALL(decode_switch, parse_header)
+DECODE_ALL(decode_lut, parse_header_fast)
+
+typedef uint64_t (*decode_all_fn)(const char *buf, uint32_t len, uint64_t *sum);
+
+static void bench_decode(const char *name, decode_all_fn fn, const char *buf, uint32_t len)
+{
+	uint64_t sum = 0, frames = 0, start;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		frames += fn(buf, len, &sum);
+	}
+	start = now_ns() - start;
+
+	printf("%-12s %8.2f ns/frame %8.1f Mframes/s (sum=%llu)\n", name,
+		(double)start / frames, frames * 1000.0 / start, (unsigned long long)sum);
+}
+
+static void bench_header()
+{
+	uint32_t len = 0;
+	uint64_t slow = 0, fast = 0;
+	char *buf = build_stream(&len);
+
+	header_lut_init();
+	decode_switch(buf, len, &slow);
+	decode_lut(buf, len, &fast);
+	assert(slow == fast);
+
+	printf("header decode: %d frames, %u bytes\n", BENCH_FRAMES, len);
+	bench_decode("switch", decode_switch, buf, len);
+	bench_decode("lut", decode_lut, buf, len);
+
+	free(buf);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+//session table: insert with the worst single insert (growing must not stall),
+//then lookups of present ids in random order and of missing ids
+static void bench_table(int n)
+{
+	rdts_table_t *tab = rdts_table_create(0);
+	rdt_session_t *s = (rdt_session_t *)calloc(n, sizeof(rdt_session_t));
+	int *order = (int *)malloc(n * sizeof(int));
+	uint64_t *lat = (uint64_t *)malloc(n * sizeof(uint64_t));
+	uint64_t start, t, hits = 0;
+	int i, j;
+
+	srand(2);
+	for (i = 0; i < n; i++) {
+		s[i].sid = 10000 + i * 7;
+		order[i] = i;
+	}
+	for (i = n - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		t = order[i], order[i] = order[j], order[j] = t;
+	}
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		t = now_ns();
+		rdts_table_insert(tab, &s[i]);
+		lat[i] = now_ns() - t;
+	}
+	start = now_ns() - start;
+	qsort(lat, n, sizeof(uint64_t), cmp_u64);
+	printf("table %8d: insert %6.1f ns/op (p99.99 %6.1f us, max %6.1f us)", n, (double)start / n,
+		lat[n - 1 - n / 10000] / 1000.0, lat[n - 1] / 1000.0);
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		hits += rdts_table_find(tab, s[order[i]].sid) != NULL;
+	}
+	start = now_ns() - start;
+	printf(", hit %6.1f ns/op", (double)start / n);
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		hits += rdts_table_find(tab, s[order[i]].sid + 1) != NULL;
+	}
+	start = now_ns() - start;
+	printf(", miss %6.1f ns/op (found=%llu)\n", (double)start / n, (unsigned long long)hits);
+
+	rdts_table_release(tab);
+	free(lat);
+	free(order);
+	free(s);
+}
+
+//snapshot of 'n' sessions with a few unacked messages each into one buffer, and back
+static void bench_snapshot(int n)
+{
+	rdt_session_t **s = (rdt_session_t **)malloc(n * sizeof(rdt_session_t *));
+	char msg[300] = {0};
+	char *buf, *p;
+	uint64_t start, len = 0;
+	uint32_t used;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		s[i] = rdts_create(i + 1, NULL);
+		rdts_send(s[i], msg, sizeof(msg));
+		rdts_send(s[i], msg, 40);
+		rdts_drain_snd_buf(s[i], rdts_get_snd_buf_length(s[i]));
+		len += rdts_serialize_size(s[i]);
+	}
+	buf = (char *)malloc(len);
+
+	start = now_ns();
+	for (i = 0, p = buf; i < n; i++) {
+		p += rdts_serialize(s[i], p, (uint32_t)(buf + len - p));
+	}
+	start = now_ns() - start;
+	printf("snapshot %6d: serialize %6.1f ns/session", n, (double)start / n);
+
+	for (i = 0; i < n; i++) {
+		rdts_release(s[i]);
+	}
+
+	start = now_ns();
+	for (i = 0, p = buf; i < n; i++) {
+		s[i] = rdts_deserialize(p, (uint32_t)(buf + len - p), &used, NULL);
+		p += used;
+	}
+	start = now_ns() - start;
+	printf(", deserialize %6.1f ns/session (%llu bytes)\n", (double)start / n, (unsigned long long)len);
+
+	for (i = 0; i < n; i++) {
+		assert(s[i] && s[i]->sid == i + 1);
+		rdts_release(s[i]);
+	}
+	free(buf);
+	free(s);
+}
+
+//one session pair inside a shard: 64 byte messages into the peer, acked every 16 messages
+static void bench_shard_job(rdts_shard_t *shard, rdts_shard_msg_t *msg)
+{
+	rdt_session_t *a = rdts_shard_create_session(shard, msg->sid);
+	rdt_session_t *b = rdts_create(msg->sid, NULL);
+	int *done = (int *)rdts_shard_get_ud(shard);
+	char data[64] = {0};
+	const char *p;
+	uint32_t len;
+	int i;
+
+	assert(a && b);
+	for (i = 0; i < SHARD_ROUNDS; i++) {
+		assert(rdts_send(a, data, sizeof(data)) >= 0);
+		p = rdts_pullup_snd_buf(a);
+		len = rdts_get_snd_buf_length(a);
+		rdts_input(b, p, len);
+		rdts_drain_snd_buf(a, len);
+		rdts_drain_raw_rcv_buf(b, rdts_get_raw_rcv_buf_length(b));
+		if (i % 16 == 15) {
+			rdts_send_ack(b);
+			p = rdts_pullup_snd_buf(b);
+			len = rdts_get_snd_buf_length(b);
+			rdts_input(a, p, len);
+			rdts_drain_snd_buf(b, len);
+		}
+	}
+
+	rdts_release(b);
+	rdts_shard_delete_session(shard, msg->sid);
+	free(msg);
+	__sync_fetch_and_add(done, 1);
+}
+
+//the same work per shard for every shard count, so the rate should grow with the
+//count for as long as there are cores to run the shards on
+static void bench_shards(int count, double *base)
+{
+	int done = 0, total = count * SHARD_SESSIONS, posted = 0, sid;
+	int *per = (int *)calloc(count, sizeof(int));
+	rdts_group_t *group = rdts_group_create(count, 0, &done);
+	uint64_t start;
+	double rate;
+
+	assert(group);
+	start = now_ns();
+	for (sid = 1; posted < total; sid++) {
+		int idx = rdts_group_shard_of(group, sid);
+		rdts_shard_msg_t *msg;
+		if (per[idx] == SHARD_SESSIONS) {
+			continue;
+		}
+		per[idx]++;
+		posted++;
+		msg = (rdts_shard_msg_t *)malloc(sizeof(*msg));
+		msg->sid = sid;
+		msg->fn = bench_shard_job;
+		rdts_group_post(group, msg);
+	}
+	while (__sync_fetch_and_add(&done, 0) < total) {
+		usleep(100);
+	}
+	start = now_ns() - start;
+	rdts_group_release(group);
+
+	rate = (double)total * SHARD_ROUNDS * 1000.0 / start;
+	if (*base == 0) {
+		*base = rate;
+	}
+	printf("shards %2d: %8.2f Mmsg/s, x%.2f\n", count, rate, rate / *base);
+	free(per);
+}
+
+typedef struct echo_client_s {
+	struct sockaddr_in addr;
+	int done;
+} echo_client_t;
+
+static void read_full(int fd, char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, buf, len);
+		assert(n > 0);
+		buf += n;
+		len -= n;
+	}
+}
+
+static void *echo_client(void *arg)
+{
+	echo_client_t *ec = (echo_client_t *)arg;
+	static char out[ECHO_BATCH * (ECHO_PACKET + 4)], in[sizeof(out)];
+	uint32_t len = ECHO_PACKET;
+	int fds[ECHO_CONNS], i, r, one = 1;
+
+	for (i = 0; i < ECHO_BATCH; i++) {
+		memcpy(out + i * (ECHO_PACKET + 4), &len, 4);
+	}
+	for (i = 0; i < ECHO_CONNS; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		assert(connect(fds[i], (struct sockaddr *)&ec->addr, sizeof(ec->addr)) == 0);
+	}
+	for (r = 0; r < ECHO_ROUNDS; r++) {
+		for (i = 0; i < ECHO_CONNS; i++) {
+			assert(write(fds[i], out, sizeof(out)) == sizeof(out));
+		}
+		for (i = 0; i < ECHO_CONNS; i++) {
+			read_full(fds[i], in, sizeof(in));
+		}
+	}
+	for (i = 0; i < ECHO_CONNS; i++) {
+		close(fds[i]);
+	}
+	__atomic_store_n(&ec->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+//the logic thread side: every packet goes straight back
+static void bench_echo(int backend)
+{
+	rdts_io_t *io = rdts_io_create(4 * 1024 * 1024, backend);
+	echo_client_t ec;
+	pthread_t client;
+	socklen_t slen = sizeof(ec.addr);
+	uint64_t start, packets = 0;
+	const char *data;
+	uint32_t len;
+	int lfd, id, type, one = 1;
+
+	if (io == NULL) {
+		//only io_uring depends on the kernel
+		printf("echo uring: not available, %s\n", strerror(errno));
+		return;
+	}
+	//accepted sockets inherit it
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(lfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	memset(&ec, 0, sizeof(ec));
+	ec.addr.sin_family = AF_INET;
+	ec.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(bind(lfd, (struct sockaddr *)&ec.addr, sizeof(ec.addr)) == 0 && listen(lfd, ECHO_CONNS) == 0);
+	getsockname(lfd, (struct sockaddr *)&ec.addr, &slen);
+	assert(rdts_io_add(io, lfd, 1, NULL, 0) > 0);
+
+	start = now_ns();
+	pthread_create(&client, NULL, echo_client, &ec);
+	while (!__atomic_load_n(&ec.done, __ATOMIC_ACQUIRE)) {
+		if (!rdts_io_wait(io, 10)) {
+			continue;
+		}
+		while ((data = rdts_io_peek(io, &id, &type, &len)) != NULL) {
+			if (type == RDTS_IO_DATA) {
+				while (rdts_io_send(io, id, data, len) != 0) {
+					sched_yield();
+				}
+				packets++;
+			}
+			rdts_io_pop(io);
+		}
+	}
+	start = now_ns() - start;
+	pthread_join(client, NULL);
+
+	assert(packets == (uint64_t)ECHO_CONNS * ECHO_BATCH * ECHO_ROUNDS);
+	printf("echo %-5s: %8.3f Mpkt/s, %6.1f ns/pkt\n", rdts_io_backend(io), packets * 1000.0 / start, (double)start / packets);
+	rdts_io_release(io);
+}
+
+int main()
+{
+	double base = 0;
+	int n;
+
+	bench_header();
+	bench_table(10000);
+	bench_table(1000000);
+	bench_table(4000000);
+	bench_snapshot(50000);
+
+	printf("sharded send/input, %ld cores\n", sysconf(_SC_NPROCESSORS_ONLN));
+	for (n = 1; n <= 16; n *= 2) {
+		bench_shards(n, &base);
+	}
+
+	printf("loopback echo, %d connections, %d byte packets\n", ECHO_CONNS, ECHO_PACKET);
+	bench_echo(RDTS_IO_BACKEND_URING);
+	bench_echo(RDTS_IO_BACKEND_EPOLL);
+	bench_echo(RDTS_IO_BACKEND_POLL);
+
+	return 0;
+}
@@ -1,9 +1,10 @@
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
-#include "rdts_manager.h"
+#include "lrdt_common.h"
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -14,11 +15,6 @@ const int MESSAGE_EMPTY = 0;
 const int MESSAGE_IN = 1;
 const int MESSAGE_OUT = 2;
 
-typedef struct message_s {
-    uint32_t sz;
-    char buf[0];
-} message_t;
-
 typedef struct connection_message_s {
     uint32_t sz;
     char *buf;
@@ -26,30 +22,7 @@ typedef struct connection_message_s {
 
 static rdt_session_t * get_session(lua_State *L)
 {
-    if (g_rdts_mng == NULL) {
-        luaL_error(L, "session manager not init");
-    }
-
-    int sid = luaL_optinteger(L, 1, 0);
-    if (sid <= 0) {
-        luaL_error(L, "need session id");
-    }
-
-    rdt_session_t *rdts = find_session(g_rdts_mng, sid, 1);
-    if (rdts == NULL) {
-        luaL_error(L, "rdt session not create: [%d]", sid);
-    }
-
-    return rdts;
-}
-
-
-static int lrdt_delete(lua_State *L)
-{
-    rdt_session_t *rdts = get_session(L);
-    delete_session(g_rdts_mng, rdts->sid);
-
-    return 0;
+    return lrdt_get_session(L, g_rdts_mng, SESSION_FIND_ENABLED);
 }
 
 static int lrdt_create(lua_State *L)
@@ -64,16 +37,9 @@ static int lrdt_create(lua_State *L)
         luaL_error(L, "session already create");
     }
 
-    create_session(g_rdts_mng, sid);
-    return 0;
-}
-
-static int lrdt_disable(lua_State *L)
-{
-    rdt_session_t *rdts = get_session(L);
-    disable_session(g_rdts_mng, rdts->sid);
-
-    return 0;
+    //false: over the memory budget (see rdt_mem_stat) or out of memory
+    lua_pushboolean(L, create_session(g_rdts_mng, sid) != NULL);
+    return 1;
 }
 
 static int lrdt_reconnect(lua_State *L)
@@ -96,38 +62,6 @@ static int lrdt_reconnect(lua_State *L)
     return 0;
 }
 
-static int lrdt_ack(lua_State *L)
-{
-    rdt_session_t *rdts = get_session(L);
-    ack_session(g_rdts_mng, rdts->sid);
-
-    return 0;
-}
-
-static message_t *new_message(const char *buf, uint32_t len)
-{
-    message_t *msg = (message_t *)malloc(sizeof(*msg) + len);
-    msg->sz = len;
-    memcpy(msg->buf, (const void *)buf, len);
-
-    return msg;
-}
-
-static int lsend(lua_State *L)
-{
-    rdt_session_t *rdts = get_session(L);
-    size_t sz = 0;
-    const char *buf = luaL_checklstring(L, 2, &sz);
-    if (sz == 0) {
-        return 0;
-    }
-
-    message_t *msg = new_message(buf, (uint32_t)sz);
-    rdts_send(rdts, (const char *)msg, sizeof(*msg) + sz);
-
-    return 0;
-}
-
 static int lrecv(lua_State *L)
 {
     rdt_session_t *rdts = get_session(L);
@@ -137,7 +71,15 @@ static int lrecv(lua_State *L)
         return 0;
     }
 
+    //the delayed ack counts from now
+    update_session(g_rdts_mng, rdts);
     rdts_input(rdts, buf, sz);
+    if (lua_isfunction(L, 3)) {
+        lrdt_recv_messages(L, g_rdts_mng, rdts->sid);
+    } else {
+        lrdt_touch(g_rdts_mng, rdts);
+    }
+
     return 0;
 }
 
@@ -156,45 +98,36 @@ static int pollin(rdt_session_t *rdts, connection_message_t *m)
     }
 
     m->sz = len;
-    m->buf = (char *)malloc(len);
-    memcpy(m->buf, buf + sizeof(*msg), len);
-    rdts_drain_raw_rcv_buf(rdts, len + sizeof(*msg));
+    //points into raw_rcv_buf, the caller drains it once pushed to lua
+    m->buf = (char *)buf + sizeof(*msg);
 
     return MESSAGE_IN;
 }
 
-static int pollout(rdt_session_t *rdts, connection_message_t *m)
-{
-    uint32_t total = rdts_get_snd_buf_length(rdts);
-    if (total <= 0) {
-        return MESSAGE_EMPTY;
-    }
-
-    const char *buf = rdts_pullup_snd_buf(rdts);
-    m->sz = total;
-    m->buf = (char *)malloc(total);
-    memcpy(m->buf, buf, total);
-    rdts_drain_snd_buf(rdts, total);
-
-    return MESSAGE_OUT;
-}
-
 static int lpoll(lua_State *L)
 {
     rdt_session_t *rdts = get_session(L);
     connection_message_t m;
-    int t = pollout(rdts, &m);
-    if (t == MESSAGE_EMPTY) {
-        t = pollin(rdts, &m);
+    int t;
+
+    lua_pushinteger(L, MESSAGE_OUT);
+    if (lrdt_push_output(L, rdts)) {
+        lrdt_touch(g_rdts_mng, rdts);
+        return 2;
     }
+    lua_pop(L, 1);
 
+    t = pollin(rdts, &m);
     if (t != MESSAGE_EMPTY) {
         lua_pushinteger(L, t);
         lua_pushlstring(L, m.buf, m.sz);
-        free(m.buf);
+        rdts_drain_raw_rcv_buf(rdts, m.sz + sizeof(message_t));
+        lrdt_touch(g_rdts_mng, rdts);
+
         return 2;
     }
 
+    lrdt_touch(g_rdts_mng, rdts);
     return 0;
 }
 
@@ -203,18 +136,15 @@ int luaopen_lsocket_client(lua_State *L)
     gL = L;
     g_rdts_mng = rdt_manager_create();
     const luaL_Reg method[] = {
-		{"rdt_delete", lrdt_delete},
 		{"rdt_create", lrdt_create},
-		{"rdt_disable", lrdt_disable},
         {"rdt_reconnect", lrdt_reconnect},
-		{"rdt_ack", lrdt_ack},
-		{"rdt_send", lsend},
 		{"rdt_recv", lrecv},
 		{"rdt_poll", lpoll},
 		// {"", },
 		{NULL, NULL},
     };
     luaL_newlib(L, method);
+    lrdt_register(L, g_rdts_mng);
 
     return 1;
 }
\ No newline at end of file
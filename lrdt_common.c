@@ -0,0 +1,384 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "lrdt_common.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+//the manager lrdt_register() gave the functions below as upvalue
+static rdt_manager_t * get_manager(lua_State *L)
+{
+    rdt_manager_t *mng = (rdt_manager_t *)lua_touserdata(L, lua_upvalueindex(1));
+    if (mng == NULL) {
+        luaL_error(L, "session manager not init");
+    }
+
+    return mng;
+}
+
+static rdt_session_t * get_session(lua_State *L)
+{
+    return lrdt_get_session(L, get_manager(L), SESSION_FIND_ENABLED);
+}
+
+rdt_session_t * lrdt_get_session(lua_State *L, rdt_manager_t *mng, int flags)
+{
+    if (mng == NULL) {
+        luaL_error(L, "session manager not init");
+    }
+
+    int sid = luaL_optinteger(L, 1, 0);
+    if (sid <= 0) {
+        luaL_error(L, "need session id");
+    }
+
+    rdt_session_t *rdts = find_session(mng, sid, flags);
+    if (rdts == NULL) {
+        luaL_error(L, "rdt session not create: [%d]", sid);
+    }
+
+    return rdts;
+}
+
+//keep the manager ready list in sync: ready while frames wait to be sent
+//or a complete message waits to be read. also keeps the session timer armed
+void lrdt_touch(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    uint32_t total = rdts_get_raw_rcv_buf_length(rdts);
+    int ready = rdts_has_output(rdts);
+    if (!ready && total > sizeof(message_t)) {
+        const message_t *msg = (const message_t *)rdts_pullup_raw_rcv_buf(rdts);
+        ready = total >= msg->sz + sizeof(*msg);
+    }
+
+    set_session_ready(mng, rdts, ready);
+    schedule_session(mng, rdts);
+}
+
+//push all pending frames as one string without an intermediate copy, returns 0 if none
+int lrdt_push_output(lua_State *L, rdt_session_t *rdts)
+{
+    struct iovec iov[16];
+    luaL_Buffer b;
+    int i, n;
+
+    if (!rdts_has_output(rdts)) {
+        return 0;
+    }
+
+    luaL_buffinit(L, &b);
+    while ((n = rdts_peek_snd_iov(rdts, iov, 16)) > 0) {
+        uint32_t len = 0;
+        for (i = 0; i < n; i++) {
+            luaL_addlstring(&b, (const char *)iov[i].iov_base, iov[i].iov_len);
+            len += iov[i].iov_len;
+        }
+        rdts_drain_snd_buf(rdts, len);
+    }
+    luaL_pushresult(&b);
+
+    return 1;
+}
+
+//append up to 'max' complete messages to the table on the stack top, from index 'first'.
+//walks the message boundaries in place and drains them at once, returns the count
+int lrdt_push_messages(lua_State *L, rdt_session_t *rdts, int first, int max)
+{
+    uint32_t total = rdts_get_raw_rcv_buf_length(rdts), used = 0, sz;
+    const char *buf;
+    int n = 0;
+
+    if (total <= sizeof(message_t)) {
+        return 0;
+    }
+
+    buf = rdts_pullup_raw_rcv_buf(rdts);
+    while (n < max && total - used > sizeof(message_t)) {
+        memcpy(&sz, buf + used, sizeof(sz));
+        if (total - used - sizeof(message_t) < sz) {
+            break;
+        }
+        lua_pushlstring(L, buf + used + sizeof(message_t), sz);
+        lua_rawseti(L, -2, first + n++);
+        used += sizeof(message_t) + sz;
+    }
+
+    if (used > 0) {
+        rdts_drain_raw_rcv_buf(rdts, used);
+    }
+    return n;
+}
+
+//call the rdt_recv handler (argument 3) for every complete message, once the input is
+//done. each message is drained before its call and the session looked up again after it,
+//so the handler may delete the session or rdt_recv more data into it
+void lrdt_recv_messages(lua_State *L, rdt_manager_t *mng, int sid)
+{
+    rdt_session_t *rdts;
+    uint32_t total, sz;
+    const char *buf;
+
+    while ((rdts = find_session(mng, sid, SESSION_FIND_QUIET)) != NULL) {
+        total = rdts_get_raw_rcv_buf_length(rdts);
+        if (total < sizeof(message_t)) {
+            break;
+        }
+        buf = rdts_pullup_raw_rcv_buf(rdts);
+        memcpy(&sz, buf, sizeof(sz));
+        if (total - sizeof(message_t) < sz) {
+            break;
+        }
+
+        lua_pushvalue(L, 3);
+        lua_pushinteger(L, sid);
+        lua_pushlstring(L, buf + sizeof(message_t), sz);
+        rdts_drain_raw_rcv_buf(rdts, sizeof(message_t) + sz);
+        if (lua_pcall(L, 2, 0, 0) != 0) {
+            printf("rdt_recv handler error: %s\n", lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+
+    if (rdts) {
+        lrdt_touch(mng, rdts);
+    }
+}
+
+static int lrdt_delete(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    delete_session(get_manager(L), rdts->sid);
+
+    return 0;
+}
+
+static int lrdt_disable(lua_State *L)
+{
+    rdt_manager_t *mng = get_manager(L);
+
+    //disabling twice is fine, the grace period keeps running
+    int sid = luaL_optinteger(L, 1, 0);
+    if (disable_session(mng, sid) != 0) {
+        luaL_error(L, "rdt session not create: [%d]", sid);
+    }
+
+    return 0;
+}
+
+static int lrdt_ack(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    ack_session(get_manager(L), rdts->sid);
+    lrdt_touch(get_manager(L), rdts);
+
+    return 0;
+}
+
+static int lsend(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    size_t sz = 0;
+    const char *buf = luaL_checklstring(L, 2, &sz);
+    if (sz == 0) {
+        return 0;
+    }
+
+    //over the memory budget with nothing left to evict
+    if (reserve_memory(get_manager(L), sizeof(message_t) + sz) != 0) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    //build the message in place inside the session
+    message_t *msg = (message_t *)rdts_send_reserve(rdts, sizeof(*msg) + sz);
+    if (msg == NULL) {
+        //backpressure: wait for OnSessionWatermark or rdt_writable
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    msg->sz = (uint32_t)sz;
+    memcpy(msg->buf, buf, sz);
+    lua_pushboolean(L, rdts_send_commit(rdts, sizeof(*msg) + sz) >= 0);
+    lrdt_touch(get_manager(L), rdts);
+
+    return 1;
+}
+
+static int lwritable(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    uint32_t n = rdts_get_writable(rdts);
+
+    //room for the message header too
+    lua_pushinteger(L, n > sizeof(message_t) ? n - sizeof(message_t) : 0);
+    return 1;
+}
+
+static int lcork(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    rdts_cork(rdts);
+
+    return 0;
+}
+
+static int luncork(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    rdts_uncork(rdts);
+    lrdt_touch(get_manager(L), rdts);
+
+    return 0;
+}
+
+static int lstat(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    const rdt_stat_t *st = rdts_get_stat(rdts);
+
+    lua_newtable(L);
+    lua_pushinteger(L, st->frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushinteger(L, st->hdr_bytes);
+    lua_setfield(L, -2, "hdr_bytes");
+    lua_pushinteger(L, st->batches);
+    lua_setfield(L, -2, "batches");
+    lua_pushinteger(L, st->batch_msgs);
+    lua_setfield(L, -2, "batch_msgs");
+    lua_pushinteger(L, st->hdr_saved);
+    lua_setfield(L, -2, "hdr_saved");
+    lua_pushinteger(L, rdts_get_mem(rdts));
+    lua_setfield(L, -2, "mem");
+
+    return 1;
+}
+
+static int lupdate(lua_State *L)
+{
+    rdt_manager_t *mng = get_manager(L);
+
+    uint64_t now_ms = (uint64_t)luaL_checkinteger(L, 1);
+    update_sessions(mng, now_ms);
+
+    return 0;
+}
+
+static int lmanager_tick(lua_State *L)
+{
+    rdt_manager_t *mng = get_manager(L);
+
+    uint64_t now_ms = (uint64_t)luaL_checkinteger(L, 1);
+    rdt_manager_tick(mng, now_ms);
+
+    return 0;
+}
+
+static int lset_grace(lua_State *L)
+{
+    set_session_grace(get_manager(L), (uint32_t)luaL_checkinteger(L, 1));
+    return 0;
+}
+
+static int lset_mem_budget(lua_State *L)
+{
+    set_memory_budget(get_manager(L), (uint64_t)luaL_checkinteger(L, 1));
+    return 0;
+}
+
+static int lcompact_all(lua_State *L)
+{
+    lua_pushinteger(L, compact_all(get_manager(L)));
+    return 1;
+}
+
+static int lmem_stat(lua_State *L)
+{
+    rdt_mem_stat_t st;
+
+    get_memory_stat(get_manager(L), &st);
+    lua_newtable(L);
+    lua_pushinteger(L, st.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, st.budget);
+    lua_setfield(L, -2, "budget");
+    lua_pushinteger(L, st.sessions);
+    lua_setfield(L, -2, "sessions");
+    lua_pushinteger(L, st.disabled);
+    lua_setfield(L, -2, "disabled");
+    lua_pushinteger(L, st.evicted);
+    lua_setfield(L, -2, "evicted");
+    lua_pushinteger(L, st.refused);
+    lua_setfield(L, -2, "refused");
+
+    return 1;
+}
+
+static int lpoll_ready(lua_State *L)
+{
+    rdt_manager_t *mng = get_manager(L);
+
+    int max = luaL_optinteger(L, 1, 64);
+    if (max <= 0) {
+        luaL_error(L, "bad max: %d", max);
+    }
+
+    int *sids = session_sid_buffer(mng, max);
+    if (sids == NULL) {
+        luaL_error(L, "out of memory");
+    }
+    int i, n = poll_ready_sessions(mng, sids, max);
+    lua_createtable(L, n, 0);
+    for (i = 0; i < n; i++) {
+        lua_pushinteger(L, sids[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+
+    return 1;
+}
+
+//rdt_poll_batch(sid, max): returns the pending frames as one string (or nil)
+//and an array of up to 'max' received messages
+static int lpoll_batch(lua_State *L)
+{
+    rdt_session_t *rdts = get_session(L);
+    int max = luaL_optinteger(L, 2, 64);
+
+    if (!lrdt_push_output(L, rdts)) {
+        lua_pushnil(L);
+    }
+    lua_createtable(L, max < 16 ? max : 16, 0);
+    lrdt_push_messages(L, rdts, 1, max);
+    lrdt_touch(get_manager(L), rdts);
+
+    return 2;
+}
+
+void lrdt_register(lua_State *L, rdt_manager_t *mng)
+{
+    const luaL_Reg method[] = {
+		{"rdt_delete", lrdt_delete},
+		{"rdt_disable", lrdt_disable},
+		{"rdt_ack", lrdt_ack},
+		{"rdt_send", lsend},
+		{"rdt_writable", lwritable},
+		{"rdt_cork", lcork},
+		{"rdt_uncork", luncork},
+		{"rdt_stat", lstat},
+		{"rdt_update", lupdate},
+		{"rdt_manager_tick", lmanager_tick},
+		{"rdt_set_grace", lset_grace},
+		{"rdt_set_mem_budget", lset_mem_budget},
+		{"rdt_mem_stat", lmem_stat},
+		{"rdt_compact_all", lcompact_all},
+		{"rdt_poll_ready", lpoll_ready},
+		{"rdt_poll_batch", lpoll_batch},
+		{NULL, NULL},
+    };
+
+    //every function finds the manager of its binding as upvalue 1
+    lua_pushlightuserdata(L, mng);
+    luaL_setfuncs(L, method, 1);
+}
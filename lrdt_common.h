@@ -0,0 +1,30 @@
+//what the server and client lua bindings share
+#ifndef __LRDT_COMMON_H__
+#define __LRDT_COMMON_H__
+
+#include "lua.h"
+#include "rdts_manager.h"
+
+#include <stdint.h>
+
+//a message inside the session stream: [sz(4)|buf]
+typedef struct message_s {
+    uint32_t sz;
+    char buf[0];
+} message_t;
+
+//the session named by argument 1, raises a lua error if there is none. 'flags': see find_session()
+rdt_session_t *lrdt_get_session(lua_State *L, rdt_manager_t *mng, int flags);
+//keep the manager ready list and the session timer in step, after any input or output
+void lrdt_touch(rdt_manager_t *mng, rdt_session_t *rdts);
+//push all pending frames as one string, returns 0 (and pushes nothing) if none
+int lrdt_push_output(lua_State *L, rdt_session_t *rdts);
+//append up to 'max' complete messages to the table on the stack top from index 'first', returns the count
+int lrdt_push_messages(lua_State *L, rdt_session_t *rdts, int first, int max);
+//call the rdt_recv handler (argument 3) for every complete message of session 'sid'
+void lrdt_recv_messages(lua_State *L, rdt_manager_t *mng, int sid);
+
+//register the rdt_* functions both bindings have into the table on the stack top
+void lrdt_register(lua_State *L, rdt_manager_t *mng);
+
+#endif
@@ -8,9 +8,11 @@
 #include "lualib.h"
 #include "lauxlib.h"
 
-#include "rdts_manager.h"
+#include "lrdt_common.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdlib.h>
 
 const int POOL_EMPTY = 0;
@@ -21,11 +23,6 @@ extern lua_State *gL;
 
 static rdt_manager_t *g_rdts_mng = NULL;
 
-typedef struct message_s {
-    uint32_t sz;
-    char buf[0];
-} message_t;
-
 typedef  struct poll_message_s {
     int sid;
     uint32_t sz;
@@ -49,55 +46,15 @@ static int pollin(rdt_session_t *rdts, poll_message_t *m)
 
     m->sid = rdts->sid;
     m->sz = len;
-    m->buf = (char *)malloc(len);
-    memcpy(m->buf, buf + sizeof(*msg), len);
-    rdts_drain_raw_rcv_buf(rdts, len + sizeof(*msg));
+    //points into raw_rcv_buf, the caller drains it once pushed to lua
+    m->buf = (char *)buf + sizeof(*msg);
 
     return POOL_IN;
 }
 
-static int pollout(rdt_session_t *rdts, poll_message_t *m)
-{
-    uint32_t total = rdts_get_snd_buf_length(rdts);
-    if (total <= 0) {
-        return POOL_EMPTY;
-    }
-
-    const char *buf = rdts_pullup_snd_buf(rdts);
-    m->sid = rdts->sid;
-    m->sz = total;
-    m->buf = (char *)malloc(total);
-    memcpy(m->buf, buf, total);
-    rdts_drain_snd_buf(rdts, total);
-
-    return POOL_OUT;
-}
-
 static rdt_session_t * get_session(lua_State *L)
 {
-    if (g_rdts_mng == NULL) {
-        luaL_error(L, "session manager not init");
-    }
-
-    int sid = luaL_optinteger(L, 1, 0);
-    if (sid <= 0) {
-        luaL_error(L, "need session id");
-    }
-
-    rdt_session_t *rdts = find_session(g_rdts_mng, sid, 1);
-    if (rdts == NULL) {
-        luaL_error(L, "rdt session not create: [%d]", sid);
-    }
-
-    return rdts;
-}
-
-static int lrdt_delete(lua_State *L)
-{
-    rdt_session_t *rdts = get_session(L);
-    delete_session(g_rdts_mng, rdts->sid);
-
-    return 0;
+    return lrdt_get_session(L, g_rdts_mng, SESSION_FIND_ENABLED);
 }
 
 static int lrdt_create(lua_State *L)
@@ -112,16 +69,16 @@ static int lrdt_create(lua_State *L)
         luaL_error(L, "session already create");
     }
 
-    create_session(g_rdts_mng, sid);
-    return 0;
-}
-
-static int lrdt_disable(lua_State *L)
-{
-    rdt_session_t *rdts = get_session(L);
-    disable_session(g_rdts_mng, rdts->sid);
-
-    return 0;
+    //NULL: over the memory budget (see rdt_mem_stat) or out of memory
+    rdts = create_session(g_rdts_mng, sid);
+    if (rdts == NULL) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    //keep unacked payload only once per session, in raw_snd_buf
+    rdts_set_snd_mode(rdts, RDTS_SND_REF);
+    lua_pushboolean(L, 1);
+    return 1;
 }
 
 static int lrdt_reconnect(lua_State *L)
@@ -135,7 +92,7 @@ static int lrdt_reconnect(lua_State *L)
         luaL_error(L, "need session id");
     }
 
-    rdt_session_t *rdts = find_session(g_rdts_mng, sid, 0);
+    rdt_session_t *rdts = find_session(g_rdts_mng, sid, SESSION_FIND_ADOPT);
     if (rdts == NULL) {
         luaL_error(L, "rdt session not create: [%d]", sid);
     }
@@ -144,48 +101,111 @@ static int lrdt_reconnect(lua_State *L)
     return 0;
 }
 
-static int lrdt_ack(lua_State *L)
+//rdt_dump(path) / rdt_load(path): session count, or nil and an error message
+static int ldump(lua_State *L)
 {
-    rdt_session_t *rdts = get_session(L);
-    ack_session(g_rdts_mng, rdts->sid);
+    const char *path = luaL_checkstring(L, 1);
+    int n;
+    if (g_rdts_mng == NULL) {
+        luaL_error(L, "session manager not init");
+    }
 
-    return 0;
+    n = dump_sessions(g_rdts_mng, path);
+    if (n < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    lua_pushinteger(L, n);
+    return 1;
 }
 
-static message_t *new_message(const char *buf, uint32_t len)
+static int lload(lua_State *L)
 {
-    message_t *msg = (message_t *)malloc(sizeof(*msg) + len);
-    msg->sz = len;
-    memcpy(msg->buf, (const void *)buf, len);
+    const char *path = luaL_checkstring(L, 1);
+    int n;
+    if (g_rdts_mng == NULL) {
+        luaL_error(L, "session manager not init");
+    }
 
-    return msg;
+    n = load_sessions(g_rdts_mng, path);
+    if (n < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    lua_pushinteger(L, n);
+    return 1;
 }
 
-static int lsend(lua_State *L)
+//rdt_handover(name, max_sessions, bytes): session count, or nil and an error message
+static int lhandover(lua_State *L)
 {
-    rdt_session_t *rdts = get_session(L);
-    size_t sz = 0;
-    const char *buf = luaL_checklstring(L, 2, &sz);
-    if (sz == 0) {
-        return 0;
+    const char *name = luaL_checkstring(L, 1);
+    uint32_t max_sessions = (uint32_t)luaL_checkinteger(L, 2);
+    uint64_t size = (uint64_t)luaL_checkinteger(L, 3);
+    int n;
+    if (g_rdts_mng == NULL) {
+        luaL_error(L, "session manager not init");
     }
 
-    message_t *msg = new_message(buf, (uint32_t)sz);
-    rdts_send(rdts, (const char *)msg, sizeof(*msg) + sz);
+    n = handover_sessions(g_rdts_mng, name, max_sessions, size);
+    if (n < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+//rdt_attach_store(name): true, or nil and an error message
+static int lattach_store(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    if (g_rdts_mng == NULL) {
+        luaL_error(L, "session manager not init");
+    }
+
+    if (attach_session_store(g_rdts_mng, name) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
 
+//rdt_detach_store([name]): the store is removed too if its name is given
+static int ldetach_store(lua_State *L)
+{
+    if (g_rdts_mng == NULL) {
+        luaL_error(L, "session manager not init");
+    }
+
+    detach_session_store(g_rdts_mng, luaL_optstring(L, 1, NULL));
     return 0;
 }
 
 static int lrecv(lua_State *L)
 {
-    rdt_session_t *rdts = get_session(L);
+    //data for a session handed over by the previous process picks it up from the store
+    rdt_session_t *rdts = lrdt_get_session(L, g_rdts_mng, SESSION_FIND_ENABLED | SESSION_FIND_ADOPT);
     size_t sz = 0;
     const char *buf = luaL_checklstring(L, 2, &sz);
     if (sz == 0) {
         return 0;
     }
 
+    //the delayed ack counts from now
+    update_session(g_rdts_mng, rdts);
     rdts_input(rdts, buf, sz);
+    if (lua_isfunction(L, 3)) {
+        lrdt_recv_messages(L, g_rdts_mng, rdts->sid);
+    } else {
+        lrdt_touch(g_rdts_mng, rdts);
+    }
+
     return 0;
 }
 
@@ -193,42 +213,92 @@ static int lpoll(lua_State *L)
 {
     rdt_session_t *rdts = get_session(L);
     poll_message_t m;
-    int t = pollout(rdts, &m);
-    if (t == POOL_EMPTY) {
-        t = pollin(rdts, &m);
+    int t;
+
+    lua_pushinteger(L, POOL_OUT);
+    lua_pushinteger(L, rdts->sid);
+    if (lrdt_push_output(L, rdts)) {
+        lrdt_touch(g_rdts_mng, rdts);
+        return 3;
     }
+    lua_pop(L, 2);
 
+    t = pollin(rdts, &m);
     if (t != POOL_EMPTY) {
         lua_pushinteger(L, t);
         lua_pushinteger(L, m.sid);
         lua_pushlstring(L, m.buf, m.sz);
-        free(m.buf);
-        m.buf = NULL;
+        rdts_drain_raw_rcv_buf(rdts, m.sz + sizeof(message_t));
+        lrdt_touch(g_rdts_mng, rdts);
 
         return 3;
     }
 
+    lrdt_touch(g_rdts_mng, rdts);
     return 0;
 }
 
+//rdt_poll_all(max_sessions, max_msgs): poll the ready sessions at once, returns an array of
+//{sid = sid, out = frames or nil, msg1, msg2, ...}
+static int lpoll_all(lua_State *L)
+{
+    if (g_rdts_mng == NULL) {
+        luaL_error(L, "session manager not init");
+    }
+
+    int max = luaL_optinteger(L, 1, 64);
+    int max_msgs = luaL_optinteger(L, 2, 64);
+    if (max <= 0) {
+        luaL_error(L, "bad max: %d", max);
+    }
+
+    int *sids = session_sid_buffer(g_rdts_mng, max);
+    if (sids == NULL) {
+        luaL_error(L, "out of memory");
+    }
+    int i, k = 0, n = poll_ready_sessions(g_rdts_mng, sids, max);
+    lua_createtable(L, n, 0);
+    for (i = 0; i < n; i++) {
+        rdt_session_t *rdts = find_session(g_rdts_mng, sids[i], SESSION_FIND_ENABLED);
+        if (rdts == NULL) {
+            continue;
+        }
+
+        lua_createtable(L, 0, 2);
+        lua_pushinteger(L, rdts->sid);
+        lua_setfield(L, -2, "sid");
+        if (lrdt_push_output(L, rdts)) {
+            lua_setfield(L, -2, "out");
+        }
+        lrdt_push_messages(L, rdts, 1, max_msgs);
+        lrdt_touch(g_rdts_mng, rdts);
+        lua_rawseti(L, -2, ++k);
+    }
+
+    return 1;
+}
+
 int luaopen_lsocket_server(lua_State *L)
 {
     gL = L;
     g_rdts_mng = rdt_manager_create();
 
     const luaL_Reg method[] = {
-		{"rdt_delete", lrdt_delete},
 		{"rdt_create", lrdt_create},
-		{"rdt_disable", lrdt_disable},
         {"rdt_reconnect", lrdt_reconnect},
-		{"rdt_ack", lrdt_ack},
-		{"rdt_send", lsend},
+		{"rdt_dump", ldump},
+		{"rdt_load", lload},
+		{"rdt_handover", lhandover},
+		{"rdt_attach_store", lattach_store},
+		{"rdt_detach_store", ldetach_store},
 		{"rdt_recv", lrecv},
 		{"rdt_poll", lpoll},
+		{"rdt_poll_all", lpoll_all},
 		// {"", },
 		{NULL, NULL},
     };
     luaL_newlib(L, method);
+    lrdt_register(L, g_rdts_mng);
 
     return 1;
 }
\ No newline at end of file
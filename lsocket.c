@@ -9,6 +9,7 @@
  */
 
 #include "mbuf.h"
+#include "rdts_io.h"
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -22,6 +23,9 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 #include <netdb.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -38,8 +42,16 @@
 #define LSOCKET_VERSION "1.1"
 
 #define LSOCKET "socket"
+#define LSOCKET_IO "socket.io"
+#define LSOCKET_POLLER "socket.poller"
+/* default size of each ring between the lua and the I/O thread */
+#define IO_RING_SIZE (4 * 1024 * 1024)
 #define TOSTRING_BUFSIZ 64
 #define READER_BUFSIZ 4096
+/* packets recv_packet returns at most, the next call returns the rest */
+#define RECV_PACKETS_MAX 256
+/* iovecs flush() hands to one sendmsg() */
+#define FLUSH_IOV_MAX 64
 #define LSOCKET_EMPTY "lsocket_empty_table"
 /* address families */
 #define LSOCKET_INET "inet"
@@ -69,6 +81,10 @@ typedef struct _lsocket_socket {
 	int protocol;
 	int listening;
 	mbuf_t *input_buf; //接收buf
+	mbuf_t *output_buf; //发送队列，第一次queue时分配
+	int epfd;		/* poller the socket is registered in, -1 if none */
+	uint32_t events;	/* the events it is registered for there */
+	int wpolled;		/* EPOLLOUT added by flush() while output is left */
 } lSocket;
 
 /* lsocket_checklSocket
@@ -125,12 +141,31 @@ static lSocket* lsocket_pushlSocket(lua_State *L)
 {
 	lSocket *sock = (lSocket*) lua_newuserdata(L, sizeof(lSocket));
 	sock->input_buf = (mbuf_t *)malloc(sizeof(mbuf_t));
-	mbuf_init(sock->input_buf, 10240);
+	mbuf_init_ring(sock->input_buf, 10240);
+	sock->output_buf = NULL;
+	sock->epfd = -1;
+	sock->events = 0;
+	sock->wpolled = 0;
 	luaL_getmetatable(L, LSOCKET);
 	lua_setmetatable(L, -2);
 	return sock;
 }
 
+/* _sock_free_output
+ * 
+ * helper: drops the send queue of a socket that is closed
+ */
+static void _sock_free_output(lSocket *sock)
+{
+	if (sock->output_buf) {
+		mbuf_free(sock->output_buf);
+		free(sock->output_buf);
+	}
+	sock->output_buf = NULL;
+	sock->epfd = -1;
+	sock->wpolled = 0;
+}
+
 /*** Housekeeping metamethods ***/
 
 /* lsocket_gc
@@ -152,6 +187,7 @@ static int lsocket_sock__gc(lua_State *L)
 	mbuf_free(sock->input_buf);
 	sock->sockfd = -1;
 	sock->input_buf = NULL;
+	_sock_free_output(sock);
 
 	return 0;
 }
@@ -777,9 +813,46 @@ static int lsocket_sock_recv(lua_State *L)
 	return 1;
 }
 
+//push the complete packets in 'in', or false if there is none
+static int lsocket_push_packets(lua_State *L, mbuf_t *in)
+{
+	uint32_t pkg_len;
+	const char *data;
+	int n = 0;
+
+	luaL_checkstack(L, RECV_PACKETS_MAX, "too many packets");
+	while (n < RECV_PACKETS_MAX && in->data_size >= sizeof(pkg_len)) {
+		data = mbuf_pullup(in);
+		memcpy(&pkg_len, data, sizeof(pkg_len));
+		if (in->data_size - sizeof(pkg_len) < pkg_len)
+			break;
+		lua_pushlstring(L, data + sizeof(pkg_len), pkg_len);
+		mbuf_drain(in, pkg_len + sizeof(pkg_len));
+		n++;
+	}
+
+	if (n == 0) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	return n;
+}
+
+//is there a complete packet in 'in'
+static int lsocket_has_packet(mbuf_t *in)
+{
+	uint32_t pkg_len;
+
+	if (in->data_size < sizeof(pkg_len))
+		return 0;
+	memcpy(&pkg_len, mbuf_pullup(in), sizeof(pkg_len));
+	return in->data_size - sizeof(pkg_len) >= pkg_len;
+}
+
 /* lsocket_sock_recv_pkg
  * 
- * reads packet from a socket
+ * reads packets from a socket. complete packets still buffered from the last
+ * call are returned without reading, so none wait for the next readable event.
  * 
  * Arguments:
  * 	L	Lua State
@@ -790,58 +863,44 @@ static int lsocket_sock_recv(lua_State *L)
  * 		to some internal value
  * 
  * Lua Returns:
- * 	+1	a string containing the packet data
+ * 	+1...	a string for each complete packet, at most RECV_PACKETS_MAX
  *  or +1 false if nonblocking socket returned EAGAIN (no data available)
+ *  or +1 false if no packet is complete yet
  *  or +1 nil if the remote end has closed the socket
  * 	or +1 nil, +2 error message on error
  */
-//接收一个完整包，包含一个4字节头部,来确认包的长度
+//接收完整包，包含一个4字节头部,来确认包的长度。直接读进input_buf的空闲空间，不另外分配
 static int lsocket_sock_recv_pkg(lua_State *L)
 {
 	lSocket *sock = lsocket_checklSocket(L, 1);
 	uint32_t howmuch = luaL_optnumber(L, 2, READER_BUFSIZ);
+	mbuf_t *in = sock->input_buf;
+	char *buf;
+	int nrd;
+
 	if (lua_tonumber(L, 2) > UINT_MAX)
 		return luaL_error(L, "bad argument #1 to 'recv' (invalid number)");
 
-	char *buf = malloc(howmuch);
-	int nrd = recv(sock->sockfd, buf, howmuch, 0);
+	if (lsocket_has_packet(in))
+		return lsocket_push_packets(L, in);
+
+	buf = (char *)mbuf_reserve(in, howmuch);
+	if (buf == NULL)
+		return lsocket_error(L, strerror(ENOMEM));
+	nrd = recv(sock->sockfd, buf, howmuch, 0);
 	if (nrd < 0) {
-		free(buf);
-		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
 			lua_pushboolean(L, 0);
-		else
-			return lsocket_error(L, strerror(errno));
+			return 1;
+		}
+		return lsocket_error(L, strerror(errno));
 	} else if (nrd == 0) {
-		free(buf);
 		lua_pushnil(L);
-	}
-	else {
-		mbuf_enq(sock->input_buf, buf, nrd);
-		free(buf);
-	}
-
-	if (nrd <= 0) {
-		return 1;
-	}
-
-	//check if we get a packet
-	uint32_t sz = sock->input_buf->data_size;
-	if (sz <= 4) {
-		lua_pushboolean(L, 0);
 		return 1;
 	}
+	mbuf_commit(in, nrd);
 
-	const char *data = mbuf_pullup(sock->input_buf);
-	uint32_t pkg_len = *(uint32_t *)data;
-	if (pkg_len + 4 > sz) {
-		lua_pushboolean(L, 0);
-		return 1;
-	}
-
-	lua_pushlstring(L, data + 4, pkg_len);
-	mbuf_drain(sock->input_buf, pkg_len + 4);
-
-	return 1;
+	return lsocket_push_packets(L, in);
 }
 
 //给数据打包成packet
@@ -1025,6 +1084,138 @@ static int lsocket_sock_sendto(lua_State *L)
 	return 1;
 }
 
+/* _sock_want_write
+ * 
+ * helper: adds EPOLLOUT to the poller registration of a socket while flush()
+ * leaves output queued, and takes it away again once the queue is empty
+ */
+static void _sock_want_write(lSocket *sock, int on)
+{
+#if defined(__linux__)
+	struct epoll_event ev;
+
+	if (sock->epfd < 0 || sock->wpolled == on)
+		return;
+	ev.events = sock->events | (on ? EPOLLOUT : 0);
+	ev.data.fd = sock->sockfd;
+	if (epoll_ctl(sock->epfd, EPOLL_CTL_MOD, sock->sockfd, &ev) == 0)
+		sock->wpolled = on;
+#endif
+}
+
+/* lsocket_sock_queue
+ * 
+ * appends data to the send queue of a socket, it is written by flush(). many
+ * small messages queued between two flushes go out in one system call
+ * 
+ * Arguments:
+ * 	L	Lua State
+ * 
+ * Lua Stack:
+ * 	1	the lSocket userdata
+ * 	2	string containing data to be queued
+ * 
+ * Lua Returns:
+ * 	+1	the number of bytes queued now
+ */
+static int lsocket_sock_queue(lua_State *L)
+{
+	lSocket *sock = lsocket_checklSocket(L, 1);
+	size_t len;
+	const char *data = luaL_checklstring(L, 2, &len);
+
+	if (sock->sockfd < 0)
+		return luaL_error(L, "bad argument #1 to 'queue' (socket is closed)");
+	if (sock->output_buf == NULL) {
+		sock->output_buf = (mbuf_t *)malloc(sizeof(mbuf_t));
+		mbuf_init_lazy(sock->output_buf, 10240);
+	}
+	if (len > UINT_MAX - sock->output_buf->data_size)
+		return luaL_error(L, "bad argument #2 to 'queue' (send queue too long)");
+	if (len > 0)
+		mbuf_enq(sock->output_buf, (void *)data, (uint32_t)len);
+
+	lua_pushnumber(L, sock->output_buf->data_size);
+	return 1;
+}
+
+/* lsocket_sock_flush
+ * 
+ * writes the send queue with as few sendmsg() calls (the writev of a socket)
+ * as the kernel takes, without copying it. when the kernel buffer is full the
+ * rest stays queued: a socket added to a poller is then reported writable by
+ * poller:wait() until a later flush() has written everything, without being
+ * added for "w" by hand
+ * 
+ * Arguments:
+ * 	L	Lua State
+ * 
+ * Lua Stack:
+ * 	1	the lSocket userdata
+ * 
+ * Lua Returns:
+ * 	+1	true if the queue is empty now
+ *  or +1 false, +2 the number of bytes still queued
+ * 	or +1 nil, +2 error message
+ */
+static int lsocket_sock_flush(lua_State *L)
+{
+	lSocket *sock = lsocket_checklSocket(L, 1);
+	mbuf_t *out = sock->output_buf;
+	struct iovec iov[FLUSH_IOV_MAX];
+	struct msghdr mh;
+	ssize_t nwr;
+	int err = 0;
+
+	if (out == NULL || out->data_size == 0) {
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+
+	int flags = 0;
+	#if defined(MSG_NOSIGNAL)
+	flags = MSG_NOSIGNAL;
+	#elif !defined(SO_NOSIGPIPE)
+	struct sigaction sa_old, sa_new;
+	sa_new.sa_handler = SIG_IGN;
+	sa_new.sa_flags = 0;
+	sigemptyset(&sa_new.sa_mask);
+	sigaction(SIGPIPE, &sa_new, &sa_old);
+	#endif
+
+	while (out->data_size > 0) {
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = mbuf_peek_iov(out, iov, FLUSH_IOV_MAX);
+		nwr = sendmsg(sock->sockfd, &mh, flags);
+		if (nwr < 0) {
+			if (errno == EINTR)
+				continue;
+			err = errno;
+			break;
+		}
+		mbuf_drain(out, (uint32_t)nwr);
+	}
+
+	#if !defined(MSG_NOSIGNAL) && !defined(SO_NOSIGPIPE)
+	sigaction(SIGPIPE, &sa_old, NULL);
+	#endif
+
+	if (err && err != EAGAIN && err != EWOULDBLOCK)
+		return lsocket_error(L, strerror(err));
+	if (out->data_size > 0) {
+		_sock_want_write(sock, 1);
+		lua_pushboolean(L, 0);
+		lua_pushnumber(L, out->data_size);
+		return 2;
+	}
+	/* a burst (a large resend) gives its blocks back */
+	mbuf_shrink(out);
+	_sock_want_write(sock, 0);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
 /* lsocket_sock_close
  * 
  * closes a socket
@@ -1048,6 +1239,7 @@ static int lsocket_sock_close(lua_State *L)
 	sock->sockfd = -1;
 	sock->type = -1;
 	sock->listening = 0;
+	_sock_free_output(sock);
 	if (err)
 		return lsocket_error(L, strerror(errno));
 	lua_pushboolean(L, 1);
@@ -1065,6 +1257,8 @@ static const struct luaL_Reg lSocket_methods [] ={
 	{"recvfrom", lsocket_sock_recvfrom},
 	{"send", lsocket_sock_send},
 	{"sendto", lsocket_sock_sendto},
+	{"queue", lsocket_sock_queue},
+	{"flush", lsocket_sock_flush},
 	{"close", lsocket_sock_close},
 	
 	{NULL, NULL}
@@ -1255,6 +1449,306 @@ static int lsocket_select(lua_State *L)
 	return nret;
 }
 
+#if defined(__linux__)
+
+/*** epoll poller ***/
+
+/* structure for the poller userdata. sockets stay registered between
+ * calls, 'ref' is a table with fd -> socket (to return the objects) and
+ * socket -> fd (to remove sockets that were closed in the meantime)
+ */
+typedef struct _lsocket_poller {
+	int epfd;
+	int edge;
+	int ref;
+	int count;
+	struct epoll_event *events;
+	int cap;
+} lPoller;
+
+static lPoller *lsocket_checklPoller(lua_State *L, int index)
+{
+	lPoller *p = (lPoller*) luaL_checkudata(L, index, LSOCKET_POLLER);
+	if (p->epfd < 0)
+		luaL_error(L, "poller is closed");
+	return p;
+}
+
+/* _poller_events
+ * 
+ * helper: maps a mode string with 'r' and/or 'w' to epoll events
+ */
+static uint32_t _poller_events(lua_State *L, lPoller *p, int idx)
+{
+	const char *mode = luaL_optstring(L, idx, "r");
+	uint32_t events = p->edge ? EPOLLET : 0;
+	if (strchr(mode, 'r'))
+		events |= EPOLLIN | EPOLLRDHUP;
+	if (strchr(mode, 'w'))
+		events |= EPOLLOUT;
+	if (!(events & (EPOLLIN | EPOLLOUT)))
+		luaL_error(L, "bad argument #%d (mode must contain 'r' or 'w')", idx);
+	return events;
+}
+
+/* lsocket_poller
+ * 
+ * creates an epoll poller. unlike select there is no FD_SETSIZE limit, and
+ * a wait costs O(ready sockets) instead of O(sockets).
+ * 
+ * Lua Stack:
+ * 	1	(opt) true for edge triggered mode: a socket is returned once per
+ * 		readiness change, so it has to be read (written) until EAGAIN
+ * 
+ * Lua Returns:
+ * 	+1	the poller userdata
+ * 	or +1 nil, +2 error message
+ */
+static int lsocket_poller(lua_State *L)
+{
+	int edge = lua_toboolean(L, 1);
+	lPoller *p = (lPoller*) lua_newuserdata(L, sizeof(lPoller));
+	p->epfd = -1;
+	p->events = NULL;
+	p->cap = 0;
+	p->count = 0;
+	p->edge = edge;
+	p->ref = LUA_NOREF;
+	luaL_getmetatable(L, LSOCKET_POLLER);
+	lua_setmetatable(L, -2);
+
+	p->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (p->epfd < 0)
+		return lsocket_error(L, strerror(errno));
+	lua_newtable(L);
+	p->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	return 1;
+}
+
+/* lsocket_poller_add
+ * 
+ * registers a socket, or changes the mode of a registered one
+ * 
+ * Lua Stack:
+ * 	1	the poller userdata
+ * 	2	the lSocket userdata
+ * 	3	(opt) mode: "r" (default), "w" or "rw"
+ * 
+ * Lua Returns:
+ * 	+1	true
+ * 	or +1 nil, +2 error message
+ */
+static int lsocket_poller_add(lua_State *L)
+{
+	lPoller *p = lsocket_checklPoller(L, 1);
+	lSocket *sock = lsocket_checklSocket(L, 2);
+	struct epoll_event ev;
+	int op = EPOLL_CTL_ADD;
+
+	if (sock->sockfd < 0)
+		return luaL_error(L, "bad argument #2 to 'add' (socket is closed)");
+	ev.events = _poller_events(L, p, 3);
+	ev.data.fd = sock->sockfd;
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, p->ref);
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+	if (!lua_isnil(L, -1))
+		op = EPOLL_CTL_MOD;
+	lua_pop(L, 1);
+
+	if (epoll_ctl(p->epfd, op, sock->sockfd, &ev) < 0)
+		return lsocket_error(L, strerror(errno));
+	/* flush() adds EPOLLOUT here while output is queued */
+	sock->epfd = p->epfd;
+	sock->events = ev.events;
+	sock->wpolled = 0;
+	if (sock->output_buf && sock->output_buf->data_size > 0)
+		_sock_want_write(sock, 1);
+	if (op == EPOLL_CTL_ADD) {
+		lua_pushvalue(L, 2);
+		lua_rawseti(L, -2, sock->sockfd);
+		lua_pushvalue(L, 2);
+		lua_pushinteger(L, sock->sockfd);
+		lua_rawset(L, -3);
+		p->count++;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/* lsocket_poller_del
+ * 
+ * unregisters a socket, also one that has been closed since it was added
+ * 
+ * Lua Stack:
+ * 	1	the poller userdata
+ * 	2	the lSocket userdata
+ * 
+ * Lua Returns:
+ * 	+1	true, or false if the socket was not registered
+ */
+static int lsocket_poller_del(lua_State *L)
+{
+	lPoller *p = lsocket_checklPoller(L, 1);
+	lSocket *sock = lsocket_checklSocket(L, 2);
+	int fd;
+
+	if (sock->epfd == p->epfd) {
+		sock->epfd = -1;
+		sock->wpolled = 0;
+	}
+	lua_rawgeti(L, LUA_REGISTRYINDEX, p->ref);
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+	if (lua_isnil(L, -1)) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	fd = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, 2);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	/* a closed socket has left the epoll set by itself, and its fd may
+	 * belong to another registered socket by now */
+	lua_rawgeti(L, -1, fd);
+	if (lua_rawequal(L, -1, 2)) {
+		epoll_ctl(p->epfd, EPOLL_CTL_DEL, fd, NULL);
+		lua_pushnil(L);
+		lua_rawseti(L, -3, fd);
+	}
+	p->count--;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/* lsocket_poller_wait
+ * 
+ * waits for registered sockets to become ready
+ * 
+ * Lua Stack:
+ * 	1	the poller userdata
+ * 	2	(opt) timeout in seconds, waits forever if not given, like select
+ * 	3	(opt) max sockets to return, default 256
+ * 
+ * Lua Returns:
+ * 	+1, +2	tables of sockets ready for reading (closed and failed ones
+ * 		included, recv tells) and for writing
+ * 	or +1 false on timeout
+ * 	or +1 nil, +2 error message
+ */
+static int lsocket_poller_wait(lua_State *L)
+{
+	lPoller *p = lsocket_checklPoller(L, 1);
+	double timeo = luaL_optnumber(L, 2, -1);
+	int max = luaL_optinteger(L, 3, 256);
+	int i, n, nr = 0, nw = 0;
+
+	if (max <= 0)
+		return luaL_error(L, "bad argument #3 to 'wait' (must be positive)");
+	if (max > p->cap) {
+		struct epoll_event *events = realloc(p->events, max * sizeof(struct epoll_event));
+		if (events == NULL)
+			return lsocket_error(L, strerror(ENOMEM));
+		p->events = events;
+		p->cap = max;
+	}
+
+	n = epoll_wait(p->epfd, p->events, max, timeo < 0 ? -1 : (int)(timeo * 1000));
+	if (n < 0 && errno != EINTR)
+		return lsocket_error(L, strerror(errno));
+	if (n <= 0) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, p->ref);
+	lua_newtable(L);
+	lua_newtable(L);
+	for (i = 0; i < n; i++) {
+		uint32_t ev = p->events[i].events;
+		lua_rawgeti(L, -3, p->events[i].data.fd);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			continue;
+		}
+		if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, -4, ++nr);
+		}
+		if (ev & EPOLLOUT) {
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, -3, ++nw);
+		}
+		lua_pop(L, 1);
+	}
+	return 2;
+}
+
+/* lsocket_poller_count
+ * 
+ * Lua Returns:
+ * 	+1	number of registered sockets
+ */
+static int lsocket_poller_count(lua_State *L)
+{
+	lPoller *p = lsocket_checklPoller(L, 1);
+	lua_pushinteger(L, p->count);
+	return 1;
+}
+
+/* lsocket_poller_close
+ * 
+ * closes the poller, the sockets stay open. also the __gc metamethod
+ */
+static int lsocket_poller_close(lua_State *L)
+{
+	lPoller *p = (lPoller*) luaL_checkudata(L, 1, LSOCKET_POLLER);
+	if (p->epfd >= 0) {
+		/* its sockets must not touch the epoll fd (or a reuse of it) later */
+		lua_rawgeti(L, LUA_REGISTRYINDEX, p->ref);
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			if (lsocket_islSocket(L, -1)) {
+				lSocket *sock = (lSocket*) lua_touserdata(L, -1);
+				if (sock->epfd == p->epfd) {
+					sock->epfd = -1;
+					sock->wpolled = 0;
+				}
+			}
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+		close(p->epfd);
+	}
+	p->epfd = -1;
+	luaL_unref(L, LUA_REGISTRYINDEX, p->ref);
+	p->ref = LUA_NOREF;
+	free(p->events);
+	p->events = NULL;
+	p->cap = 0;
+	return 0;
+}
+
+static const luaL_Reg lPoller_meta[] = {
+	{"__gc", lsocket_poller_close},
+	{0, 0}
+};
+
+static const struct luaL_Reg lPoller_methods [] ={
+	{"add", lsocket_poller_add},
+	{"del", lsocket_poller_del},
+	{"wait", lsocket_poller_wait},
+	{"count", lsocket_poller_count},
+	{"close", lsocket_poller_close},
+
+	{NULL, NULL}
+};
+
+#endif
+
 /* lsocket_resolve
  * 
  * resolves a name to an address
@@ -1363,6 +1857,240 @@ static int lsocket_getinterfaces(lua_State *L)
 
 /* Function list
  */
+/*** I/O thread ***/
+
+/* structure for the I/O thread userdata */
+typedef struct _lsocket_io {
+	rdts_io_t *io;
+} lIo;
+
+static lIo *lsocket_checklIo(lua_State *L, int index)
+{
+	lIo *lio = (lIo*) luaL_checkudata(L, index, LSOCKET_IO);
+	if (lio->io == NULL)
+		luaL_error(L, "I/O thread stopped");
+	return lio;
+}
+
+/* lsocket_io_start
+ * 
+ * starts a network I/O thread. sockets handed to it with io:add() are read
+ * and written by that thread, complete packets (as sent with pack_msg) are
+ * taken with io:poll(), so a slow lua step never stalls the socket reads.
+ * the thread waits with io_uring where the kernel has it (6.0 or later),
+ * else with epoll, else with poll().
+ * 
+ * Arguments:
+ * 	L	Lua State
+ * 
+ * Lua Stack:
+ * 	1	(opt) bytes of each ring between the threads, default 4MB
+ * 	2	(opt) "uring", "epoll" or "poll" to force a backend
+ * 
+ * Lua Returns:
+ * 	+1	the I/O thread userdata
+ * 	or +1 nil, +2 error message
+ */
+static int lsocket_io_start(lua_State *L)
+{
+	static const char *const backends[] = {"auto", "uring", "epoll", "poll", NULL};
+	uint32_t size = (uint32_t)luaL_optinteger(L, 1, IO_RING_SIZE);
+	int backend = luaL_checkoption(L, 2, "auto", backends);
+	lIo *lio = (lIo*) lua_newuserdata(L, sizeof(lIo));
+	lio->io = rdts_io_create(size, backend);
+	if (lio->io == NULL)
+		return lsocket_error(L, strerror(errno));
+	luaL_getmetatable(L, LSOCKET_IO);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+/* lsocket_io_add
+ * 
+ * hands a socket over to the I/O thread, the lSocket is closed for lua
+ * afterwards. input it has buffered (recv_packet) goes along. connections
+ * accepted on a listening socket are added by the I/O thread itself. a
+ * socket still registered in a poller must be removed from it first.
+ * 
+ * Lua Stack:
+ * 	1	the I/O thread userdata
+ * 	2	the lSocket userdata
+ * 
+ * Lua Returns:
+ * 	+1	connection id
+ * 	or +1 false if the command ring is full, try again later
+ */
+static int lsocket_io_add(lua_State *L)
+{
+	lIo *lio = lsocket_checklIo(L, 1);
+	lSocket *sock = lsocket_checklSocket(L, 2);
+	mbuf_t *in = sock->input_buf;
+	uint32_t len = in ? in->data_size : 0;
+	int id;
+
+	if (sock->sockfd < 0)
+		return luaL_error(L, "bad argument #2 to 'add' (socket is closed)");
+	if (sock->output_buf && sock->output_buf->data_size > 0)
+		return luaL_error(L, "bad argument #2 to 'add' (output is still queued, flush first)");
+	/* the poller would keep watching an fd that is no longer lua's */
+	if (sock->epfd >= 0)
+		return luaL_error(L, "bad argument #2 to 'add' (socket is in a poller, del it first)");
+	id = rdts_io_add(lio->io, sock->sockfd, sock->listening, len ? mbuf_pullup(in) : NULL, len);
+	if (id < 0) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	if (len)
+		mbuf_drain(in, len);
+	sock->sockfd = -1;
+	_sock_free_output(sock);
+	lua_pushinteger(L, id);
+	return 1;
+}
+
+/* lsocket_io_send
+ * 
+ * queues data as one packet (length header added) for a connection
+ * 
+ * Lua Stack:
+ * 	1	the I/O thread userdata
+ * 	2	connection id
+ * 	3	string to send
+ * 
+ * Lua Returns:
+ * 	+1	true, or false if the command ring is full
+ */
+static int lsocket_io_send(lua_State *L)
+{
+	lIo *lio = lsocket_checklIo(L, 1);
+	int id = luaL_checkinteger(L, 2);
+	size_t len;
+	const char *data = luaL_checklstring(L, 3, &len);
+
+	if (len > rdts_io_max_packet(lio->io))
+		return luaL_error(L, "bad argument #3 to 'send' (packet too large)");
+	lua_pushboolean(L, rdts_io_send(lio->io, id, data, (uint32_t)len) == 0);
+	return 1;
+}
+
+/* lsocket_io_close
+ * 
+ * closes a connection once its queued output is written
+ * 
+ * Lua Returns:
+ * 	+1	true, or false if the command ring is full
+ */
+static int lsocket_io_close(lua_State *L)
+{
+	lIo *lio = lsocket_checklIo(L, 1);
+	int id = luaL_checkinteger(L, 2);
+
+	lua_pushboolean(L, rdts_io_close(lio->io, id) == 0);
+	return 1;
+}
+
+/* lsocket_io_poll
+ * 
+ * takes events from the I/O thread, waiting for the first one up to timeout
+ * 
+ * Lua Stack:
+ * 	1	the I/O thread userdata
+ * 	2	(opt) timeout in seconds, waits forever if not given, like select
+ * 	3	(opt) max events to return, default 256
+ * 
+ * Lua Returns:
+ * 	+1	array of events:
+ * 		{id = id, data = packet}
+ * 		{id = id, accept = true, ip = ip, port = port}
+ * 		{id = id, closed = true, err = error message or nil on EOF}
+ */
+static int lsocket_io_poll(lua_State *L)
+{
+	lIo *lio = lsocket_checklIo(L, 1);
+	double timeo = luaL_optnumber(L, 2, -1);
+	int max = luaL_optinteger(L, 3, 256);
+	const char *data;
+	uint32_t len;
+	int id, type, n = 0;
+	char ipbuf[TOSTRING_BUFSIZ];
+
+	rdts_io_wait(lio->io, timeo < 0 ? -1 : (int)(timeo * 1000));
+	lua_newtable(L);
+	while (n < max && (data = rdts_io_peek(lio->io, &id, &type, &len)) != NULL) {
+		lua_createtable(L, 0, 3);
+		lua_pushinteger(L, id);
+		lua_setfield(L, -2, "id");
+		if (type == RDTS_IO_DATA) {
+			lua_pushlstring(L, data, len);
+			lua_setfield(L, -2, "data");
+		} else if (type == RDTS_IO_ACCEPT) {
+			struct sockaddr *sa = (struct sockaddr*) data;
+			lua_pushboolean(L, 1);
+			lua_setfield(L, -2, "accept");
+			if (_addr2string(sa, ipbuf, TOSTRING_BUFSIZ)) {
+				lua_pushstring(L, ipbuf);
+				lua_setfield(L, -2, "ip");
+			}
+			lua_pushinteger(L, _portnumber(sa));
+			lua_setfield(L, -2, "port");
+		} else {
+			lua_pushboolean(L, 1);
+			lua_setfield(L, -2, "closed");
+			if (len > 0) {
+				lua_pushlstring(L, data, len);
+				lua_setfield(L, -2, "err");
+			}
+		}
+		lua_rawseti(L, -2, ++n);
+		rdts_io_pop(lio->io);
+	}
+	return 1;
+}
+
+/* lsocket_io_backend
+ * 
+ * Lua Stack:
+ * 	1	the I/O thread userdata
+ * 
+ * Lua Returns:
+ * 	+1	"uring", "epoll" or "poll", what the thread waits with
+ */
+static int lsocket_io_backend(lua_State *L)
+{
+	lIo *lio = lsocket_checklIo(L, 1);
+	lua_pushstring(L, rdts_io_backend(lio->io));
+	return 1;
+}
+
+/* lsocket_io_stop
+ * 
+ * stops the I/O thread and closes all its connections, also the __gc metamethod
+ */
+static int lsocket_io_stop(lua_State *L)
+{
+	lIo *lio = (lIo*) luaL_checkudata(L, 1, LSOCKET_IO);
+	if (lio->io)
+		rdts_io_release(lio->io);
+	lio->io = NULL;
+	return 0;
+}
+
+static const luaL_Reg lIo_meta[] = {
+	{"__gc", lsocket_io_stop},
+	{0, 0}
+};
+
+static const struct luaL_Reg lIo_methods [] ={
+	{"add", lsocket_io_add},
+	{"send", lsocket_io_send},
+	{"close", lsocket_io_close},
+	{"poll", lsocket_io_poll},
+	{"backend", lsocket_io_backend},
+	{"stop", lsocket_io_stop},
+
+	{NULL, NULL}
+};
+
 static const struct luaL_Reg lsocket [] ={
 	{"connect", lsocket_connect},
 	{"bind", lsocket_bind},
@@ -1370,6 +2098,10 @@ static const struct luaL_Reg lsocket [] ={
 	{"resolve", lsocket_resolve},
 	{"getinterfaces", lsocket_getinterfaces},
 	{"pack_msg", lsocket_packet_pack},
+	{"io_start", lsocket_io_start},
+#if defined(__linux__)
+	{"poller", lsocket_poller},
+#endif
 	
 	{NULL, NULL}
 };
@@ -1419,6 +2151,24 @@ int luaopen_lsocket(lua_State *L)
 	/* cleanup */
 	lua_pop(L, 1);
 
+#if defined(__linux__)
+	/* poller userdata metatable */
+	luaL_newmetatable(L, LSOCKET_POLLER);
+	luaL_setfuncs(L, lPoller_meta, 0);
+	lua_pushliteral(L, "__index");
+	luaL_newlib(L, lPoller_methods);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+#endif
+
+	/* I/O thread userdata metatable */
+	luaL_newmetatable(L, LSOCKET_IO);
+	luaL_setfuncs(L, lIo_meta, 0);
+	lua_pushliteral(L, "__index");
+	luaL_newlib(L, lIo_methods);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
 	/* finally, create an empty table and store it in the registry, so
 	 * that we don't create loads of garbage for empty tables we might
 	 * return from select */
@@ -1,20 +1,185 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 
 #include "mbuf.h"
 #include <errno.h>
 
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #define MIN_BLK_SIZE 4 
 #define BLK_FACTOR 4 
 
 #define BLK_SIZE  (2048)
+//rings are mapped twice, and their size must stay a uint32
+#define RING_MAX_SIZE 0x80000000u
+
+//size classes: 4 classes per power of two, from 64B up to 1MB
+#define POOL_MIN_SHIFT 6
+#define POOL_MAX_SHIFT 20
+#define POOL_STEPS 4
+#define POOL_CLASS_COUNT ((POOL_MAX_SHIFT - POOL_MIN_SHIFT) * POOL_STEPS + 1)
+#define POOL_LIMIT_DEFAULT (32 * 1024 * 1024)
+
+typedef struct mbuf_pool_s {
+	mbuf_blk_t *free_list[POOL_CLASS_COUNT];
+	mbuf_pool_stat_t stat;
+} mbuf_pool_t;
+
+//one per thread, so session threads never contend on it
+static __thread mbuf_pool_t g_pool = { {NULL}, {0, 0, 0, 0, 0, 0, POOL_LIMIT_DEFAULT} };
 
 inline static void blk_buf_init(mbuf_blk_t *blk)
 {
 	blk->head = blk->tail = blk->buf;
 }
 
+//-----------------------------
+//map size to its class, returns -1 if the size is too large to be pooled
+//-----------------------------
+static int pool_class(uint32_t size, uint32_t *class_size)
+{
+	uint32_t shift = POOL_MIN_SHIFT, step, q;
+
+	if (size <= (1u << POOL_MIN_SHIFT)) {
+		*class_size = 1u << POOL_MIN_SHIFT;
+		return 0;
+	}
+	if (size > (1u << POOL_MAX_SHIFT)) {
+		*class_size = size;
+		return -1;
+	}
+
+	//2^shift < size <= 2^(shift+1)
+	while ((1u << (shift + 1)) < size) {
+		shift++;
+	}
+	step = 1u << (shift - 2);
+	q = (size + step - 1) >> (shift - 2);
+	*class_size = q << (shift - 2);
+
+	return (shift - POOL_MIN_SHIFT) * POOL_STEPS + q - POOL_STEPS;
+}
+
+static mbuf_blk_t *pool_get(uint32_t size)
+{
+	uint32_t class_size;
+	int idx = pool_class(size, &class_size);
+	mbuf_blk_t *blk = NULL;
+
+	if (idx >= 0 && g_pool.free_list[idx]) {
+		blk = g_pool.free_list[idx];
+		g_pool.free_list[idx] = blk->next;
+		g_pool.stat.hits++;
+		g_pool.stat.cached_blocks--;
+		g_pool.stat.cached_bytes -= blk->size;
+	} else {
+		//block header and data share one allocation
+		blk = (mbuf_blk_t *)malloc(sizeof(mbuf_blk_t) + class_size);
+		if (blk == NULL) {
+			return NULL;
+		}
+		blk->buf = (char *)(blk + 1);
+		blk->size = class_size;
+		blk->end = blk->buf + blk->size;
+		g_pool.stat.misses++;
+	}
+
+	blk->next = NULL;
+	blk->mbuf = NULL;
+	blk->id = 0;
+	blk_buf_init(blk);
+
+	return blk;
+}
+
+static void pool_put(mbuf_blk_t *blk)
+{
+	uint32_t class_size;
+	int idx = pool_class(blk->size, &class_size);
+
+	if (idx < 0 || g_pool.stat.cached_bytes + blk->size > g_pool.stat.limit) {
+		g_pool.stat.drops++;
+		free(blk);
+		return;
+	}
+
+	blk->mbuf = NULL;
+	blk->next = g_pool.free_list[idx];
+	g_pool.free_list[idx] = blk;
+	g_pool.stat.releases++;
+	g_pool.stat.cached_blocks++;
+	g_pool.stat.cached_bytes += blk->size;
+}
+
+void mbuf_pool_set_limit(uint64_t limit)
+{
+	int i;
+	mbuf_blk_t *blk;
+
+	g_pool.stat.limit = limit;
+
+	//trim from the largest class down until we are under the new limit
+	for (i = POOL_CLASS_COUNT - 1; i >= 0 && g_pool.stat.cached_bytes > limit; i--) {
+		while ((blk = g_pool.free_list[i]) != NULL && g_pool.stat.cached_bytes > limit) {
+			g_pool.free_list[i] = blk->next;
+			g_pool.stat.cached_blocks--;
+			g_pool.stat.cached_bytes -= blk->size;
+			free(blk);
+		}
+	}
+}
+
+void mbuf_pool_get_stat(mbuf_pool_stat_t *stat)
+{
+	*stat = g_pool.stat;
+}
+
+void mbuf_pool_clear(void)
+{
+	uint64_t limit = g_pool.stat.limit;
+	mbuf_pool_set_limit(0);
+	g_pool.stat.limit = limit;
+}
+
+//every alloc_size change goes through here, so the counters stay in step
+static void mbuf_account(mbuf_t *mbuf, uint32_t size)
+{
+	mbuf_acct_t *a;
+	for (a = mbuf->acct; a; a = a->parent) {
+		a->bytes = a->bytes - mbuf->alloc_size + size;
+	}
+	mbuf->alloc_size = size;
+}
+
+void mbuf_set_acct(mbuf_t *mbuf, mbuf_acct_t *acct)
+{
+	uint32_t size = mbuf->alloc_size;
+
+	mbuf_account(mbuf, 0);
+	mbuf->acct = acct;
+	mbuf_account(mbuf, size);
+}
+
+void mbuf_acct_attach(mbuf_acct_t *acct, mbuf_acct_t *parent)
+{
+	mbuf_acct_t *a;
+
+	for (a = acct->parent; a; a = a->parent) {
+		a->bytes -= acct->bytes;
+	}
+	acct->parent = parent;
+	for (a = parent; a; a = a->parent) {
+		a->bytes += acct->bytes;
+	}
+}
+
 mbuf_blk_t *mbuf_add_blk(mbuf_t *mbuf, uint32_t size)
 {
-	mbuf_blk_t *blk = (mbuf_blk_t *)calloc(1, sizeof(mbuf_blk_t));
+	mbuf_blk_t *blk;
 
 	size = mbuf->hint_size > size ? mbuf->hint_size : size;
 	size = BLK_FACTOR * ((size + BLK_FACTOR - 1) / BLK_FACTOR);
@@ -22,12 +187,9 @@ mbuf_blk_t *mbuf_add_blk(mbuf_t *mbuf, uint32_t size)
 		size = MIN_BLK_SIZE;
 	}
 
+	blk = pool_get(size);
 	blk->id = mbuf->blk_count;	
 	blk->mbuf = mbuf;
-	blk->buf = (char*)malloc(size);
-	blk->size = size;
-	blk->end = blk->buf + blk->size;
-	blk_buf_init(blk);
 
 
 	blk->next = NULL;
@@ -38,15 +200,200 @@ mbuf_blk_t *mbuf_add_blk(mbuf_t *mbuf, uint32_t size)
 		mbuf->tail = blk;
 	}
 	
+	if (mbuf->blk_deq == NULL) {
+		mbuf->blk_deq = blk;
+	}
 	mbuf->blk_count++;
 	mbuf->blk_enq = blk;
-	mbuf->alloc_size += blk->size;
+	mbuf_account(mbuf, mbuf->alloc_size + blk->size);
 
 	return blk;
 }
 
-void mbuf_init(mbuf_t *mbuf, uint32_t blk_size)
+//-----------------------------
+//ring mode
+//the same pages are mapped twice back to back, so data wrapping around
+//the end of the ring can still be read as one contiguous span.
+//-----------------------------
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+static uint32_t ring_round(uint32_t size)
+{
+	uint32_t page = (uint32_t)sysconf(_SC_PAGESIZE);
+	return (size + page - 1) / page * page;
+}
+
+static char *ring_map(uint32_t size)
+{
+	char *base, *p;
+	int fd = memfd_create("mbuf_ring", MFD_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	base = (char *)mmap(NULL, (size_t)size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	p = (char *)mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	if (p != MAP_FAILED) {
+		p = (char *)mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	}
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		munmap(base, (size_t)size * 2);
+		return NULL;
+	}
+
+	return base;
+}
+
+static void ring_unmap(char *ring, uint32_t size)
+{
+	munmap(ring, (size_t)size * 2);
+}
+#else
+static uint32_t ring_round(uint32_t size)
+{
+	return size;
+}
+
+static char *ring_map(uint32_t size)
+{
+	return NULL;
+}
+
+static void ring_unmap(char *ring, uint32_t size)
+{
+}
+#endif
+
+//move the data to a new ring of 'size' bytes, it must fit
+static int ring_resize(mbuf_t *mbuf, uint32_t size)
+{
+	char *ring = ring_map(size);
+	if (ring == NULL) {
+		return -1;
+	}
+
+	memcpy(ring, mbuf->ring + mbuf->ring_off, mbuf->data_size);
+	ring_unmap(mbuf->ring, mbuf->alloc_size);
+
+	mbuf->ring = ring;
+	mbuf->ring_off = 0;
+	mbuf_account(mbuf, size);
+
+	return 0;
+}
+
+static void mbuf_setup(mbuf_t *mbuf, uint32_t blk_size);
+
+//the ring can't grow (out of mappings or memory, or too large): the data moves into a
+//block and the mbuf goes on in block mode
+static void ring_to_blocks(mbuf_t *mbuf)
+{
+	char *ring = mbuf->ring;
+	uint32_t size = mbuf->alloc_size, off = mbuf->ring_off, len = mbuf->data_size;
+	mbuf_blk_t *blk;
+
+	mbuf_account(mbuf, 0);
+	mbuf_setup(mbuf, mbuf->hint_size);
+	if (len > 0) {
+		blk = mbuf_add_blk(mbuf, len);
+		memcpy(blk->tail, ring + off, len);
+		MBUF_ADVANCE(mbuf, blk, len);
+	}
+	ring_unmap(ring, size);
+}
+
+//grow the ring so at least 'len' more bytes fit, the old data is moved once.
+//-1 if it can't, the mbuf is in block mode then
+static int ring_grow(mbuf_t *mbuf, uint32_t len)
+{
+	uint64_t need = (uint64_t)mbuf->data_size + len;
+	uint64_t size = (uint64_t)mbuf->alloc_size * 2;
+
+	if (size > RING_MAX_SIZE) {
+		size = RING_MAX_SIZE;
+	}
+	if (size < need) {
+		size = need;
+	}
+
+	if (size > RING_MAX_SIZE || ring_resize(mbuf, ring_round((uint32_t)size)) < 0) {
+		ring_to_blocks(mbuf);
+		return -1;
+	}
+	return 0;
+}
+
+void *mbuf_ring_alloc(mbuf_t *mbuf, uint32_t len)
 {
+	char *p;
+
+	if (mbuf->alloc_size - mbuf->data_size < len && ring_grow(mbuf, len) < 0) {
+		return MBUF_ALLOC(mbuf, len);
+	}
+
+	//may land in the mirror half, which is the same memory
+	p = mbuf->ring + mbuf->ring_off + mbuf->data_size;
+	mbuf->data_size += len;
+
+	return p;
+}
+
+static uint32_t ring_deq(mbuf_t *mbuf, void *ret, uint32_t len)
+{
+	if (len > mbuf->data_size) {
+		len = mbuf->data_size;
+	}
+
+	if (ret != NULL) {
+		memcpy(ret, mbuf->ring + mbuf->ring_off, len);
+	}
+
+	mbuf->data_size -= len;
+	mbuf->ring_off = mbuf->data_size == 0 ? 0 : (mbuf->ring_off + len) % mbuf->alloc_size;
+
+	return len;
+}
+
+int mbuf_init_ring(mbuf_t *mbuf, uint32_t size)
+{
+	size = ring_round(size == 0 ? BLK_SIZE : size);
+
+	mbuf->acct = NULL;
+	mbuf->ring = ring_map(size);
+	if (mbuf->ring == NULL) {
+		mbuf_init(mbuf, size);
+		return -1;
+	}
+
+	mbuf->hint_size = size;
+	mbuf->alloc_size = size;
+	mbuf->ring_off = 0;
+	mbuf->data_size = 0;
+	mbuf->blk_enq = NULL;
+	mbuf->blk_deq = NULL;
+	mbuf->blk_count = 0;
+	mbuf->head = NULL;
+	mbuf->tail = NULL;
+
+	return 0;
+}
+
+//everything but the counter, no block is allocated
+static void mbuf_setup(mbuf_t *mbuf, uint32_t blk_size)
+{
+	mbuf->ring = NULL;
+	mbuf->ring_off = 0;
 	mbuf->hint_size = blk_size == 0 ? BLK_SIZE : blk_size;
 	mbuf->data_size = 0;
 	mbuf->blk_enq = NULL;
@@ -55,25 +402,63 @@ void mbuf_init(mbuf_t *mbuf, uint32_t blk_size)
 	mbuf->alloc_size = 0;
 	mbuf->head = NULL;
 	mbuf->tail = NULL;
-	mbuf->blk_deq = mbuf_add_blk(mbuf, mbuf->hint_size);
+}
+
+void mbuf_init_lazy(mbuf_t *mbuf, uint32_t blk_size)
+{
+	mbuf->acct = NULL;
+	mbuf_setup(mbuf, blk_size);
+}
+
+void mbuf_init(mbuf_t *mbuf, uint32_t blk_size)
+{
+	mbuf_init_lazy(mbuf, blk_size);
+	mbuf_add_blk(mbuf, mbuf->hint_size);
 }
 
 void mbuf_free(mbuf_t *mbuf)
 {
 	mbuf_blk_t *blk, *tmp;
 
+	if (mbuf->ring) {
+		ring_unmap(mbuf->ring, mbuf->alloc_size);
+		mbuf->ring = NULL;
+		mbuf_account(mbuf, 0);
+		return;
+	}
+
 	for (blk = mbuf->head; blk && (tmp = blk->next, 1); blk = tmp) {
 		mbuf->blk_count--;
-		free(blk->buf);
-		free(blk);
+		pool_put(blk);
 	}
+	mbuf_account(mbuf, 0);
 }
 
 void mbuf_reset(mbuf_t *mbuf, uint32_t reset_size)
 {
+	if (mbuf->ring) {
+		mbuf->data_size = 0;
+		mbuf->ring_off = 0;
+		if (reset_size > mbuf->alloc_size) {
+			ring_grow(mbuf, reset_size);
+		}
+		return;
+	}
+
+	if (mbuf->blk_count == 0) {
+		//never written, stays lazy
+		if (reset_size > mbuf->hint_size) {
+			mbuf->hint_size = reset_size;
+		}
+		mbuf->data_size = 0;
+		return;
+	}
+
 	if (mbuf->blk_count > 1 || (reset_size > mbuf->alloc_size)) {
+		uint32_t size = (reset_size > mbuf->alloc_size) ? reset_size : mbuf->alloc_size;
 		mbuf_free(mbuf);
-		mbuf_init(mbuf, (reset_size > mbuf->alloc_size) ? reset_size : mbuf->alloc_size);
+		mbuf_setup(mbuf, size);
+		mbuf_add_blk(mbuf, size);
 	} else {
 		assert(mbuf->blk_count == 1);
 		blk_buf_init(mbuf->head);
@@ -82,24 +467,69 @@ void mbuf_reset(mbuf_t *mbuf, uint32_t reset_size)
 	assert(mbuf->head == mbuf->tail && mbuf->head == mbuf->blk_enq && mbuf->head == mbuf->blk_deq);
 }
 
+uint32_t mbuf_shrink(mbuf_t *mbuf)
+{
+	uint32_t before = mbuf->alloc_size;
+	mbuf_blk_t *old, *from, *blk, *tmp;
+
+	if (mbuf->data_size > mbuf->hint_size) {
+		return 0;
+	}
+
+	if (mbuf->ring) {
+		uint32_t size = ring_round(mbuf->hint_size);
+		if (before > size) {
+			ring_resize(mbuf, size);
+		}
+		return before - mbuf->alloc_size;
+	}
+
+	if (mbuf->blk_count == 0) {
+		return 0;
+	}
+
+	if (mbuf->data_size == 0) {
+		mbuf_free(mbuf);
+		mbuf_setup(mbuf, mbuf->hint_size);
+		return before;
+	}
+
+	//one block of about the hint size already
+	if (mbuf->blk_count == 1 && before < mbuf->hint_size * 2) {
+		return 0;
+	}
+
+	old = mbuf->head;
+	from = mbuf->blk_deq;
+	mbuf->head = mbuf->tail = mbuf->blk_deq = mbuf->blk_enq = NULL;
+	mbuf->blk_count = 0;
+
+	blk = mbuf_add_blk(mbuf, mbuf->data_size);
+	for (; from; from = from->next) {
+		uint32_t len = MBUF_BLK_DATA_LEN(from);
+		memcpy(blk->tail, from->head, len);
+		blk->tail += len;
+	}
+	for (; old && (tmp = old->next, 1); old = tmp) {
+		pool_put(old);
+	}
+	mbuf_account(mbuf, blk->size);
+
+	return before > blk->size ? before - blk->size : 0;
+}
+
 const char *mbuf_pullup(mbuf_t *mbuf)
 {
 	uint32_t size, offset;
 	mbuf_blk_t *blk;
+	if (mbuf->ring) return mbuf->ring + mbuf->ring_off;
 	if (mbuf->blk_count <= 0) return NULL;
 	if (mbuf->blk_count == 1) goto done;
 
-	blk = (mbuf_blk_t *)calloc(1, sizeof(mbuf_blk_t));
-
 	size = mbuf->alloc_size;
 
-	blk->id = 0;
+	blk = pool_get(size);
 	blk->mbuf = mbuf;
-	blk->buf = (char*)malloc(size);
-	blk->size = size;
-	blk->end = blk->buf + blk->size;
-	blk_buf_init(blk);
-	blk->next = NULL;
 
 	offset = 0;
 	mbuf_blk_t *tblk, *tmp;
@@ -110,24 +540,77 @@ const char *mbuf_pullup(mbuf_t *mbuf)
 			offset += len;
 		}
 
-		free(tblk->buf);
-		free(tblk);
+		pool_put(tblk);
 	}
 
 	blk->tail = blk->head + offset;
 
 	mbuf->head = mbuf->tail = mbuf->blk_deq = mbuf->blk_enq = blk;
 	mbuf->blk_count = 1;
+	mbuf_account(mbuf, blk->size);
 
 done:
 	return mbuf->head->head;
 }
 
+int mbuf_peek_iov(mbuf_t *mbuf, struct iovec *iov, int max)
+{
+	return mbuf_peek_iov_range(mbuf, 0, mbuf->data_size, iov, max);
+}
+
+int mbuf_peek_iov_range(mbuf_t *mbuf, uint32_t off, uint32_t len, struct iovec *iov, int max)
+{
+	mbuf_blk_t *blk;
+	int n = 0;
+
+	if (off >= mbuf->data_size) return 0;
+	if (len > mbuf->data_size - off) {
+		len = mbuf->data_size - off;
+	}
+	if (max <= 0 || len == 0) return 0;
+
+	if (mbuf->ring) {
+		iov[0].iov_base = mbuf->ring + mbuf->ring_off + off;
+		iov[0].iov_len = len;
+		return 1;
+	}
+
+	for (blk = mbuf->blk_deq; blk && len > 0 && n < max; blk = blk->next) {
+		uint32_t blen = MBUF_BLK_DATA_LEN(blk);
+		if (off >= blen) {
+			off -= blen;
+			continue;
+		}
+
+		blen -= off;
+		if (blen > len) {
+			blen = len;
+		}
+		iov[n].iov_base = blk->head + off;
+		iov[n].iov_len = blen;
+		n++;
+		len -= blen;
+		off = 0;
+	}
+
+	return n;
+}
+
 void mbuf_enq_span(mbuf_t *mbuf, void *data, uint32_t len)
 {
 	mbuf_blk_t *blk = mbuf->blk_enq;
-	uint32_t capacity = MBUF_BLK_CAP(blk);
+	uint32_t capacity;
 	char *dat = (char *)data;
+	if (mbuf->ring) {
+		memcpy(MBUF_ALLOC(mbuf, len), dat, len);
+		return;
+	}
+
+	if (blk == NULL) {
+		blk = mbuf_add_blk(mbuf, len);
+	}
+
+	capacity = MBUF_BLK_CAP(blk);
 	if (capacity < len) {
 		memcpy(blk->tail, dat, capacity);
 		MBUF_ADVANCE(mbuf, blk, capacity);
@@ -142,6 +625,40 @@ void mbuf_enq_span(mbuf_t *mbuf, void *data, uint32_t len)
 
 
 
+void *mbuf_reserve(mbuf_t *mbuf, uint32_t len)
+{
+	//a ring that can't grow has turned into blocks
+	if (mbuf->ring && (mbuf->alloc_size - mbuf->data_size >= len || ring_grow(mbuf, len) == 0)) {
+		return mbuf->ring + mbuf->ring_off + mbuf->data_size;
+	}
+
+	if (mbuf->blk_enq == NULL) {
+		mbuf_add_blk(mbuf, len);
+	}
+	while ((uint32_t)MBUF_BLK_CAP(mbuf->blk_enq) < len) {
+		if (mbuf->blk_enq->next == NULL) {
+			mbuf_add_blk(mbuf, len);
+			break;
+		}
+		mbuf->blk_enq = mbuf->blk_enq->next;
+		assert(MBUF_BLK_DATA_LEN(mbuf->blk_enq) == 0);
+	}
+
+	return mbuf->blk_enq->tail;
+}
+
+void mbuf_commit(mbuf_t *mbuf, uint32_t len)
+{
+	if (mbuf->ring) {
+		assert(mbuf->alloc_size - mbuf->data_size >= len);
+		mbuf->data_size += len;
+		return;
+	}
+
+	assert((uint32_t)MBUF_BLK_CAP(mbuf->blk_enq) >= len);
+	MBUF_ADVANCE(mbuf, mbuf->blk_enq, len);
+}
+
 void *mbuf_enq(mbuf_t *mbuf, void *data, uint32_t len)
 {
 	void *p = MBUF_ALLOC(mbuf, len);
@@ -155,18 +672,29 @@ uint32_t mbuf_deq(mbuf_t *mbuf, void *ret, uint32_t len)
 	mbuf_blk_t *blk = mbuf->blk_deq;
 	uint32_t slen = len;
 
+	if (mbuf->ring) {
+		return ring_deq(mbuf, ret, len);
+	}
+
+	if (blk == NULL) {
+		return 0;
+	}
+
+	//blk_deq never moves past the last block, which is the one written next
 	do {
 		uint32_t payload = blk->tail - blk->head;
 		uint32_t min = payload < len ? payload : len;
 		if (min > 0) {
-			if (ret != NULL)
-				memcpy(ret, blk->head, payload);
+			if (ret != NULL) {
+				memcpy(ret, blk->head, min);
+				ret = (char *)ret + min;
+			}
 			blk->head += min;
 			mbuf->data_size -= min;
 			len -= min;
 		}
 
-	} while (len > 0 && NULL != (blk = mbuf->blk_deq = blk->next));
+	} while (len > 0 && blk->next != NULL && NULL != (blk = mbuf->blk_deq = blk->next));
 
 	return slen - len;
 }
@@ -10,8 +10,16 @@
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/uio.h>
 
 typedef struct mbuf_s mbuf_t;
+
+//byte counter shared by several mbufs, a change is added to every counter up the 'parent' chain
+typedef struct mbuf_acct_s {
+	struct mbuf_acct_s *parent;
+	uint64_t bytes;
+} mbuf_acct_t;
+
 typedef struct mbuf_blk_s {
 	struct mbuf_blk_s *next;
 	mbuf_t *mbuf;
@@ -33,8 +41,26 @@ struct mbuf_s {
 	uint32_t data_size;
 	uint32_t hint_size;
 	uint32_t alloc_size;
+
+	//ring mode: 'ring' is a double-mapped region of alloc_size bytes,
+	//readable data always starts contiguously at ring + ring_off.
+	char *ring;
+	uint32_t ring_off;
+
+	//charged with alloc_size, may be NULL
+	mbuf_acct_t *acct;
 };
 
+typedef struct mbuf_pool_stat_s {
+	uint64_t hits;          //blocks served from the pool
+	uint64_t misses;        //blocks that had to be allocated
+	uint64_t releases;      //blocks returned to the pool
+	uint64_t drops;         //blocks freed because the pool is full or the block is oversize
+	uint64_t cached_blocks;
+	uint64_t cached_bytes;
+	uint64_t limit;
+} mbuf_pool_stat_t;
+
 
 #define MBUF_ADVANCE(mbuf, blk, len)  do {\
 	(mbuf)->data_size += (len);	\
@@ -88,18 +114,58 @@ extern "C" {
 #endif
 
 void mbuf_init(mbuf_t *mbuf, uint32_t blk_size);
+//same as mbuf_init(), but the first block is only allocated when data is written
+void mbuf_init_lazy(mbuf_t *mbuf, uint32_t blk_size);
+//init mbuf as a growable ring buffer, pullup never copies in this mode.
+//returns -1 and falls back to block mode if the ring can't be mapped.
+int mbuf_init_ring(mbuf_t *mbuf, uint32_t size);
 void mbuf_free(mbuf_t *mbuf);
 void *mbuf_enq(mbuf_t *mbuf, void *data, uint32_t len);
 void mbuf_enq_span(mbuf_t *mbuf, void *data, uint32_t len);
 uint32_t mbuf_deq(mbuf_t *mbuf, void *ret, uint32_t len);
 void mbuf_reset(mbuf_t *mbuf, uint32_t reset_size);
+//give memory grown in a burst back once the data fits the hint size again: an empty mbuf
+//drops all its blocks (the next write allocates), small data is moved into one hint sized
+//block or ring. pointers into mbuf are invalid afterwards. returns the bytes released
+uint32_t mbuf_shrink(mbuf_t *mbuf);
 const char *mbuf_pullup(mbuf_t *mbuf);
+//fill at most 'max' iovecs with the readable data without copying it.
+//returns the number of iovecs used, the data stays in mbuf until drained
+int mbuf_peek_iov(mbuf_t *mbuf, struct iovec *iov, int max);
+//same as mbuf_peek_iov(), but only maps [off, off + len) of the readable data
+int mbuf_peek_iov_range(mbuf_t *mbuf, uint32_t off, uint32_t len, struct iovec *iov, int max);
 void mbuf_drain(mbuf_t *mbuf, uint32_t drainlen);
+//reserve 'len' contiguous writable bytes at the end of mbuf without enqueueing them,
+//returns NULL on failure. call mbuf_commit() with the bytes actually written
+void *mbuf_reserve(mbuf_t *mbuf, uint32_t len);
+void mbuf_commit(mbuf_t *mbuf, uint32_t len);
 
 mbuf_blk_t *mbuf_add_blk(mbuf_t *mbuf, uint32_t size);
+void *mbuf_ring_alloc(mbuf_t *mbuf, uint32_t len);
+
+//charge alloc_size to 'acct' from now on, moving what is already allocated off the old counter
+void mbuf_set_acct(mbuf_t *mbuf, mbuf_acct_t *acct);
+//hook 'acct' under 'parent', its current bytes move along
+void mbuf_acct_attach(mbuf_acct_t *acct, mbuf_acct_t *parent);
+
+//per-thread block pool, blocks are recycled by size class instead of malloc/free.
+//a block freed on another thread joins that thread's pool, all calls below act on the
+//calling thread's pool only
+//@limit  max bytes kept in the pool, blocks beyond that are freed
+void mbuf_pool_set_limit(uint64_t limit);
+void mbuf_pool_get_stat(mbuf_pool_stat_t *stat);
+//free all cached blocks, threads that used buffers should call it before they exit
+void mbuf_pool_clear(void);
 
 inline static void *MBUF_ALLOC(mbuf_t *mbuf, uint32_t len)
 {
+	if (mbuf->ring) {
+		return mbuf_ring_alloc(mbuf, len);
+	}
+
+	if (mbuf->blk_enq == NULL) {
+		mbuf_add_blk(mbuf, len);
+	}
 	for (; (uint32_t)MBUF_BLK_CAP(mbuf->blk_enq) < len; ) {
 		mbuf->blk_enq = mbuf->blk_enq->next;
 		if (mbuf->blk_enq == NULL) {
@@ -51,19 +51,10 @@ function string.split( line, sep, maxsplit )
 	return retval
 end
 
+--消息进入socket的发送队列，flush写不完的部分留在队列中，socket可写时再flush
 local function sendmsgbyso(so, msg)
-    msg = SOCKET.pack_msg(msg)
-    local len = 0
-    while true do
-        len = so:send(msg:sub(len + 1))
-        if len then
-            if len == #msg then
-                break
-            end
-        else
-            error("write failed")
-        end
-    end
+    so:queue(SOCKET.pack_msg(msg))
+    assert(so:flush() ~= nil, "write failed")
 end
 
 local function sendmsgbyrdt(so, msg)
@@ -177,14 +168,22 @@ end
 
 
 while true do
+    --发送队列中剩下的部分
+    assert(so:flush() ~= nil, "write failed")
     local r = SOCKET.select(readsocket, {}, 1)
     if type(r) == "table" then
         assert(r[1] == so)
-        local msg = assert(so:recv_packet())
-        if enable then
-            CLIENT.rdt_recv(session_id, msg)
-        else
-            on_recv_raw(so, msg)
+        --every complete packet at once
+        local msgs = {so:recv_packet()}
+        assert(msgs[1] ~= nil, msgs[2])
+        if msgs[1] then
+            for _, msg in ipairs(msgs) do
+                if enable then
+                    CLIENT.rdt_recv(session_id, msg)
+                else
+                    on_recv_raw(so, msg)
+                end
+            end
         end
         poll(so)
     else
@@ -18,13 +18,15 @@ local SESSION_START = 10000
 --rdt session 是否握手成功
 local enable = false
 
-local readsocket = { so }
+--socket读事件用epoll poller等待，不受select的FD_SETSIZE限制
+local poller = assert(SOCKET.poller())
+assert(poller:add(so))
 local client = {}
 local fds = {}
 local enable = {}
 local current_id
 local fd2rdt = {}
-local session_2_delete = {}
+local rdt2fd = {}
 
 function string.split( line, sep, maxsplit ) 
 	if not line or string.len(line) == 0 then
@@ -55,19 +57,10 @@ function string.split( line, sep, maxsplit )
 	return retval
 end
 
+--消息进入socket的发送队列，flush写不完的部分留在队列中，socket可写时再flush
 local function sendmsgbyso(so, msg)
-    msg = SOCKET.pack_msg(msg)
-    local len = 0
-    while true do
-        len = so:send(msg:sub(len + 1))
-        if len then
-            if len == #msg then
-                break
-            end
-        else
-            error("write failed")
-        end
-    end
+    so:queue(SOCKET.pack_msg(msg))
+    assert(so:flush() ~= nil, "write failed")
 end
 
 local function sendmsgbyrdt(session_id, msg)
@@ -76,7 +69,7 @@ local function sendmsgbyrdt(session_id, msg)
 end
 
 local function accept(c)
-	table.insert(readsocket, c)
+	assert(poller:add(c))
 	local fd = c:info().fd
 	client[c] = fd
 	fds[fd] = c
@@ -90,19 +83,16 @@ local function close(s)
 	fds[client[s]] = nil
 	client[s] = nil
     fd2rdt[fd] = nil
-	local tmp = readsocket
-	readsocket = {}
-	for _,v in pairs(tmp) do
-		if v ~= s then
-			table.insert(readsocket, v)
-		end
-	end
+    if session_id then
+        rdt2fd[session_id] = nil
+    end
+	poller:del(s)
 
-    --不删除引擎里的rdt对象，因为后面要演示如何重连
+    --不删除引擎里的rdt对象，因为后面要演示如何重连；超过重连宽限期后由引擎释放
     if session_id then
         print("disable rdt session: ", session_id)
         enable[session_id] = false
-        session_2_delete[session_id] = os.time()
+        SERVER.rdt_disable(session_id)
     end
 end
 
@@ -122,6 +112,7 @@ local function on_recv_raw(s, str)
         SESSION_START = SESSION_START + 1
         local session_id = SESSION_START
         fd2rdt[fd] = session_id
+        rdt2fd[session_id] = fd
         enable[session_id] = false
         local msg = "HANDSHAKE_1 " .. session_id
         sendmsgbyso(s, msg)
@@ -129,6 +120,7 @@ local function on_recv_raw(s, str)
 	    local fd = client[s]
         local session_id = tonumber(args[2])
         fd2rdt[fd] = session_id
+        rdt2fd[session_id] = fd
         enable[session_id] = false
         print("RECONN_HANDSHAKE_1: ", fd, session_id)
         SERVER.rdt_disable(session_id)
@@ -148,12 +140,17 @@ end
 local function recv(s)
 	local fd = client[s]
     local session_id = fd2rdt[fd]
-	local str, err = s:recv_packet()
+	--every complete packet at once
+	local pkgs = {s:recv_packet()}
+	local str = pkgs[1]
 	if str then
-        if session_id and enable[session_id] then
-            SERVER.rdt_recv(session_id, str)
-        else
-            on_recv_raw(s, str)
+        for _, pkg in ipairs(pkgs) do
+            session_id = fd2rdt[fd]
+            if session_id and enable[session_id] then
+                SERVER.rdt_recv(session_id, pkg)
+            else
+                on_recv_raw(s, pkg)
+            end
         end
 
 	elseif str == nil then
@@ -168,20 +165,17 @@ end
 local function poll()
     local msg_in = {}
 
-    for fd, session_id in pairs(fd2rdt) do
-        if enable[session_id] then
-            while true do
-                local t, sid, msg = SERVER.rdt_poll(session_id)
-                if t == nil then
-                    break
-                elseif t == 1 then
-                    --message in
-                    msg_in[fd] = session_id
-                    print("<==========:", sid, msg)
-                else
-                    local so = assert(fds[fd])
-                    sendmsgbyso(so, msg)
-                end
+    --only sessions with something to send or read, all their messages at once.
+    --frames of a closed fd can be dropped, rdt_reconnect resends them
+    for _, r in ipairs(SERVER.rdt_poll_all(128)) do
+        local fd = rdt2fd[r.sid]
+        if fd and enable[r.sid] then
+            if r.out then
+                sendmsgbyso(assert(fds[fd]), r.out)
+            end
+            for _, msg in ipairs(r) do
+                msg_in[fd] = r.sid
+                print("<==========:", r.sid, msg)
             end
         end
     end
@@ -195,12 +189,26 @@ function _G.OnSessionReconnected(session_id)
     print("server reconnect succ: ", session_id)
 end
 
+--session断开后超过宽限期没有重连，引擎已释放该session
+function _G.OnSessionExpired(session_id)
+    print("rdt session expired: ", session_id)
+    enable[session_id] = nil
+end
+
 
 print("start server: ", port)
+SERVER.rdt_set_grace(60 * 1000)
 while true do
-	local r = SOCKET.select(readsocket)
+	local r, w = poller:wait(1)
+	SERVER.rdt_manager_tick(os.time() * 1000)
 	local t = 0
-	for _, s in ipairs(r) do
+	--flush写不完时poller自动关注可写，这里写出队列中剩下的部分
+	for _, s in ipairs(w or {}) do
+		if s:flush() == nil then
+			close(s)
+		end
+	end
+	for _, s in ipairs(r or {}) do
 		if s == so then
 			local c, ip, port = so:accept()
 			if c then
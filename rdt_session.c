@@ -8,9 +8,11 @@
 #include "rdt_session.h"
 #include "mbuf.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <string.h>
 
 #define SIZE_NONE   0
 #define SIZE_UINT8  1
@@ -18,7 +20,13 @@
 #define SIZE_UINT32 3
 #define SIZE_UINT64 4
 
+//set in rdt_header_t.ack_size when a uint32 receive window follows the ack offset
+#define RDT_WND_FLAG 8
+
 const int MBUF_INIT_SIZE = 10240;
+//snd_buf only takes flattened frames in RDTS_SND_REF mode
+const int MBUF_REF_SND_SIZE = 256;
+const int SND_SEG_INIT_COUNT = 16;
 
 const int RAW_SEND_BUF_DEFAULT = 64 * 1024;
 const int AUTO_ACK_THREASHHOLD_DEFAULT = 10 * 1024;
@@ -34,6 +42,72 @@ typedef struct rdt_header_s {
 
 static char __check_header_size[sizeof(rdt_header_t) == 1 ? 1 : -1];
 
+//header byte + ack offset + window + data length
+#define RDT_HEADER_MAX (1 + 8 + 4 + 8)
+
+//a frame queued in RDTS_SND_REF mode: the encoded header, followed on the
+//wire by data_len bytes of raw_snd_buf starting at stream offset data_off
+typedef struct rdt_snd_seg_s {
+    uint64_t data_off;
+    uint32_t data_len;
+    uint32_t hdr_len;
+    char hdr[RDT_HEADER_MAX];
+} rdt_snd_seg_t;
+
+//per header byte field layout, see parse_header_fast()
+typedef struct rdt_header_lut_s {
+    uint64_t ack_mask;
+    uint64_t wnd_mask;
+    uint64_t data_mask;
+    uint8_t wnd_off;
+    uint8_t data_off;
+    uint8_t hdr_len; //0 for an invalid header byte
+} rdt_header_lut_t;
+
+static rdt_header_lut_t g_header_lut[256];
+static pthread_once_t g_header_lut_once = PTHREAD_ONCE_INIT;
+
+static void header_lut_build()
+{
+    static const uint8_t width[8] = {0, 1, 2, 4, 8, 0, 0, 0};
+    rdt_header_t hdr;
+    int i, ack, data;
+
+    for (i = 0; i < 256; i++) {
+        unsigned char c = (unsigned char)i;
+        rdt_header_lut_t *e = &g_header_lut[i];
+        uint8_t wnd_len;
+        memcpy(&hdr, &c, sizeof(hdr));
+
+        ack = hdr.ack_size & ~RDT_WND_FLAG;
+        data = hdr.data_size;
+        memset(e, 0, sizeof(*e));
+        if (ack > SIZE_UINT64 || data > SIZE_UINT64) {
+            continue;
+        }
+        wnd_len = (hdr.ack_size & RDT_WND_FLAG) ? sizeof(uint32_t) : 0;
+        e->ack_mask = width[ack] ? ~0ULL >> (64 - 8 * width[ack]) : 0;
+        e->wnd_mask = wnd_len ? 0xffffffffULL : 0;
+        e->data_mask = width[data] ? ~0ULL >> (64 - 8 * width[data]) : 0;
+        e->wnd_off = 1 + width[ack];
+        e->data_off = e->wnd_off + wnd_len;
+        e->hdr_len = e->data_off + width[data];
+    }
+}
+
+//sessions may be created on several threads at once
+static void header_lut_init()
+{
+    pthread_once(&g_header_lut_once, header_lut_build);
+}
+
+static inline uint64_t load_u64(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
 static int rdts_canlog(rdt_session_t *rdts, int mask)
 {
 	if ((mask & rdts->logmask) == 0 || rdts->writelog == NULL) return 0;
@@ -81,21 +155,213 @@ static void init_packet_header(rdt_header_t *hdr, uint64_t offset, uint32_t data
     }
 }
 
-static void mbuf_push_number(mbuf_t *mbuf, uint64_t len)
+static uint32_t encode_number(char *p, uint64_t len)
 {
     if (len <= UCHAR_MAX) {
         unsigned char n = (unsigned char)len;
-        MBUF_ENQ_WITH_TYPE(mbuf, &n, unsigned char);
+        memcpy(p, &n, sizeof(n));
+        return sizeof(n);
     } else if (len <= USHRT_MAX) {
         unsigned short n = (unsigned short)len;
-        MBUF_ENQ_WITH_TYPE(mbuf, &n, unsigned short);
+        memcpy(p, &n, sizeof(n));
+        return sizeof(n);
     } else if (len <= UINT32_MAX) {
         uint32_t n = (uint32_t)len;
-        MBUF_ENQ_WITH_TYPE(mbuf, &n, uint32_t);
+        memcpy(p, &n, sizeof(n));
+        return sizeof(n);
     } else {
         uint64_t n = (uint64_t)len;
-        MBUF_ENQ_WITH_TYPE(mbuf, &n, uint64_t);
+        memcpy(p, &n, sizeof(n));
+        return sizeof(n);
+    }
+}
+
+//encode a frame header into p (at least RDT_HEADER_MAX bytes), returns its length.
+//'window' is only sent along with an ack, NULL for none
+static uint32_t encode_header(char *p, uint64_t offset, const uint32_t *window, uint32_t data_len)
+{
+    rdt_header_t hdr;
+    uint32_t n = sizeof(hdr);
+
+    init_packet_header(&hdr, offset, data_len);
+    if (offset > 0 && window) {
+        hdr.ack_size |= RDT_WND_FLAG;
+    }
+    memcpy(p, &hdr, sizeof(hdr));
+    if (offset > 0) {
+        n += encode_number(p + n, offset);
+        if (window) {
+            memcpy(p + n, window, sizeof(*window));
+            n += sizeof(*window);
+        }
+    }
+    if (data_len > 0) {
+        n += encode_number(p + n, data_len);
+    }
+
+    return n;
+}
+
+static uint32_t number_size(uint64_t n)
+{
+    if (n <= UCHAR_MAX) return 1;
+    if (n <= USHRT_MAX) return 2;
+    if (n <= UINT32_MAX) return 4;
+    return 8;
+}
+
+//length of the header encode_header() would produce
+static uint32_t header_size(uint64_t offset, uint32_t data_len)
+{
+    return sizeof(rdt_header_t) + (offset > 0 ? number_size(offset) : 0) + (data_len > 0 ? number_size(data_len) : 0);
+}
+
+//-----------------------------
+//send segment queue, used by RDTS_SND_REF mode
+//-----------------------------
+static rdt_snd_seg_t *snd_seg_front(rdt_session_t *rdts)
+{
+    if (rdts->snd_seg_count == 0) {
+        return NULL;
+    }
+
+    return &rdts->snd_segs[rdts->snd_seg_head];
+}
+
+static void snd_seg_pop(rdt_session_t *rdts)
+{
+    rdts->snd_seg_head = (rdts->snd_seg_head + 1) % rdts->snd_seg_cap;
+    rdts->snd_seg_count--;
+}
+
+static void snd_seg_clear(rdt_session_t *rdts)
+{
+    rdts->snd_seg_head = 0;
+    rdts->snd_seg_count = 0;
+    rdts->snd_seg_bytes = 0;
+}
+
+static rdt_snd_seg_t *snd_seg_push(rdt_session_t *rdts)
+{
+    if (rdts->snd_seg_count == rdts->snd_seg_cap) {
+        uint32_t i, cap = rdts->snd_seg_cap ? rdts->snd_seg_cap * 2 : SND_SEG_INIT_COUNT;
+        rdt_snd_seg_t *segs = (rdt_snd_seg_t *)malloc(cap * sizeof(rdt_snd_seg_t));
+        if (segs == NULL) {
+            return NULL;
+        }
+
+        for (i = 0; i < rdts->snd_seg_count; i++) {
+            segs[i] = rdts->snd_segs[(rdts->snd_seg_head + i) % rdts->snd_seg_cap];
+        }
+        free(rdts->snd_segs);
+        rdts->snd_segs = segs;
+        rdts->snd_seg_cap = cap;
+        rdts->snd_seg_head = 0;
     }
+
+    rdts->snd_seg_count++;
+    return &rdts->snd_segs[(rdts->snd_seg_head + rdts->snd_seg_count - 1) % rdts->snd_seg_cap];
+}
+
+//map the payload of a segment, it still lives in raw_snd_buf
+static int snd_seg_peek_data(rdt_session_t *rdts, rdt_snd_seg_t *seg, struct iovec *iov, int max)
+{
+    uint64_t off = seg->data_off - rdts->remote_rcv_raw_offset;
+    return mbuf_peek_iov_range(rdts->raw_snd_buf, (uint32_t)off, seg->data_len, iov, max);
+}
+
+//copy [data_off, data_off + len) of the stream out of raw_snd_buf into dst
+static void raw_snd_copy(rdt_session_t *rdts, mbuf_t *dst, uint64_t data_off, uint32_t len)
+{
+    struct iovec iov[8];
+    int i, n;
+
+    while (len > 0) {
+        n = mbuf_peek_iov_range(rdts->raw_snd_buf, (uint32_t)(data_off - rdts->remote_rcv_raw_offset), len, iov, 8);
+        if (n <= 0) {
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            MBUF_ENQ(dst, iov[i].iov_base, iov[i].iov_len);
+            data_off += iov[i].iov_len;
+            len -= iov[i].iov_len;
+        }
+    }
+}
+
+//copy all queued segments into snd_buf so it can be pulled up
+static void snd_seg_flatten(rdt_session_t *rdts)
+{
+    rdt_snd_seg_t *seg;
+
+    while ((seg = snd_seg_front(rdts)) != NULL) {
+        MBUF_ENQ(rdts->snd_buf, seg->hdr, seg->hdr_len);
+        raw_snd_copy(rdts, rdts->snd_buf, seg->data_off, seg->data_len);
+        snd_seg_pop(rdts);
+    }
+
+    rdts->snd_seg_bytes = 0;
+}
+
+//-----------------------------
+//queue an outgoing frame, carrying the pending ack if there is one.
+//the payload, if any, is already in raw_snd_buf at
+//stream offset data_off. for RDTS_SND_COPY it is copied from 'data' when that
+//points to a contiguous copy, or gathered from raw_snd_buf otherwise.
+//returns the header length
+//-----------------------------
+static uint32_t rdts_queue_frame(rdt_session_t *rdts, uint64_t ack_offset, uint64_t data_off, const char *data, uint32_t len)
+{
+    uint32_t hdr_len;
+
+    uint32_t window, *pwnd = NULL;
+
+    //fold a pending ack into this frame
+    if (rdts->ack_pending) {
+        ack_offset = rdts->rcv_raw_offset;
+        rdts->ack_pending = 0;
+        rdts->stat.acks++;
+        rdts->stat.ack_bytes += ack_offset - rdts->acked_offset;
+        rdts->acked_offset = ack_offset;
+        if (len > 0) {
+            rdts->stat.acks_piggybacked++;
+        }
+    }
+
+    //advertise how much more unread data we accept
+    if (ack_offset > 0 && rdts->rcv_window > 0) {
+        uint32_t unread = rdts->raw_rcv_buf->data_size;
+        window = rdts->rcv_window > unread ? rdts->rcv_window - unread : 0;
+        rdts->adv_window = window;
+        pwnd = &window;
+    }
+
+    if (rdts->snd_mode == RDTS_SND_REF) {
+        rdt_snd_seg_t *seg = snd_seg_push(rdts);
+        if (seg == NULL) {
+            return 0;
+        }
+
+        hdr_len = seg->hdr_len = encode_header(seg->hdr, ack_offset, pwnd, len);
+        seg->data_off = data_off;
+        seg->data_len = len;
+        rdts->snd_seg_bytes += seg->hdr_len + len;
+    } else {
+        char hdr[RDT_HEADER_MAX];
+        hdr_len = encode_header(hdr, ack_offset, pwnd, len);
+        MBUF_ENQ(rdts->snd_buf, hdr, hdr_len);
+        if (len > 0 && data) {
+            MBUF_ENQ(rdts->snd_buf, data, len);
+        } else if (len > 0) {
+            raw_snd_copy(rdts, rdts->snd_buf, data_off, len);
+        }
+    }
+
+    rdts->stat.frames++;
+    rdts->stat.hdr_bytes += hdr_len;
+
+    return hdr_len;
 }
 
 void rdts_dump(rdt_session_t *rdts)
@@ -121,7 +387,7 @@ rdts->need_ack,
 rdts->raw_rcv_buf->data_size,
 rdts->rcv_buf->data_size,
 rdts->raw_snd_buf->data_size,
-rdts->snd_buf->data_size,
+rdts->snd_buf->data_size + rdts->snd_seg_bytes,
 rdts->rcv_raw_offset,
 rdts->remote_rcv_raw_offset);
 }
@@ -136,10 +402,13 @@ rdt_session_t *rdts_create(int sid, void *user)
         return NULL;
     }
 
+    header_lut_init();
+
     rdts->sid = sid;
     rdts->logmask = 0;
     rdts->enable = 1;
     rdts->need_ack = 0;
+    rdts->snd_mode = RDTS_SND_COPY;
 
     rdts->rcv_raw_offset = 0;
     rdts->remote_rcv_raw_offset = 0;
@@ -148,36 +417,80 @@ rdt_session_t *rdts_create(int sid, void *user)
     rdts->auto_ack_limit = AUTO_ACK_THREASHHOLD_DEFAULT;
     rdts->auto_ack_count = 0;
 
+    rdts->snd_segs = NULL;
+    rdts->snd_seg_cap = 0;
+    snd_seg_clear(rdts);
+    rdts->snd_reserve = NULL;
+    rdts->snd_reserve_len = 0;
+    rdts->ack_pending = 0;
+    rdts->ack_delay_ms = 0;
+    rdts->ack_since_ms = 0;
+    rdts->current_ms = 0;
+    rdts->acked_offset = 0;
+    rdts->rcv_window = 0;
+    rdts->adv_window = 0;
+    rdts->remote_wnd_limit = 0;
+    rdts->wm_low = 0;
+    rdts->wm_high = 0;
+    rdts->wm_state = RDTS_WM_LOW;
+    rdts->on_watermark = NULL;
+    rdts->wm_userdata = NULL;
+    rdts->snd_cork = 0;
+    rdts->cork_off = 0;
+    rdts->cork_len = 0;
+    rdts->cork_msgs = 0;
+    rdts->cork_hdr_bytes = 0;
+    memset(&rdts->stat, 0, sizeof(rdts->stat));
+    rdts->mem.parent = NULL;
+    rdts->mem.bytes = 0;
+    rdts->shrink_idle_ms = 0;
+    rdts->shrink_busy_ms = 0;
+    rdts->shrink_mem = 0;
+
     rdts->raw_rcv_buf = (mbuf_t *)malloc(sizeof(mbuf_t));
     if (rdts->raw_rcv_buf == NULL) {
         rdts_release(rdts);
         return NULL;
     }
-    mbuf_init(rdts->raw_rcv_buf, MBUF_INIT_SIZE);
+    mbuf_init_lazy(rdts->raw_rcv_buf, MBUF_INIT_SIZE);
+    mbuf_set_acct(rdts->raw_rcv_buf, &rdts->mem);
 
     rdts->rcv_buf = (mbuf_t *)malloc(sizeof(mbuf_t));
     if (rdts->rcv_buf == NULL) {
         rdts_release(rdts);
         return NULL;
     }
-    mbuf_init(rdts->rcv_buf, MBUF_INIT_SIZE);
+    mbuf_init_lazy(rdts->rcv_buf, MBUF_INIT_SIZE);
+    mbuf_set_acct(rdts->rcv_buf, &rdts->mem);
 
     rdts->raw_snd_buf = (mbuf_t *)malloc(sizeof(mbuf_t));
     if (rdts->raw_snd_buf == NULL) {
         rdts_release(rdts);
         return NULL;
     }
-    mbuf_init(rdts->raw_snd_buf, MBUF_INIT_SIZE);
+    mbuf_init_lazy(rdts->raw_snd_buf, MBUF_INIT_SIZE);
+    mbuf_set_acct(rdts->raw_snd_buf, &rdts->mem);
 
     rdts->snd_buf = (mbuf_t *)malloc(sizeof(mbuf_t));
     if (rdts->snd_buf == NULL) {
         rdts_release(rdts);
         return NULL;
     }
-    mbuf_init(rdts->snd_buf, MBUF_INIT_SIZE);
+    mbuf_init_lazy(rdts->snd_buf, MBUF_INIT_SIZE);
+    mbuf_set_acct(rdts->snd_buf, &rdts->mem);
 
     rdts->userdata = NULL;
     rdts->on_ack = NULL;
+    rdts->on_recv = NULL;
+    rdts->recv_userdata = NULL;
+
+    rdts->ready_prev = NULL;
+    rdts->ready_next = NULL;
+    rdts->ready = 0;
+    memset(&rdts->expire_timer, 0, sizeof(rdts->expire_timer));
+    memset(&rdts->update_timer, 0, sizeof(rdts->update_timer));
+    rdts->disabled_prev = NULL;
+    rdts->disabled_next = NULL;
 
     rdts->user = user;
     rdts->writelog = NULL;
@@ -194,6 +507,35 @@ void rdts_init(rdt_session_t *rdts, uint32_t max_raw_snd_buf_size, uint32_t auto
 }
 //-----------------------------
 
+//-----------------------------
+// switch the receive buffers to ring mode
+//-----------------------------
+int rdts_set_rcv_ring(rdt_session_t *rdts)
+{
+    int r = 0;
+    mbuf_t *bufs[] = { rdts->raw_rcv_buf, rdts->rcv_buf };
+    unsigned i;
+
+    for (i = 0; i < sizeof(bufs) / sizeof(bufs[0]); i++) {
+        if (bufs[i]->ring) {
+            continue;
+        }
+
+        if (bufs[i]->data_size > 0) {
+            r = -1;
+            continue;
+        }
+
+        mbuf_free(bufs[i]);
+        if (mbuf_init_ring(bufs[i], MBUF_INIT_SIZE) < 0) {
+            r = -1;
+        }
+        mbuf_set_acct(bufs[i], &rdts->mem);
+    }
+
+    return r;
+}
+
 //-----------------------------
 // release a rdt session object
 //-----------------------------
@@ -221,8 +563,11 @@ void rdts_release(rdt_session_t *rdts)
         free(rdts->rcv_buf);
     }
 
+    free(rdts->snd_segs);
+
     rdts->writelog = NULL;
     rdts->on_ack = NULL;
+    rdts->on_recv = NULL;
     rdts->user = NULL;
     rdts->userdata = NULL;
 
@@ -237,9 +582,127 @@ void rdts_reset(rdt_session_t *rdts)
     rdts->max_raw_snd_buf_size = 0;
     rdts->auto_ack_limit = 0;
 
-    mbuf_reset(rdts->snd_buf, MBUF_INIT_SIZE);
+    mbuf_reset(rdts->snd_buf, rdts->snd_mode == RDTS_SND_REF ? MBUF_REF_SND_SIZE : MBUF_INIT_SIZE);
     mbuf_reset(rdts->raw_snd_buf, MBUF_INIT_SIZE);
     mbuf_reset(rdts->raw_rcv_buf, MBUF_INIT_SIZE);
+    snd_seg_clear(rdts);
+    rdts->snd_reserve = NULL;
+    rdts->snd_reserve_len = 0;
+    rdts->ack_pending = 0;
+    rdts->adv_window = rdts->rcv_window;
+    rdts->wm_state = RDTS_WM_LOW;
+    rdts->snd_cork = 0;
+    rdts->cork_len = 0;
+    rdts->cork_msgs = 0;
+    rdts->cork_hdr_bytes = 0;
+}
+
+//-----------------------------
+// set send mode
+//-----------------------------
+int rdts_set_snd_mode(rdt_session_t *rdts, int mode)
+{
+    int old = rdts->snd_mode;
+    if (mode != RDTS_SND_COPY && mode != RDTS_SND_REF) {
+        return -1;
+    }
+
+    if (mode == old) {
+        return old;
+    }
+
+    if (rdts->snd_buf->data_size + rdts->snd_seg_bytes > 0) {
+        if (rdts_canlog(rdts, RDTS_LOG_FLAG)) {
+            rdts_log(rdts, RDTS_LOG_FLAG, "can't change send mode with pending data. sid=%d,mode=%d", rdts->sid, mode);
+        }
+        return -1;
+    }
+
+    //snd_buf carries no payload in ref mode, so it can be much smaller
+    mbuf_free(rdts->snd_buf);
+    mbuf_init_lazy(rdts->snd_buf, mode == RDTS_SND_REF ? MBUF_REF_SND_SIZE : MBUF_INIT_SIZE);
+    mbuf_set_acct(rdts->snd_buf, &rdts->mem);
+    rdts->snd_mode = mode;
+
+    if (rdts_canlog(rdts, RDTS_LOG_FLAG)) {
+        rdts_log(rdts, RDTS_LOG_FLAG, "change send mode. mode=%d,old=%d", mode, old);
+    }
+
+    return old;
+}
+
+//-----------------------------
+// set delayed ack timeout
+//-----------------------------
+void rdts_set_ack_delay(rdt_session_t *rdts, uint32_t delay_ms)
+{
+    rdts->ack_delay_ms = delay_ms;
+}
+
+//every buffer holds no more than its initial size
+static int rdts_bufs_small(rdt_session_t *rdts)
+{
+    return rdts->snd_buf->data_size <= rdts->snd_buf->hint_size
+        && rdts->rcv_buf->data_size <= rdts->rcv_buf->hint_size
+        && rdts->raw_rcv_buf->data_size <= rdts->raw_rcv_buf->hint_size
+        && rdts->raw_snd_buf->data_size <= rdts->raw_snd_buf->hint_size;
+}
+
+static void rdts_check_shrink(rdt_session_t *rdts, uint64_t now_ms)
+{
+    if (!rdts_bufs_small(rdts)) {
+        rdts->shrink_busy_ms = now_ms;
+    } else if (now_ms - rdts->shrink_busy_ms >= rdts->shrink_idle_ms) {
+        rdts->shrink_busy_ms = now_ms;
+        if (rdts->mem.bytes > 0) {
+            rdts_shrink(rdts);
+        }
+        rdts->shrink_mem = rdts->mem.bytes;
+    }
+}
+
+//-----------------------------
+// drive the session clock, acks data held longer than ack_delay_ms
+// and shrinks buffers that stayed small for shrink_idle_ms
+//-----------------------------
+void rdts_update(rdt_session_t *rdts, uint64_t now_ms)
+{
+    rdts->current_ms = now_ms;
+
+    if (rdts->shrink_idle_ms > 0) {
+        rdts_check_shrink(rdts, now_ms);
+    }
+
+    if (rdts->ack_delay_ms == 0 || rdts->auto_ack_count == 0 || rdts->ack_pending) {
+        return;
+    }
+
+    if (now_ms - rdts->ack_since_ms >= rdts->ack_delay_ms) {
+        rdts->stat.acks_timer++;
+        rdts_send_ack(rdts);
+    }
+}
+
+//-----------------------------
+// the delayed ack, or a shrink once the buffers hold more than the last shrink left
+//-----------------------------
+uint64_t rdts_next_update(rdt_session_t *rdts)
+{
+    uint64_t due = 0;
+
+    if (rdts->ack_delay_ms > 0 && rdts->auto_ack_count > 0 && !rdts->ack_pending) {
+        due = rdts->ack_since_ms + rdts->ack_delay_ms;
+    }
+
+    if (rdts->shrink_idle_ms > 0 && rdts->mem.bytes > rdts->shrink_mem) {
+        //buffers above their initial size restart the idle time on each update
+        uint64_t shrink = (rdts_bufs_small(rdts) ? rdts->shrink_busy_ms : rdts->current_ms) + rdts->shrink_idle_ms;
+        if (due == 0 || shrink < due) {
+            due = shrink;
+        }
+    }
+
+    return due;
 }
 
 //-----------------------------
@@ -302,34 +765,273 @@ void rdts_set_onack(rdt_session_t *rdts, void (*on_ack)(uint64_t offset, void *u
     rdts->userdata = userdata;
 }
 
+//-----------------------------
+//set on_recv callback, received data is handed to it instead of raw_rcv_buf
+//-----------------------------
+void rdts_set_onrecv(rdt_session_t *rdts, uint32_t (*on_recv)(const char *data, uint32_t len, void *userdata), void *userdata)
+{
+    rdts->on_recv = on_recv;
+    rdts->recv_userdata = userdata;
+}
+
+//-----------------------------
+// bytes that can be sent right now
+//-----------------------------
+uint32_t rdts_get_writable(rdt_session_t *rdts)
+{
+    uint32_t used = rdts->raw_snd_buf->data_size;
+    uint32_t n = rdts->max_raw_snd_buf_size > used ? rdts->max_raw_snd_buf_size - used - 1 : 0;
+
+    if (rdts->remote_wnd_limit > 0) {
+        uint64_t end = rdts->remote_rcv_raw_offset + used;
+        uint64_t wnd = rdts->remote_wnd_limit > end ? rdts->remote_wnd_limit - end : 0;
+        if (wnd < n) {
+            n = (uint32_t)wnd;
+        }
+    }
+
+    return n;
+}
+
+//-----------------------------
+// fire the watermark callback when unacked data crosses high or drains to low.
+// 'blocked' means a send was just refused
+//-----------------------------
+static void rdts_check_watermark(rdt_session_t *rdts, int blocked)
+{
+    uint32_t unacked = rdts->raw_snd_buf->data_size;
+    if (rdts->on_watermark == NULL) {
+        return;
+    }
+
+    if (rdts->wm_state == RDTS_WM_LOW) {
+        if (blocked || (rdts->wm_high > 0 && unacked >= rdts->wm_high)) {
+            rdts->wm_state = RDTS_WM_HIGH;
+            rdts->on_watermark(RDTS_WM_HIGH, unacked, rdts->wm_userdata);
+        }
+    } else if (unacked <= rdts->wm_low && rdts_get_writable(rdts) > 0) {
+        rdts->wm_state = RDTS_WM_LOW;
+        rdts->on_watermark(RDTS_WM_LOW, unacked, rdts->wm_userdata);
+    }
+}
+
+//-----------------------------
+// set send watermarks and their callback
+//-----------------------------
+void rdts_set_onwatermark(rdt_session_t *rdts, uint32_t low, uint32_t high, void (*on_watermark)(int event, uint32_t unacked, void *userdata), void *userdata)
+{
+    rdts->wm_low = low;
+    rdts->wm_high = high;
+    rdts->wm_state = RDTS_WM_LOW;
+    rdts->on_watermark = on_watermark;
+    rdts->wm_userdata = userdata;
+}
+
+//-----------------------------
+// advertise a receive window in acks
+//-----------------------------
+void rdts_set_rcv_window(rdt_session_t *rdts, uint32_t window)
+{
+    rdts->rcv_window = window;
+    rdts->adv_window = window;
+}
+
 //-----------------------------
 // user/upper level send, returns below zero for error
 //-----------------------------
 int rdts_send(rdt_session_t *rdts, const char *buf, uint32_t len)
 {
-    if (rdts->raw_snd_buf->data_size + len >= rdts->max_raw_snd_buf_size) {
+    char *p = rdts_send_reserve(rdts, len);
+    if (p == NULL) {
+        return -1;
+    }
+
+    memcpy(p, buf, len);
+    return rdts_send_commit(rdts, len);
+}
+
+//-----------------------------
+// reserve space in raw_snd_buf for the caller to write a message into
+//-----------------------------
+char *rdts_send_reserve(rdt_session_t *rdts, uint32_t len)
+{
+    if (len > rdts_get_writable(rdts)) {
         if (rdts_canlog(rdts, RDTS_LOG_SEND)) {
             rdts_log(rdts, RDTS_LOG_SEND, "raw_snd_buf overflow. sid=%d,snd_buf_sz=%ld,len=%ld", rdts->sid, rdts->raw_snd_buf->data_size, len);
         }
-        return -1;
+        rdts_check_watermark(rdts, 1);
+        return NULL;
     }
 
-    rdt_header_t hdr;
-    init_packet_header(&hdr, 0, len);
+    rdts->snd_reserve = (char *)mbuf_reserve(rdts->raw_snd_buf, len);
+    rdts->snd_reserve_len = rdts->snd_reserve ? len : 0;
 
-    MBUF_ENQ_WITH_TYPE(rdts->snd_buf, &hdr, rdt_header_t);
-    mbuf_push_number(rdts->snd_buf, len);
-    MBUF_ENQ(rdts->snd_buf, buf, len);
+    return rdts->snd_reserve;
+}
 
-    MBUF_ENQ(rdts->raw_snd_buf, buf, len);
+//-----------------------------
+// frame the reserved data, it is copied into snd_buf only in RDTS_SND_COPY mode
+//-----------------------------
+int rdts_send_commit(rdt_session_t *rdts, uint32_t len)
+{
+    if (rdts->snd_reserve == NULL || len > rdts->snd_reserve_len) {
+        if (rdts_canlog(rdts, RDTS_LOG_SEND)) {
+            rdts_log(rdts, RDTS_LOG_SEND, "commit without reserve. sid=%d,reserved=%u,len=%u", rdts->sid, rdts->snd_reserve_len, len);
+        }
+        return -1;
+    }
+
+    uint64_t data_off = rdts->remote_rcv_raw_offset + rdts->raw_snd_buf->data_size;
+    const char *buf = rdts->snd_reserve;
+    rdts->snd_reserve = NULL;
+    rdts->snd_reserve_len = 0;
+    if (len == 0) {
+        return 0;
+    }
+
+    mbuf_commit(rdts->raw_snd_buf, len);
+    if (rdts->snd_cork) {
+        //just extend the pending batch, it is framed once on rdts_uncork()
+        if (rdts->cork_len == 0) {
+            rdts->cork_off = data_off;
+        }
+        rdts->cork_len += len;
+        rdts->cork_msgs++;
+        rdts->cork_hdr_bytes += header_size(0, len);
+    } else {
+        rdts_queue_frame(rdts, 0, data_off, buf, len);
+    }
 
     if (rdts_canlog(rdts, RDTS_LOG_SEND)) {
         rdts_log(rdts, RDTS_LOG_SEND, "send data. sid=%d,snd_buf_sz=%ld,len=%ld", rdts->sid, rdts->raw_snd_buf->data_size, len);
     }
 
+    rdts_check_watermark(rdts, 0);
     return 0;
 }
 
+//-----------------------------
+// start coalescing sends into one frame
+//-----------------------------
+void rdts_cork(rdt_session_t *rdts)
+{
+    rdts->snd_cork = 1;
+}
+
+//-----------------------------
+// frame everything sent since rdts_cork() as a single data frame
+//-----------------------------
+int rdts_uncork(rdt_session_t *rdts)
+{
+    uint32_t hdr_len;
+
+    if (!rdts->snd_cork) {
+        return 0;
+    }
+
+    rdts->snd_cork = 0;
+    if (rdts->cork_len == 0) {
+        return 0;
+    }
+
+    rdts_queue_frame(rdts, 0, rdts->cork_off, NULL, rdts->cork_len);
+    hdr_len = header_size(0, rdts->cork_len);
+    rdts->stat.batches++;
+    rdts->stat.batch_msgs += rdts->cork_msgs;
+    if (rdts->cork_hdr_bytes > hdr_len) {
+        rdts->stat.hdr_saved += rdts->cork_hdr_bytes - hdr_len;
+    }
+
+    if (rdts_canlog(rdts, RDTS_LOG_SEND)) {
+        rdts_log(rdts, RDTS_LOG_SEND, "send batch. sid=%d,msgs=%u,len=%u,hdr_saved=%u", rdts->sid, rdts->cork_msgs, rdts->cork_len, rdts->cork_hdr_bytes - hdr_len);
+    }
+
+    rdts->cork_len = 0;
+    rdts->cork_msgs = 0;
+    rdts->cork_hdr_bytes = 0;
+
+    return 0;
+}
+
+//-----------------------------
+// send several messages as one data frame
+//-----------------------------
+int rdts_send_batch(rdt_session_t *rdts, const struct iovec *msgs, int count)
+{
+    int i, r = 0;
+    int corked = rdts->snd_cork;
+    uint64_t total = 0;
+
+    //all or nothing: a partly queued batch could not be retried without duplicates
+    for (i = 0; i < count; i++) {
+        total += msgs[i].iov_len;
+    }
+    if (total > rdts_get_writable(rdts)) {
+        if (rdts_canlog(rdts, RDTS_LOG_SEND)) {
+            rdts_log(rdts, RDTS_LOG_SEND, "raw_snd_buf overflow. sid=%d,snd_buf_sz=%u,batch=%lu", rdts->sid, rdts->raw_snd_buf->data_size, total);
+        }
+        rdts_check_watermark(rdts, 1);
+        return -1;
+    }
+
+    rdts_cork(rdts);
+    for (i = 0; i < count && r == 0; i++) {
+        r = rdts_send(rdts, (const char *)msgs[i].iov_base, (uint32_t)msgs[i].iov_len);
+    }
+
+    if (!corked) {
+        rdts_uncork(rdts);
+    }
+
+    return r < 0 ? -1 : 0;
+}
+
+//-----------------------------
+// get send statistics
+//-----------------------------
+const rdt_stat_t *rdts_get_stat(rdt_session_t *rdts)
+{
+    return &rdts->stat;
+}
+
+//-----------------------------
+// buffer memory accounting
+//-----------------------------
+uint64_t rdts_get_mem(rdt_session_t *rdts)
+{
+    return rdts->mem.bytes;
+}
+
+void rdts_set_mem_parent(rdt_session_t *rdts, mbuf_acct_t *parent)
+{
+    mbuf_acct_attach(&rdts->mem, parent);
+}
+
+uint32_t rdts_shrink(rdt_session_t *rdts)
+{
+    uint32_t n = 0;
+
+    n += mbuf_shrink(rdts->snd_buf);
+    n += mbuf_shrink(rdts->rcv_buf);
+    n += mbuf_shrink(rdts->raw_rcv_buf);
+    //a pending rdts_send_reserve() points into raw_snd_buf
+    if (rdts->snd_reserve == NULL) {
+        n += mbuf_shrink(rdts->raw_snd_buf);
+    }
+
+    if (n > 0 && rdts_canlog(rdts, RDTS_LOG_DEBUG)) {
+        rdts_log(rdts, RDTS_LOG_DEBUG, "shrink buffers. sid=%d,released=%u,mem=%llu", rdts->sid, n, (unsigned long long)rdts->mem.bytes);
+    }
+
+    return n;
+}
+
+void rdts_set_shrink(rdt_session_t *rdts, uint32_t idle_ms)
+{
+    rdts->shrink_idle_ms = idle_ms;
+    rdts->shrink_busy_ms = rdts->current_ms;
+}
+
 //-----------------------------
 // when reconnect to remote endpoint, resend all data in raw_snd_buf to avoid losing user layer data.
 //-----------------------------
@@ -341,15 +1043,16 @@ int rdts_push_raw(rdt_session_t *rdts)
     }
 
     //discard data in snd_buf
-    mbuf_reset(rdts->snd_buf, MBUF_INIT_SIZE);
+    mbuf_reset(rdts->snd_buf, 0);
+    snd_seg_clear(rdts);
 
-    rdt_header_t hdr;
-    init_packet_header(&hdr, 0, len);
-    MBUF_ENQ_WITH_TYPE(rdts->snd_buf, &hdr, rdt_header_t);
-    mbuf_push_number(rdts->snd_buf, len);
+    //the resend covers any corked data as well
+    rdts->cork_len = 0;
+    rdts->cork_msgs = 0;
+    rdts->cork_hdr_bytes = 0;
 
-    const char *buf = mbuf_pullup(rdts->raw_snd_buf);
-    MBUF_ENQ(rdts->snd_buf, buf, len);
+    //resend straight out of raw_snd_buf, no need to linearize it
+    rdts_queue_frame(rdts, 0, rdts->remote_rcv_raw_offset, NULL, len);
 
     if (rdts_canlog(rdts, RDTS_LOG_PUSH_RAW)) {
         rdts_log(rdts, RDTS_LOG_SEND, "push raw. sid=%d,raw_snd_buf=%u,remote_rcv_raw_offset=%lu", rdts->sid, rdts->raw_snd_buf->data_size, rdts->remote_rcv_raw_offset);
@@ -363,20 +1066,27 @@ int rdts_push_raw(rdt_session_t *rdts)
 //-----------------------------
 int rdts_send_ack(rdt_session_t *rdts)
 {
-    rdt_header_t hdr;
-    uint64_t offset = rdts->rcv_raw_offset;
-    init_packet_header(&hdr, offset, 0);
-    MBUF_ENQ_WITH_TYPE(rdts->snd_buf, &hdr, rdt_header_t);
-    mbuf_push_number(rdts->snd_buf, offset);
+    //the ack rides on the next data frame, or goes alone when the send queue is read
+    rdts->ack_pending = 1;
     rdts->auto_ack_count = 0;
 
     if (rdts_canlog(rdts, RDTS_LOG_ACK)) {
-        rdts_log(rdts, RDTS_LOG_ACK, "[info]send ack. sid=%d,rcv_raw_offset=%ld", rdts->sid, offset);
+        rdts_log(rdts, RDTS_LOG_ACK, "[info]send ack. sid=%d,rcv_raw_offset=%ld", rdts->sid, rdts->rcv_raw_offset);
     }
 
     return 0;
 }
 
+//-----------------------------
+// emit a pending ack that found no data frame to ride on
+//-----------------------------
+void rdts_flush_ack(rdt_session_t *rdts)
+{
+    if (rdts->ack_pending) {
+        rdts_queue_frame(rdts, 0, 0, NULL, 0);
+    }
+}
+
 //-----------------------------
 //when received an ack, modify the remote_recv_raw_offset
 //-----------------------------
@@ -414,9 +1124,24 @@ static int rdts_on_rcv_ack(rdt_session_t *rdts, uint64_t offset)
         rdts_log(rdts, RDTS_LOG_ACK, "[info]remote ack offset. sid=%d,remote_rcv_raw_offset=%lu,offset=%lu,delta=%u", rdts->sid, rdts->remote_rcv_raw_offset - delta, offset, delta);
     }
 
+    rdts_check_watermark(rdts, 0);
     return 0;
 }
 
+//-----------------------------
+//when received a window, the remote accepts data up to offset + window
+//-----------------------------
+static void rdts_on_rcv_window(rdt_session_t *rdts, uint64_t offset, uint32_t window)
+{
+    rdts->remote_wnd_limit = offset + window;
+
+    if (rdts_canlog(rdts, RDTS_LOG_ACK)) {
+        rdts_log(rdts, RDTS_LOG_ACK, "[info]remote window. sid=%d,offset=%lu,window=%u", rdts->sid, offset, window);
+    }
+
+    rdts_check_watermark(rdts, 0);
+}
+
 
 //-----------------------------
 //when received remote data, push into raw_rcv_buf and wait for user level read
@@ -424,9 +1149,30 @@ static int rdts_on_rcv_ack(rdt_session_t *rdts, uint64_t offset)
 static int rdts_on_rcv_data(rdt_session_t *rdts, const char *buf, uint32_t len)
 {
     mbuf_t *rcv_buf = rdts->raw_rcv_buf;
-    MBUF_ENQ(rcv_buf, buf, len);
+    uint32_t used;
+
+    if (rdts->on_recv == NULL) {
+        MBUF_ENQ(rcv_buf, buf, len);
+    } else if (rcv_buf->data_size == 0) {
+        //deliver straight from the input, keep only the unconsumed tail
+        used = rdts->on_recv(buf, len, rdts->recv_userdata);
+        if (used < len) {
+            MBUF_ENQ(rcv_buf, buf + used, len - used);
+        }
+    } else {
+        MBUF_ENQ(rcv_buf, buf, len);
+        used = rdts->on_recv((const char *)mbuf_pullup(rcv_buf), rcv_buf->data_size, rdts->recv_userdata);
+        if (used > 0) {
+            rdts_drain_raw_rcv_buf(rdts, used > rcv_buf->data_size ? rcv_buf->data_size : used);
+        }
+    }
     rdts->rcv_raw_offset += len;
 
+    //the delayed ack timer starts with the first unacked byte
+    if (rdts->auto_ack_count == 0) {
+        rdts->ack_since_ms = rdts->current_ms;
+    }
+
     rdts->auto_ack_count += len;
     if (rdts->auto_ack_count >= rdts->auto_ack_limit) {
         rdts_send_ack(rdts);
@@ -442,7 +1188,7 @@ static int rdts_on_rcv_data(rdt_session_t *rdts, const char *buf, uint32_t len)
 #define READ_TYPE(p, end, dest, type)  \
     if (p + sizeof(type) - 1 > end)    \
     {                                  \
-        return DECODE_HEADER_ERR; \
+        return DECODE_HEADER_LACK;     \
     }                                  \
     *dest = *((type *)(p));            \
     p += sizeof(type);                 \
@@ -453,17 +1199,19 @@ static int rdts_on_rcv_data(rdt_session_t *rdts, const char *buf, uint32_t len)
 // packet: [hdr, end]
 //-----------------------------
 
-static int parse_header(rdt_header_t *hdr, uint32_t payload, uint64_t *ack_offset, uint32_t *data_size, const char **pdata, uint32_t *pkg_len)
+static int parse_header(rdt_header_t *hdr, uint32_t payload, uint64_t *ack_offset, int *has_window, uint32_t *window, uint32_t *data_size, const char **pdata, uint32_t *pkg_len)
 {
     const char *p = (const char *)(hdr + 1);
     const char *end = (const char *)hdr + payload - 1;
     *ack_offset = 0;
+    *has_window = 0;
+    *window = 0;
     *data_size = 0;
     *pkg_len = 0;
     *pdata = NULL;
 
     //parse ack filed
-    switch (hdr->ack_size) {
+    switch (hdr->ack_size & ~RDT_WND_FLAG) {
     case SIZE_NONE: {
         *ack_offset = 0;
         break;
@@ -485,6 +1233,15 @@ static int parse_header(rdt_header_t *hdr, uint32_t payload, uint64_t *ack_offse
     }
     }
 
+    if (hdr->ack_size & RDT_WND_FLAG) {
+        if (p + sizeof(uint32_t) - 1 > end) {
+            return DECODE_HEADER_LACK;
+        }
+        memcpy(window, p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        *has_window = 1;
+    }
+
     switch (hdr->data_size) {
     case SIZE_NONE: {
         *data_size = 0;
@@ -516,6 +1273,38 @@ static int parse_header(rdt_header_t *hdr, uint32_t payload, uint64_t *ack_offse
     return DECODE_HEADER_OK;
 }
 
+//-----------------------------
+// table driven header decoder, used while a whole RDT_HEADER_MAX fits in the input:
+// one lookup gives every field width, fields are read with masked 8 byte loads.
+// near the end of the input it falls back to parse_header()
+//-----------------------------
+static int parse_header_fast(rdt_header_t *hdr, uint32_t payload, uint64_t *ack_offset, int *has_window, uint32_t *window, uint32_t *data_size, const char **pdata, uint32_t *pkg_len)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const char *p = (const char *)hdr;
+    const rdt_header_lut_t *e = &g_header_lut[*(const unsigned char *)p];
+
+    //every load below stays inside [p, p + RDT_HEADER_MAX)
+    if (payload < RDT_HEADER_MAX) {
+        return parse_header(hdr, payload, ack_offset, has_window, window, data_size, pdata, pkg_len);
+    }
+    if (e->hdr_len == 0) {
+        return DECODE_HEADER_ERR;
+    }
+
+    *ack_offset = load_u64(p + 1) & e->ack_mask;
+    *window = (uint32_t)(load_u64(p + e->wnd_off) & e->wnd_mask);
+    *has_window = e->wnd_mask != 0;
+    *data_size = (uint32_t)(load_u64(p + e->data_off) & e->data_mask);
+    *pdata = p + e->hdr_len;
+    *pkg_len = e->hdr_len + *data_size;
+
+    return (uint64_t)e->hdr_len + *data_size > payload ? DECODE_HEADER_LACK : DECODE_HEADER_OK;
+#else
+    return parse_header(hdr, payload, ack_offset, has_window, window, data_size, pdata, pkg_len);
+#endif
+}
+
 //-----------------------------
 // when you received a low level packet (eg. tcp or udp packet), call it
 //-----------------------------
@@ -529,8 +1318,8 @@ int rdts_input(rdt_session_t *rdts, const char *buf, uint32_t len)
     const char *pdata = NULL;
     const char *pinput = NULL;
     uint64_t ack_offset = 0;
-    uint32_t data_size = 0, pkg_len = 0, drain_len = 0;
-    int r = 0, use_buf = 0;
+    uint32_t data_size = 0, pkg_len = 0, drain_len = 0, window = 0;
+    int r = 0, use_buf = 0, has_window = 0;
     mbuf_t *rcv_buf = rdts->rcv_buf;
 
 
@@ -545,7 +1334,8 @@ int rdts_input(rdt_session_t *rdts, const char *buf, uint32_t len)
 
     while (1) {
         if (len <= sizeof(rdt_header_t)) {
-            if (!use_buf) {
+            //nothing left over is the common case, don't touch (and allocate) rcv_buf for it
+            if (!use_buf && len > 0) {
                 MBUF_ENQ(rcv_buf, pinput, len);
             }
             break;
@@ -553,10 +1343,13 @@ int rdts_input(rdt_session_t *rdts, const char *buf, uint32_t len)
 
         hdr = (rdt_header_t *)pinput;
         ack_offset = data_size = pkg_len = 0;
-        r = parse_header(hdr, len, &ack_offset, &data_size, &pdata, &pkg_len);
+        r = parse_header_fast(hdr, len, &ack_offset, &has_window, &window, &data_size, &pdata, &pkg_len);
         if (r == DECODE_HEADER_OK) {
             if (ack_offset > 0) {
-                rdts_on_rcv_ack(rdts, ack_offset);
+                //a rejected (stale or bogus) ack must not move the window either
+                if (rdts_on_rcv_ack(rdts, ack_offset) == 0 && has_window && ack_offset >= rdts->remote_rcv_raw_offset) {
+                    rdts_on_rcv_window(rdts, ack_offset, window);
+                }
             }
 
             if (data_size > 0) {
@@ -570,12 +1363,13 @@ int rdts_input(rdt_session_t *rdts, const char *buf, uint32_t len)
             if (!use_buf) {
                 MBUF_ENQ(rcv_buf, pinput, len);
             }
+            break;
         } else {
             if (rdts_canlog(rdts, RDTS_LOG_INPUT)) {
                 rdts_log(rdts, RDTS_LOG_INPUT, "rdts_input: parse header error. sid=%d,r=%d", rdts->sid, r);
-
-                return -1;
             }
+
+            return -1;
         }
     }
 
@@ -592,15 +1386,72 @@ int rdts_input(rdt_session_t *rdts, const char *buf, uint32_t len)
 //-----------------------------
 const char *rdts_pullup_snd_buf(rdt_session_t *rdts)
 {
+    rdts_flush_ack(rdts);
+    if (rdts->snd_seg_count > 0) {
+        snd_seg_flatten(rdts);
+    }
+
     return (const char *)mbuf_pullup(rdts->snd_buf);
 }
 
+//-----------------------------
+//map data in rdts->snd_buf into iovecs, and call rdts_drain_snd_buf() to free.
+//-----------------------------
+int rdts_peek_snd_iov(rdt_session_t *rdts, struct iovec *iov, int max)
+{
+    uint32_t i;
+    int n;
+
+    rdts_flush_ack(rdts);
+    n = mbuf_peek_iov(rdts->snd_buf, iov, max);
+
+    for (i = 0; i < rdts->snd_seg_count && n < max; i++) {
+        rdt_snd_seg_t *seg = &rdts->snd_segs[(rdts->snd_seg_head + i) % rdts->snd_seg_cap];
+        if (seg->hdr_len > 0) {
+            iov[n].iov_base = seg->hdr;
+            iov[n].iov_len = seg->hdr_len;
+            n++;
+        }
+
+        if (seg->data_len > 0 && n < max) {
+            n += snd_seg_peek_data(rdts, seg, iov + n, max - n);
+        }
+    }
+
+    return n;
+}
+
 //-----------------------------
 // free all data in rdts->snd_buf
 //-----------------------------
 void rdts_drain_snd_buf(rdt_session_t *rdts, uint32_t len)
 {
-    mbuf_drain(rdts->snd_buf, len);
+    rdt_snd_seg_t *seg;
+    uint32_t n = len < rdts->snd_buf->data_size ? len : rdts->snd_buf->data_size;
+
+    mbuf_drain(rdts->snd_buf, n);
+    len -= n;
+
+    //then consume queued segments, a partly sent one is trimmed in place
+    while (len > 0 && (seg = snd_seg_front(rdts)) != NULL) {
+        n = len < seg->hdr_len ? len : seg->hdr_len;
+        if (n > 0) {
+            memmove(seg->hdr, seg->hdr + n, seg->hdr_len - n);
+            seg->hdr_len -= n;
+            rdts->snd_seg_bytes -= n;
+            len -= n;
+        }
+
+        n = len < seg->data_len ? len : seg->data_len;
+        seg->data_off += n;
+        seg->data_len -= n;
+        rdts->snd_seg_bytes -= n;
+        len -= n;
+
+        if (seg->hdr_len == 0 && seg->data_len == 0) {
+            snd_seg_pop(rdts);
+        }
+    }
 }
 
 //-----------------------------
@@ -608,7 +1459,15 @@ void rdts_drain_snd_buf(rdt_session_t *rdts, uint32_t len)
 //-----------------------------
 uint32_t rdts_get_snd_buf_length(rdt_session_t *rdts)
 {
-    return rdts->snd_buf->data_size;
+    return rdts->snd_buf->data_size + rdts->snd_seg_bytes;
+}
+
+//-----------------------------
+//check for pending output
+//-----------------------------
+int rdts_has_output(rdt_session_t *rdts)
+{
+    return rdts->ack_pending || rdts->snd_buf->data_size + rdts->snd_seg_bytes > 0;
 }
 
 //recv buf operation
@@ -626,6 +1485,12 @@ const char *rdts_pullup_raw_rcv_buf(rdt_session_t *rdts)
 void rdts_drain_raw_rcv_buf(rdt_session_t *rdts, uint32_t len)
 {
     mbuf_drain(rdts->raw_rcv_buf, len);
+
+    //reopen a window we shrank below half, so the sender is not stalled
+    if (rdts->rcv_window > 0 && rdts->adv_window < rdts->rcv_window / 2
+            && rdts->raw_rcv_buf->data_size <= rdts->rcv_window / 2 && rdts->rcv_raw_offset > 0) {
+        rdts->ack_pending = 1;
+    }
 }
 
 //-----------------------------
@@ -640,4 +1505,165 @@ uint32_t rdts_get_raw_rcv_buf_length(rdt_session_t *rdts)
 uint64_t rdts_get_rcv_raw_offset(rdt_session_t *rdts)
 {
     return rdts->rcv_raw_offset;
-}
\ No newline at end of file
+}
+//-----------------------------
+//snapshot: rdts_serialize() layout, native byte order. the header is followed by the
+//raw_snd_buf, raw_rcv_buf and rcv_buf data. snd_buf is not kept: a reconnect frames
+//raw_snd_buf again anyway
+//-----------------------------
+#define RDTS_IMAGE_MAGIC 0x53544452 //"RDTS"
+#define RDTS_IMAGE_VERSION 1
+#define RDTS_IMAGE_RING 1
+
+typedef struct rdts_image_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t len;       //header and data
+    int32_t sid;
+    uint64_t rcv_raw_offset;
+    uint64_t remote_rcv_raw_offset;
+    uint64_t acked_offset;
+    int32_t enable;
+    int32_t need_ack;
+    int32_t snd_mode;
+    int32_t logmask;
+    uint32_t flags;
+    uint32_t max_raw_snd_buf_size;
+    uint32_t auto_ack_limit;
+    uint32_t ack_delay_ms;
+    uint32_t rcv_window;
+    uint32_t shrink_idle_ms;
+    uint32_t raw_snd_len;
+    uint32_t raw_rcv_len;
+    uint32_t rcv_len;
+    uint32_t reserved;
+} rdts_image_t;
+
+static char *image_copy_out(mbuf_t *mbuf, char *p)
+{
+    struct iovec iov[16];
+    uint32_t off = 0;
+    int i, n;
+
+    while (off < mbuf->data_size) {
+        n = mbuf_peek_iov_range(mbuf, off, mbuf->data_size - off, iov, 16);
+        for (i = 0; i < n; i++) {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+            off += iov[i].iov_len;
+        }
+    }
+
+    return p;
+}
+
+//restored data gets a block of its own size, later writes allocate by the hint again
+static const char *image_copy_in(mbuf_t *mbuf, const char *p, uint32_t len)
+{
+    uint32_t hint = mbuf->hint_size;
+
+    if (len == 0) {
+        return p;
+    }
+    if (mbuf->ring == NULL && mbuf->blk_count == 0) {
+        mbuf->hint_size = len;
+    }
+    mbuf_enq(mbuf, (void *)p, len);
+    mbuf->hint_size = hint;
+
+    return p + len;
+}
+
+uint32_t rdts_serialize_size(rdt_session_t *rdts)
+{
+    return sizeof(rdts_image_t) + rdts->raw_snd_buf->data_size + rdts->raw_rcv_buf->data_size + rdts->rcv_buf->data_size;
+}
+
+int rdts_serialize(rdt_session_t *rdts, char *buf, uint32_t size)
+{
+    rdts_image_t img;
+    char *p;
+    uint32_t len = rdts_serialize_size(rdts);
+    if (size < len) {
+        return -1;
+    }
+
+    memset(&img, 0, sizeof(img));
+    img.magic = RDTS_IMAGE_MAGIC;
+    img.version = RDTS_IMAGE_VERSION;
+    img.len = len;
+    img.sid = rdts->sid;
+    img.rcv_raw_offset = rdts->rcv_raw_offset;
+    img.remote_rcv_raw_offset = rdts->remote_rcv_raw_offset;
+    img.acked_offset = rdts->acked_offset;
+    img.enable = rdts->enable;
+    img.need_ack = rdts->need_ack;
+    img.snd_mode = rdts->snd_mode;
+    img.logmask = rdts->logmask;
+    img.flags = rdts->raw_rcv_buf->ring ? RDTS_IMAGE_RING : 0;
+    img.max_raw_snd_buf_size = rdts->max_raw_snd_buf_size;
+    img.auto_ack_limit = rdts->auto_ack_limit;
+    img.ack_delay_ms = rdts->ack_delay_ms;
+    img.rcv_window = rdts->rcv_window;
+    img.shrink_idle_ms = rdts->shrink_idle_ms;
+    img.raw_snd_len = rdts->raw_snd_buf->data_size;
+    img.raw_rcv_len = rdts->raw_rcv_buf->data_size;
+    img.rcv_len = rdts->rcv_buf->data_size;
+
+    memcpy(buf, &img, sizeof(img));
+    p = buf + sizeof(img);
+    p = image_copy_out(rdts->raw_snd_buf, p);
+    p = image_copy_out(rdts->raw_rcv_buf, p);
+    p = image_copy_out(rdts->rcv_buf, p);
+
+    return (int)(p - buf);
+}
+
+rdt_session_t *rdts_deserialize(const char *buf, uint32_t size, uint32_t *used, void *user)
+{
+    rdts_image_t img;
+    rdt_session_t *rdts;
+    const char *p = buf + sizeof(img);
+
+    if (size < sizeof(img)) {
+        return NULL;
+    }
+
+    memcpy(&img, buf, sizeof(img));
+    if (img.magic != RDTS_IMAGE_MAGIC || img.version != RDTS_IMAGE_VERSION || img.len > size
+            || (uint64_t)sizeof(img) + img.raw_snd_len + img.raw_rcv_len + img.rcv_len != img.len) {
+        return NULL;
+    }
+
+    rdts = rdts_create(img.sid, user);
+    if (rdts == NULL) {
+        return NULL;
+    }
+
+    rdts_set_snd_mode(rdts, img.snd_mode);
+    if (img.flags & RDTS_IMAGE_RING) {
+        rdts_set_rcv_ring(rdts);
+    }
+    rdts->rcv_raw_offset = img.rcv_raw_offset;
+    rdts->remote_rcv_raw_offset = img.remote_rcv_raw_offset;
+    rdts->acked_offset = img.acked_offset;
+    rdts->enable = img.enable;
+    rdts->need_ack = img.need_ack;
+    rdts->logmask = img.logmask;
+    rdts->max_raw_snd_buf_size = img.max_raw_snd_buf_size;
+    rdts->auto_ack_limit = img.auto_ack_limit;
+    rdts->ack_delay_ms = img.ack_delay_ms;
+    rdts->rcv_window = img.rcv_window;
+    rdts->adv_window = img.rcv_window;
+    rdts->shrink_idle_ms = img.shrink_idle_ms;
+
+    p = image_copy_in(rdts->raw_snd_buf, p, img.raw_snd_len);
+    p = image_copy_in(rdts->raw_rcv_buf, p, img.raw_rcv_len);
+    image_copy_in(rdts->rcv_buf, p, img.rcv_len);
+
+    if (used) {
+        *used = img.len;
+    }
+
+    return rdts;
+}
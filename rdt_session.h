@@ -12,6 +12,9 @@
 
 #include <stdint.h>
 
+#include "rdts_timer.h"
+#include "mbuf.h"
+
 #ifndef INLINE
 #if defined(__GNUC__)
 
@@ -51,14 +54,38 @@
 #define RDTS_NO_ACK  0
 #define RDTS_ACK 1
 
-struct mbuf_s;
-typedef struct mbuf_s mbuf_t;
+//send modes
+//RDTS_SND_COPY: payload is copied into both snd_buf and raw_snd_buf
+//RDTS_SND_REF: payload lives once in raw_snd_buf, queued frames only keep
+//              their header and a reference into raw_snd_buf
+#define RDTS_SND_COPY 0
+#define RDTS_SND_REF  1
+
+//watermark events, see rdts_set_onwatermark()
+#define RDTS_WM_LOW  0
+#define RDTS_WM_HIGH 1
+
+struct iovec;
+struct rdt_snd_seg_s;
+
+typedef struct rdt_stat_s {
+    uint64_t frames;        //frames queued for sending
+    uint64_t hdr_bytes;     //frame header bytes queued
+    uint64_t batches;       //data frames emitted by rdts_uncork()
+    uint64_t batch_msgs;    //messages coalesced into those frames
+    uint64_t hdr_saved;     //header bytes saved by coalescing
+    uint64_t acks;              //acks sent
+    uint64_t acks_piggybacked;  //acks that rode on a data frame
+    uint64_t acks_timer;        //acks triggered by the delayed ack timer
+    uint64_t ack_bytes;         //bytes acknowledged, ack_bytes / acks is bytes per ack
+} rdt_stat_t;
 
 typedef struct rdt_session_s {
     int sid;
     int logmask;
     int enable;
     int need_ack;
+    int snd_mode;
 
     uint64_t rcv_raw_offset;
     uint64_t remote_rcv_raw_offset;
@@ -67,16 +94,80 @@ typedef struct rdt_session_s {
     uint32_t auto_ack_limit;
     uint32_t auto_ack_count;
 
+    //delayed ack: ack once received data has waited ack_delay_ms, see rdts_update()
+    uint32_t ack_delay_ms;
+    uint64_t ack_since_ms;
+    uint64_t current_ms;
+    uint64_t acked_offset;
+
     mbuf_t *raw_rcv_buf;
     mbuf_t *rcv_buf;
 
     mbuf_t *raw_snd_buf;
     mbuf_t *snd_buf;
+    //bytes allocated by the four buffers above, blocks are only allocated on first use
+    mbuf_acct_t mem;
+    //shrink the buffers once their data stayed small for shrink_idle_ms (0 = never)
+    uint32_t shrink_idle_ms;
+    uint64_t shrink_busy_ms;
+    uint64_t shrink_mem;    //mem.bytes the last shrink left, see rdts_next_update()
+
+    //RDTS_SND_REF only: frames queued behind snd_buf, a circular array
+    struct rdt_snd_seg_s *snd_segs;
+    uint32_t snd_seg_cap;
+    uint32_t snd_seg_head;
+    uint32_t snd_seg_count;
+    uint32_t snd_seg_bytes;
+
+    //pending rdts_send_reserve() space in raw_snd_buf
+    char *snd_reserve;
+    uint32_t snd_reserve_len;
+
+    //rdts_send_ack() was called and the ack is not framed yet
+    int ack_pending;
+
+    //receive window advertised with acks (0 = off) and its last advertised value
+    uint32_t rcv_window;
+    uint32_t adv_window;
+    //remote window: sending is limited to this stream offset, 0 = no limit
+    uint64_t remote_wnd_limit;
+
+    //send watermarks on unacked bytes, see rdts_set_onwatermark()
+    uint32_t wm_low;
+    uint32_t wm_high;
+    int wm_state;
+    void (*on_watermark)(int event, uint32_t unacked, void *userdata);
+    void *wm_userdata;
+
+    //rdts_cork(): data sent since then, framed at once by rdts_uncork()
+    int snd_cork;
+    uint64_t cork_off;
+    uint32_t cork_len;
+    uint32_t cork_msgs;
+    uint32_t cork_hdr_bytes;
+
+    rdt_stat_t stat;
+
+    //intrusive ready list links, owned by the session manager
+    struct rdt_session_s *ready_prev;
+    struct rdt_session_s *ready_next;
+    int ready;
+    //expiry timer while disabled, owned by the session manager
+    rdts_timer_t expire_timer;
+    //next rdts_update() while enabled, owned by the session manager
+    rdts_timer_t update_timer;
+    //disabled list links, oldest first, owned by the session manager
+    struct rdt_session_s *disabled_prev;
+    struct rdt_session_s *disabled_next;
 
     void *user;
     void *userdata;
 
     void (*on_ack)(uint64_t offset, void *userdata);
+
+    //receive callback mode, see rdts_set_onrecv()
+    uint32_t (*on_recv)(const char *data, uint32_t len, void *userdata);
+    void *recv_userdata;
 	void (*writelog)(const char *log, struct rdt_session_s *session, void *user);
 
 } rdt_session_t;
@@ -105,6 +196,25 @@ rdt_session_t *rdts_create(int sid, void *user);
 //@auto_ack_size  when one endpoint receives auto_ack_size data, rdt session will auto send an ack to remote endpoint
 void rdts_init(rdt_session_t *rdts, uint32_t max_raw_snd_buf_size, uint32_t auto_ack_size);
 
+//set delayed ack timeout, 0 disables it (the default).
+//received data is acked after 'delay_ms' or auto_ack_size bytes, whichever comes first
+void rdts_set_ack_delay(rdt_session_t *rdts, uint32_t delay_ms);
+
+//drive the session timers with the current time in milliseconds, call it every tick
+//or when rdts_next_update() says
+void rdts_update(rdt_session_t *rdts, uint64_t now_ms);
+//when rdts_update() has work next, on its clock. 0 if it has none until the session
+//sees input or output again, so a caller with many sessions can keep them on a timer wheel
+uint64_t rdts_next_update(rdt_session_t *rdts);
+
+//switch raw_rcv_buf and rcv_buf to ring mode, so pulling them up never copies.
+//call it before any data is received, returns -1 if a buffer can't be switched
+int rdts_set_rcv_ring(rdt_session_t *rdts);
+
+//set send mode (RDTS_SND_COPY or RDTS_SND_REF) and return old value.
+//the mode can only change while there is nothing waiting in the send queue, otherwise returns -1
+int rdts_set_snd_mode(rdt_session_t *rdts, int mode);
+
 //set rdts enable flag and return old value
 int rdts_set_enable(rdt_session_t *rdts, int flag);
 //check rdts enable flag. if enable then return 1 else 0
@@ -123,27 +233,92 @@ void rdts_reset(rdt_session_t *rdts);
 // user level send, returns below 0 for error
 int rdts_send(rdt_session_t *rdts, const char *buf, uint32_t len);
 
+// zero copy send: reserve 'len' bytes of writable space inside the session,
+// encode the message into it, then call rdts_send_commit() before any other call on the session.
+// returns NULL if raw_snd_buf would overflow
+char *rdts_send_reserve(rdt_session_t *rdts, uint32_t len);
+
+// frame the first 'len' bytes of the last reservation, 'len' may be smaller than reserved.
+// returns below 0 for error
+int rdts_send_commit(rdt_session_t *rdts, uint32_t len);
+
+// coalesce everything sent from rdts_cork() to rdts_uncork() into one data frame,
+// e.g. cork at the start of a game tick and uncork at the end of it
+void rdts_cork(rdt_session_t *rdts);
+int rdts_uncork(rdt_session_t *rdts);
+
+// send 'count' messages as a single data frame. all or nothing: returns below 0, with
+// none of them queued, if they don't fit rdts_get_writable() together
+int rdts_send_batch(rdt_session_t *rdts, const struct iovec *msgs, int count);
+
+// bytes that can be sent now, limited by max_raw_snd_buf_size and the remote window
+uint32_t rdts_get_writable(rdt_session_t *rdts);
+
+// set on_watermark callback. RDTS_WM_HIGH fires once unacked data reaches 'high' or a send
+// is refused, RDTS_WM_LOW fires after that once unacked data drains to 'low'. stop producing
+// on HIGH and resume on LOW
+void rdts_set_onwatermark(rdt_session_t *rdts, uint32_t low, uint32_t high, void (*on_watermark)(int event, uint32_t unacked, void *userdata), void *userdata);
+
+// advertise a receive window of 'window' unread bytes with every ack, 0 turns it off (the default).
+// both endpoints must run a version that understands the window field
+void rdts_set_rcv_window(rdt_session_t *rdts, uint32_t window);
+
+// get send statistics, e.g. header bytes saved by batching
+const rdt_stat_t *rdts_get_stat(rdt_session_t *rdts);
+
+// get the bytes allocated by the session buffers
+uint64_t rdts_get_mem(rdt_session_t *rdts);
+// count the session buffers into 'parent' as well, e.g. a manager wide total. NULL detaches
+void rdts_set_mem_parent(rdt_session_t *rdts, mbuf_acct_t *parent);
+// trim buffers grown by a burst back to their initial size, empty ones are released.
+// pointers from the rdts_pullup_*() calls are invalid afterwards. returns the bytes released
+uint32_t rdts_shrink(rdt_session_t *rdts);
+// let rdts_update() shrink the buffers once no data beyond the initial size was held
+// for 'idle_ms', 0 turns it off (the default)
+void rdts_set_shrink(rdt_session_t *rdts, uint32_t idle_ms);
+
 // when reconnect to remote endpoint, resend all data in raw_snd_buf to avoid losing user layer data.
 int rdts_push_raw(rdt_session_t *rdts);
 
 // when you received a low level packet (eg. tcp or udp packet), call it
 int rdts_input(rdt_session_t *rdts, const char *buf, uint32_t len);
 
-// send an ack packet to the remote endpoint to notify the offset of the received data
+// send an ack packet to the remote endpoint to notify the offset of the received data.
+// the ack is folded into the next outgoing data frame, and is only framed on its own
+// when the send queue is read (length/pullup/peek) with no data frame to carry it
 int rdts_send_ack(rdt_session_t *rdts);
 
 //set on_ack callback, when recieved an ack packet and rdts->need_ack is set, which will be invoked by rdts
 void rdts_set_onack(rdt_session_t *rdts, void (*on_ack)(uint64_t offset, void *userdata), void *userdata);
 
+//set on_recv callback, NULL restores the default of buffering in raw_rcv_buf.
+//rdts_input() calls it with received data, straight from the input buffer when nothing is
+//buffered. it returns how many bytes it consumed, e.g. the complete messages, and the rest
+//is kept in raw_rcv_buf and handed over again, ahead of newer data, on the next call.
+//don't call rdts_input() on the same session from inside it
+void rdts_set_onrecv(rdt_session_t *rdts, uint32_t (*on_recv)(const char *data, uint32_t len, void *userdata), void *userdata);
+
 //send buf operation
 //pull data from rdts->snd_buf, and call rdts_drain_snd_buf() to free.
 const char *rdts_pullup_snd_buf(rdt_session_t *rdts);
 
+//map the data in rdts->snd_buf into at most 'max' iovecs without copying,
+//so it can be passed to writev/sendmsg. returns the number of iovecs used.
+//call rdts_drain_snd_buf() with the bytes actually written.
+//the iovecs are only valid until the session is modified again.
+int rdts_peek_snd_iov(rdt_session_t *rdts, struct iovec *iov, int max);
+
 // free all data in rdts->snd_buf
 void rdts_drain_snd_buf(rdt_session_t *rdts, uint32_t len);
 
-// get data length in rdts->snd_buf
+// get data length in rdts->snd_buf. a pending ack is not counted until it is framed:
+// rdts_pullup_snd_buf() and rdts_peek_snd_iov() do that, or rdts_flush_ack()
 uint32_t rdts_get_snd_buf_length(rdt_session_t *rdts);
+// frame a pending ack that found no data frame to ride on
+void rdts_flush_ack(rdt_session_t *rdts);
+
+//check for frames or an ack waiting to be sent, without framing the ack
+int rdts_has_output(rdt_session_t *rdts);
 
 //recv buf operation
 //pull data from rdts->raw_rcv_buf, and call rdts_drain_snd_buf() to free.
@@ -158,6 +333,15 @@ uint32_t rdts_get_raw_rcv_buf_length(rdt_session_t *rdts);
 //for debug
 uint64_t rdts_get_rcv_raw_offset(rdt_session_t *rdts);
 
+//snapshot, e.g. to carry sessions over a process restart. the image keeps the stream
+//offsets, unacked and unread data and the settings, in native byte order.
+//a restored session resumes with the usual reconnect
+uint32_t rdts_serialize_size(rdt_session_t *rdts);
+//write the image into 'buf', returns its length or -1 if 'size' is too small
+int rdts_serialize(rdt_session_t *rdts, char *buf, uint32_t size);
+//create a session from an image, NULL if it is malformed. '*used' gets the image length
+rdt_session_t *rdts_deserialize(const char *buf, uint32_t size, uint32_t *used, void *user);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,696 @@
+//network I/O thread. the thread sleeps in its backend (io_uring, epoll or poll) on its
+//sockets and on a wake pipe; the logic thread writes the pipe only when the I/O thread said
+//it is going to sleep, and the other way around with a notify pipe, so busy threads never
+//make a syscall for each other. work that does not come from the kernel (output queued by
+//commands, packets left over while the event ring was full, closing and reporting) is
+//kept on a list of dirty connections, so a round never scans every connection.
+//a connection that fails stays open until its RDTS_IO_CLOSED is in the ring, which keeps
+//its fd, and so its id, from being reused before the logic thread hears of it.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "rdts_io_impl.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define IO_GEN_MASK 0x7ff
+
+#define IO_INPUT_HINT 10240
+#define IO_IOV_MAX 64
+//accepts per readiness wakeup, the listening socket stays readable for the rest
+#define IO_ACCEPT_MAX 64
+
+//commands, logic -> I/O thread
+enum {
+    IO_CMD_ADD = 1,
+    IO_CMD_LISTEN,
+    IO_CMD_SEND,
+    IO_CMD_CLOSE,
+};
+
+//in the order AUTO tries them, indexed by RDTS_IO_BACKEND_* - 1
+static const io_backend_t *io_backends[] = {
+    &io_backend_uring,
+    &io_backend_epoll,
+    &io_backend_poll,
+};
+
+static int make_id(rdts_io_t *io, int fd)
+{
+    int gen = (__atomic_add_fetch(&io->gen, 1, __ATOMIC_RELAXED) & IO_GEN_MASK) | 1;
+    return gen << IO_FD_BITS | fd;
+}
+
+static int set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void wake_pipe(int fd)
+{
+    char c = 0;
+    ssize_t r = write(fd, &c, 1);
+    (void)r;
+}
+
+static void drain_pipe(int fd)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+}
+
+void io_drain_wake(rdts_io_t *io)
+{
+    drain_pipe(io->wake[0]);
+}
+
+io_conn_t *io_conn_get(rdts_io_t *io, int id)
+{
+    int fd = IO_ID_FD(id);
+    if (fd >= io->conn_cap || io->conns[fd].id != id) {
+        return NULL;
+    }
+    return &io->conns[fd];
+}
+
+void io_touch(rdts_io_t *io, io_conn_t *c)
+{
+    if (c->dirty) {
+        return;
+    }
+    if (io->dirty_count == io->dirty_cap) {
+        int cap = io->dirty_cap ? io->dirty_cap * 2 : 64;
+        int *dirty = (int *)realloc(io->dirty, cap * sizeof(int));
+        if (dirty == NULL) {
+            return;
+        }
+        io->dirty = dirty;
+        io->dirty_cap = cap;
+    }
+    io->dirty[io->dirty_count++] = c->id;
+    c->dirty = 1;
+}
+
+static io_conn_t *conn_add(rdts_io_t *io, int fd, int id, int listening)
+{
+    io_conn_t *c;
+
+    if (fd >= io->conn_cap) {
+        int cap = io->conn_cap ? io->conn_cap : 64;
+        io_conn_t *conns;
+        while (cap <= fd) {
+            cap *= 2;
+        }
+        conns = (io_conn_t *)realloc(io->conns, cap * sizeof(io_conn_t));
+        if (conns == NULL) {
+            return NULL;
+        }
+        memset(conns + io->conn_cap, 0, (cap - io->conn_cap) * sizeof(io_conn_t));
+        io->conns = conns;
+        io->conn_cap = cap;
+    }
+
+    c = &io->conns[fd];
+    memset(c, 0, sizeof(*c));
+    c->id = id;
+    c->listening = listening;
+    c->sending = -1;
+    //without a ring (it falls back by itself) pulling a packet up may copy
+    if (listening) {
+        mbuf_init_lazy(&c->in, IO_INPUT_HINT);
+    } else {
+        mbuf_init_ring(&c->in, IO_INPUT_HINT);
+    }
+    mbuf_init_lazy(&c->out, IO_INPUT_HINT);
+    set_nonblock(fd);
+
+    if (io->backend->add(io, c) != 0) {
+        int err = errno;
+        mbuf_free(&c->in);
+        mbuf_free(&c->out);
+        c->id = 0;
+        errno = err;
+        return NULL;
+    }
+    return c;
+}
+
+static void conn_free(rdts_io_t *io, io_conn_t *c)
+{
+    io->backend->remove(io, c);
+    close(IO_CONN_FD(io, c));
+    mbuf_free(&c->in);
+    mbuf_free(&c->out);
+    c->id = 0;
+}
+
+static int conn_busy(rdts_io_t *io, io_conn_t *c)
+{
+    return c->out.data_size > 0 || (io->backend->busy && io->backend->busy(io, c));
+}
+
+//queue what is left of a failed connection's story, then let the fd go
+static void conn_report(rdts_io_t *io, io_conn_t *c)
+{
+    const char *msg = c->err ? strerror(c->err) : "";
+
+    if (rdts_spsc_push(io->events, c->id, RDTS_IO_CLOSED, msg, strlen(msg)) != 0) {
+        io->events_full = 1;
+        io_touch(io, c);
+        return;
+    }
+    io->events_added = 1;
+    conn_free(io, c);
+}
+
+//queue the RDTS_IO_ACCEPT of 'c' with its peer address, -1 while the ring is full
+static int conn_announce(rdts_io_t *io, io_conn_t *c)
+{
+    socklen_t slen = 128;
+    char *p = rdts_spsc_reserve(io->events, slen);
+
+    if (p == NULL) {
+        io->events_full = 1;
+        return -1;
+    }
+    if (getpeername(IO_CONN_FD(io, c), (struct sockaddr *)p, &slen) != 0 || slen > 128) {
+        slen = 0;
+    }
+    rdts_spsc_commit(io->events, c->id, RDTS_IO_ACCEPT, slen);
+    io->events_added = 1;
+    c->announce = 0;
+    return 0;
+}
+
+//move the complete packets of 'c' into the event ring, 1 if the ring is full for now
+static int conn_frame(rdts_io_t *io, io_conn_t *c)
+{
+    uint32_t pkg_len;
+    const char *data;
+    char *p;
+
+    if (c->announce && conn_announce(io, c) != 0) {
+        return 1;
+    }
+
+    while (c->in.data_size >= sizeof(pkg_len)) {
+        data = mbuf_pullup(&c->in);
+        memcpy(&pkg_len, data, sizeof(pkg_len));
+        if (pkg_len > rdts_spsc_max(io->events)) {
+            mbuf_drain(&c->in, c->in.data_size);
+            io_fail(io, c, EMSGSIZE);
+            return 0;
+        }
+        if (c->in.data_size - sizeof(pkg_len) < pkg_len) {
+            return 0;
+        }
+
+        p = rdts_spsc_reserve(io->events, pkg_len);
+        if (p == NULL) {
+            io->events_full = 1;
+            return 1;
+        }
+        memcpy(p, data + sizeof(pkg_len), pkg_len);
+        rdts_spsc_commit(io->events, c->id, RDTS_IO_DATA, pkg_len);
+        io->events_added = 1;
+        mbuf_drain(&c->in, pkg_len + sizeof(pkg_len));
+    }
+    return 0;
+}
+
+void io_input(rdts_io_t *io, io_conn_t *c, const char *data, uint32_t len)
+{
+    uint32_t pkg_len;
+
+    if (c->dead) {
+        return;
+    }
+
+    //nothing buffered: the complete packets go from 'data' straight into the ring
+    if (c->in.data_size == 0 && (!c->announce || conn_announce(io, c) == 0)) {
+        while (len >= sizeof(pkg_len)) {
+            memcpy(&pkg_len, data, sizeof(pkg_len));
+            if (pkg_len > rdts_spsc_max(io->events) || len - sizeof(pkg_len) < pkg_len) {
+                break;
+            }
+            if (rdts_spsc_push(io->events, c->id, RDTS_IO_DATA, data + sizeof(pkg_len), pkg_len) != 0) {
+                break;
+            }
+            io->events_added = 1;
+            data += sizeof(pkg_len) + pkg_len;
+            len -= sizeof(pkg_len) + pkg_len;
+        }
+        if (len == 0) {
+            return;
+        }
+    }
+
+    mbuf_enq(&c->in, (void *)data, len);
+    //the logic thread is behind: stop reading 'c' until its packets are in the ring
+    if (conn_frame(io, c) != 0) {
+        if (!c->paused) {
+            c->paused = 1;
+            io->backend->update(io, c);
+        }
+        io_touch(io, c);
+    }
+}
+
+void io_fail(rdts_io_t *io, io_conn_t *c, int err)
+{
+    if (c->dead) {
+        return;
+    }
+    c->dead = 1;
+    c->err = err;
+    io->backend->update(io, c);
+    io_touch(io, c);
+}
+
+void io_accepted(rdts_io_t *io, int fd)
+{
+    io_conn_t *c;
+
+    if (fd >= IO_FD_MAX) {
+        close(fd);
+        return;
+    }
+    c = conn_add(io, fd, make_id(io, fd), 0);
+    if (c == NULL) {
+        close(fd);
+        return;
+    }
+    c->announce = 1;
+    io_touch(io, c);
+}
+
+void io_read(rdts_io_t *io, io_conn_t *c)
+{
+    //one read per wakeup: the backend comes back while there is more
+    ssize_t n = recv(IO_CONN_FD(io, c), io->rbuf, IO_READ_SIZE, 0);
+
+    if (n > 0) {
+        io_input(io, c, io->rbuf, (uint32_t)n);
+    } else if (n == 0) {
+        io_fail(io, c, 0);
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        io_fail(io, c, errno);
+    }
+}
+
+void io_accept(rdts_io_t *io, io_conn_t *c)
+{
+    //io_accepted() may move the table under 'c'
+    int i, fd, lfd = IO_CONN_FD(io, c);
+
+    for (i = 0; i < IO_ACCEPT_MAX; i++) {
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        io_accepted(io, fd);
+    }
+}
+
+void io_flush(rdts_io_t *io, io_conn_t *c)
+{
+    struct iovec iov[IO_IOV_MAX];
+    struct msghdr mh;
+    ssize_t n;
+
+    while (c->out.data_size > 0) {
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = mbuf_peek_iov(&c->out, iov, IO_IOV_MAX);
+        n = sendmsg(IO_CONN_FD(io, c), &mh, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                //the read side reports it
+                mbuf_drain(&c->out, c->out.data_size);
+            }
+            break;
+        }
+        mbuf_drain(&c->out, (uint32_t)n);
+    }
+
+    if (c->closing && c->out.data_size == 0) {
+        io_touch(io, c);
+    }
+}
+
+static void run_commands(rdts_io_t *io)
+{
+    const char *data, *msg;
+    int id, type;
+    uint32_t len;
+
+    io->cmds_blocked = 0;
+    while ((data = rdts_spsc_peek(io->cmds, &id, &type, &len)) != NULL) {
+        io_conn_t *c = io_conn_get(io, id);
+        int fd = IO_ID_FD(id);
+
+        switch (type) {
+        case IO_CMD_ADD:
+        case IO_CMD_LISTEN:
+            errno = 0;
+            c = conn_add(io, fd, id, type == IO_CMD_LISTEN);
+            if (c == NULL) {
+                //lua holds 'id' already. like a failed connection, the fd stays open
+                //(and the command queued) until its RDTS_IO_CLOSED is in the ring
+                msg = strerror(errno ? errno : EIO);
+                if (rdts_spsc_push(io->events, id, RDTS_IO_CLOSED, msg, strlen(msg)) != 0) {
+                    io->events_full = 1;
+                    io->cmds_blocked = 1;
+                    return;
+                }
+                io->events_added = 1;
+                close(fd);
+            } else if (len > 0) {
+                io_input(io, c, data, len);
+            }
+            break;
+        case IO_CMD_SEND:
+            //written once the whole batch of commands is in, not one syscall per send
+            if (c && !c->dead && !c->closing) {
+                uint32_t n = len;
+                mbuf_enq(&c->out, &n, sizeof(n));
+                mbuf_enq(&c->out, (void *)data, len);
+                io_touch(io, c);
+            }
+            break;
+        case IO_CMD_CLOSE:
+            if (c) {
+                c->closing = 1;
+                //a dead one has nothing more to say
+                if (c->dead) {
+                    mbuf_drain(&c->out, c->out.data_size);
+                }
+                io_touch(io, c);
+            }
+            break;
+        }
+        rdts_spsc_pop(io->cmds);
+    }
+}
+
+//the work on a connection that does not wait for the kernel: packets left over while the
+//event ring was full, queued output, closing and reporting failures
+static void conn_step(rdts_io_t *io, io_conn_t *c)
+{
+    if (c->dead && c->closing) {
+        conn_free(io, c);
+        return;
+    }
+
+    if (!c->listening && (c->announce || c->in.data_size >= sizeof(uint32_t))) {
+        if (conn_frame(io, c) != 0) {
+            io_touch(io, c);
+            return;
+        }
+    }
+    //resumes input, writes output and retries what the backend could not submit
+    c->paused = 0;
+    io->backend->update(io, c);
+    if (c->closing && !conn_busy(io, c)) {
+        conn_free(io, c);
+        return;
+    }
+    //its packets go first
+    if (c->id && c->dead) {
+        conn_report(io, c);
+    }
+}
+
+static void run_steps(rdts_io_t *io)
+{
+    int i, n = io->dirty_count;
+
+    if (n == 0) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        io_conn_t *c = io_conn_get(io, io->dirty[i]);
+        if (c) {
+            c->dirty = 0;
+            conn_step(io, c);
+        }
+    }
+    //touched while stepping: next round
+    memmove(io->dirty, io->dirty + n, (io->dirty_count - n) * sizeof(int));
+    io->dirty_count -= n;
+}
+
+static int start_backend(rdts_io_t *io)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(io_backends) / sizeof(io_backends[0])); i++) {
+        if (io->kind != RDTS_IO_BACKEND_AUTO && io->kind != i + 1) {
+            continue;
+        }
+        io->backend = io_backends[i];
+        if (io->backend->init(io) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void *io_main(void *arg)
+{
+    rdts_io_t *io = (rdts_io_t *)arg;
+    int i, timeout;
+
+    //io_uring wants to be set up by the thread that submits
+    if (start_backend(io) != 0) {
+        io->err = errno ? errno : ENOSYS;
+        __atomic_store_n(&io->started, -1, __ATOMIC_RELEASE);
+        wake_pipe(io->notify[1]);
+        return NULL;
+    }
+    __atomic_store_n(&io->started, 1, __ATOMIC_RELEASE);
+    wake_pipe(io->notify[1]);
+
+    while (!__atomic_load_n(&io->stop, __ATOMIC_ACQUIRE)) {
+        io->events_full = 0;
+        run_commands(io);
+        run_steps(io);
+
+        if (io->events_added) {
+            io->events_added = 0;
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&io->logic_sleeping, __ATOMIC_RELAXED)) {
+                wake_pipe(io->notify[1]);
+            }
+        }
+
+        //a full event ring is polled for room, there is no wakeup for it
+        timeout = io->dirty_count || io->cmds_blocked ? (io->events_full ? 1 : 0) : -1;
+        __atomic_store_n(&io->io_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if ((!io->cmds_blocked && !rdts_spsc_empty(io->cmds)) || __atomic_load_n(&io->stop, __ATOMIC_RELAXED)) {
+            timeout = 0;
+        }
+        io->backend->wait(io, timeout);
+        __atomic_store_n(&io->io_sleeping, 0, __ATOMIC_RELAXED);
+    }
+
+    //added sockets still in the ring are owned here too
+    run_commands(io);
+    for (i = 0; i < io->conn_cap; i++) {
+        if (io->conns[i].id) {
+            conn_free(io, &io->conns[i]);
+        }
+    }
+    io->backend->release(io);
+    free(io->conns);
+    free(io->dirty);
+    mbuf_pool_clear();
+
+    return NULL;
+}
+
+static int open_pipe(int fds[2])
+{
+    if (pipe(fds) < 0) {
+        return -1;
+    }
+    set_nonblock(fds[0]);
+    set_nonblock(fds[1]);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+rdts_io_t *rdts_io_create(uint32_t ring_size, int backend)
+{
+    rdts_io_t *io = (rdts_io_t *)calloc(1, sizeof(*io));
+    struct pollfd pfd;
+    int i, err;
+
+    if (io == NULL) {
+        return NULL;
+    }
+    io->kind = backend;
+    io->wake[0] = io->wake[1] = io->notify[0] = io->notify[1] = -1;
+    io->events = rdts_spsc_create(ring_size);
+    io->cmds = rdts_spsc_create(ring_size);
+    if (io->events == NULL || io->cmds == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    if (open_pipe(io->wake) < 0 || open_pipe(io->notify) < 0) {
+        goto fail;
+    }
+    err = pthread_create(&io->thread, NULL, io_main, io);
+    if (err != 0) {
+        errno = err;
+        goto fail;
+    }
+
+    pfd.fd = io->notify[0];
+    pfd.events = POLLIN;
+    while (__atomic_load_n(&io->started, __ATOMIC_ACQUIRE) == 0) {
+        poll(&pfd, 1, 100);
+    }
+    drain_pipe(io->notify[0]);
+    if (io->started < 0) {
+        pthread_join(io->thread, NULL);
+        errno = io->err;
+        goto fail;
+    }
+
+    return io;
+
+fail:
+    err = errno;
+    if (io->events) {
+        rdts_spsc_release(io->events);
+    }
+    if (io->cmds) {
+        rdts_spsc_release(io->cmds);
+    }
+    for (i = 0; i < 2; i++) {
+        if (io->wake[i] >= 0) {
+            close(io->wake[i]);
+        }
+        if (io->notify[i] >= 0) {
+            close(io->notify[i]);
+        }
+    }
+    free(io);
+    errno = err;
+    return NULL;
+}
+
+void rdts_io_release(rdts_io_t *io)
+{
+    __atomic_store_n(&io->stop, 1, __ATOMIC_RELEASE);
+    wake_pipe(io->wake[1]);
+    pthread_join(io->thread, NULL);
+
+    close(io->wake[0]);
+    close(io->wake[1]);
+    close(io->notify[0]);
+    close(io->notify[1]);
+    rdts_spsc_release(io->events);
+    rdts_spsc_release(io->cmds);
+    free(io);
+}
+
+static int push_cmd(rdts_io_t *io, int id, int type, const char *data, uint32_t len)
+{
+    if (rdts_spsc_push(io->cmds, id, type, data, len) != 0) {
+        return -1;
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&io->io_sleeping, __ATOMIC_RELAXED)) {
+        wake_pipe(io->wake[1]);
+    }
+    return 0;
+}
+
+int rdts_io_add(rdts_io_t *io, int fd, int listening, const char *pending, uint32_t len)
+{
+    int id;
+
+    if (fd < 0 || fd >= IO_FD_MAX) {
+        return -1;
+    }
+    id = make_id(io, fd);
+    if (push_cmd(io, id, listening ? IO_CMD_LISTEN : IO_CMD_ADD, pending, len) != 0) {
+        return -1;
+    }
+    return id;
+}
+
+int rdts_io_send(rdts_io_t *io, int id, const char *data, uint32_t len)
+{
+    return push_cmd(io, id, IO_CMD_SEND, data, len);
+}
+
+int rdts_io_close(rdts_io_t *io, int id)
+{
+    return push_cmd(io, id, IO_CMD_CLOSE, NULL, 0);
+}
+
+const char *rdts_io_backend(rdts_io_t *io)
+{
+    return io->backend->name;
+}
+
+uint32_t rdts_io_max_packet(rdts_io_t *io)
+{
+    return rdts_spsc_max(io->events);
+}
+
+const char *rdts_io_peek(rdts_io_t *io, int *id, int *type, uint32_t *len)
+{
+    return rdts_spsc_peek(io->events, id, type, len);
+}
+
+void rdts_io_pop(rdts_io_t *io)
+{
+    rdts_spsc_pop(io->events);
+}
+
+int rdts_io_wait(rdts_io_t *io, int timeout_ms)
+{
+    struct pollfd pfd;
+
+    if (!rdts_spsc_empty(io->events)) {
+        return 1;
+    }
+
+    __atomic_store_n(&io->logic_sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (rdts_spsc_empty(io->events)) {
+        pfd.fd = io->notify[0];
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            drain_pipe(io->notify[0]);
+        }
+    }
+    __atomic_store_n(&io->logic_sleeping, 0, __ATOMIC_RELAXED);
+
+    return !rdts_spsc_empty(io->events);
+}
@@ -0,0 +1,63 @@
+//network I/O thread: owns the sockets, reads and frames packets, writes queued output
+#ifndef __RDTS_IO_H__
+#define __RDTS_IO_H__
+
+#include <stdint.h>
+
+struct rdts_io_s;
+typedef struct rdts_io_s rdts_io_t;
+
+//packets are len(4)|data like recv_packet/pack_msg. the I/O thread hands complete packets
+//to the logic thread over one spsc ring (rdts_spsc.h) and takes output and commands from
+//it over another, so a stalled logic thread (e.g. a long GC step) never stalls socket
+//reads: the kernel buffers are drained into the ring meanwhile. sessions stay on the
+//logic thread, which calls rdts_input() on the packets it takes.
+//every rdts_io_* call below is for the logic thread only.
+//
+//connections are named by an id rather than the fd: fds are reused as soon as they are
+//closed, so a command still in flight for a closed connection could hit a new one
+
+//events, with the id of the connection they are about
+enum {
+    RDTS_IO_DATA = 1,   //a packet, without its length header
+    RDTS_IO_ACCEPT,     //accepted on a listening socket, data is its struct sockaddr
+    RDTS_IO_CLOSED,     //closed by the peer or on error, data is the error text (empty on EOF)
+};
+
+//how the I/O thread waits for its sockets. AUTO takes the first one the system runs:
+//io_uring (Linux 6.0 or later) with multishot recv into a provided buffer ring and writes
+//from registered buffers, else epoll, else poll
+enum {
+    RDTS_IO_BACKEND_AUTO = 0,
+    RDTS_IO_BACKEND_URING,
+    RDTS_IO_BACKEND_EPOLL,
+    RDTS_IO_BACKEND_POLL,
+};
+
+//start the I/O thread, each ring gets 'ring_size' bytes. NULL with errno set on failure,
+//ENOSYS or the setup error if 'backend' can't run here
+rdts_io_t *rdts_io_create(uint32_t ring_size, int backend);
+//stop the thread and close every socket it owns
+void rdts_io_release(rdts_io_t *io);
+
+//hand 'fd' over, the I/O thread owns it from now on. accepted sockets of a listening one
+//are added by themselves. 'pending' is input already read from it, e.g. a partial packet.
+//returns the connection id, or -1 while the command ring is full (or 'fd' is too large).
+//if the I/O thread can't take it, the id gets an RDTS_IO_CLOSED with the error
+int rdts_io_add(rdts_io_t *io, int fd, int listening, const char *pending, uint32_t len);
+//queue 'data' as one packet, -1 if the ring is full or 'len' is larger than a ring takes
+int rdts_io_send(rdts_io_t *io, int id, const char *data, uint32_t len);
+//close the connection once its queued output is written, no RDTS_IO_CLOSED follows
+int rdts_io_close(rdts_io_t *io, int id);
+//"uring", "epoll" or "poll"
+const char *rdts_io_backend(rdts_io_t *io);
+//the largest packet a ring takes
+uint32_t rdts_io_max_packet(rdts_io_t *io);
+
+//the oldest event, NULL if there is none. valid until rdts_io_pop()
+const char *rdts_io_peek(rdts_io_t *io, int *id, int *type, uint32_t *len);
+void rdts_io_pop(rdts_io_t *io);
+//wait up to 'timeout_ms' (-1 forever) for an event, returns 1 if there is one
+int rdts_io_wait(rdts_io_t *io, int timeout_ms);
+
+#endif //__RDTS_IO_H__
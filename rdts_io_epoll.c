@@ -0,0 +1,160 @@
+//epoll backend of the I/O thread: a connection is registered once, its interest only
+//changes when it pauses, dies or has output the socket did not take
+#include "rdts_io_impl.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define IO_EPOLL_EVENTS 256
+
+typedef struct io_epoll_s {
+    int epfd;
+    struct epoll_event evs[IO_EPOLL_EVENTS];
+} io_epoll_t;
+
+static int epoll_init(rdts_io_t *io)
+{
+    io_epoll_t *p = (io_epoll_t *)malloc(sizeof(io_epoll_t));
+    struct epoll_event ev;
+
+    if (p == NULL) {
+        return -1;
+    }
+    p->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (p->epfd < 0) {
+        free(p);
+        return -1;
+    }
+    //ids are never 0
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, io->wake[0], &ev) != 0) {
+        close(p->epfd);
+        free(p);
+        return -1;
+    }
+    io->bd = p;
+    return 0;
+}
+
+static void epoll_release(rdts_io_t *io)
+{
+    io_epoll_t *p = (io_epoll_t *)io->bd;
+    close(p->epfd);
+    free(p);
+}
+
+static int epoll_watch(rdts_io_t *io, io_conn_t *c, uint32_t events)
+{
+    io_epoll_t *p = (io_epoll_t *)io->bd;
+    struct epoll_event ev;
+    int op;
+
+    if (events == c->watch) {
+        return 0;
+    }
+    //an fd without interest is taken out: EPOLLHUP would come back level-triggered
+    if (events == 0) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        op = c->watch ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    }
+    ev.events = events;
+    ev.data.u64 = (uint32_t)c->id;
+    if (epoll_ctl(p->epfd, op, IO_CONN_FD(io, c), &ev) != 0) {
+        return -1;
+    }
+    c->watch = events;
+    return 0;
+}
+
+static uint32_t epoll_interest(io_conn_t *c)
+{
+    uint32_t events = 0;
+
+    if (!c->dead && !c->paused) {
+        events |= EPOLLIN;
+    }
+    if (c->out.data_size > 0) {
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+static int epoll_add(rdts_io_t *io, io_conn_t *c)
+{
+    return epoll_watch(io, c, EPOLLIN);
+}
+
+static void epoll_remove(rdts_io_t *io, io_conn_t *c)
+{
+    epoll_watch(io, c, 0);
+}
+
+static void epoll_update(rdts_io_t *io, io_conn_t *c)
+{
+    //most output fits the socket buffer, EPOLLOUT is only asked for the rest
+    if (c->out.data_size > 0) {
+        io_flush(io, c);
+    }
+    epoll_watch(io, c, epoll_interest(c));
+}
+
+static void epoll_wait_io(rdts_io_t *io, int timeout_ms)
+{
+    io_epoll_t *p = (io_epoll_t *)io->bd;
+    int i, n = epoll_wait(p->epfd, p->evs, IO_EPOLL_EVENTS, timeout_ms);
+
+    for (i = 0; i < n; i++) {
+        uint32_t events = p->evs[i].events;
+        io_conn_t *c;
+
+        if (p->evs[i].data.u64 == 0) {
+            io_drain_wake(io);
+            continue;
+        }
+        c = io_conn_get(io, (int)p->evs[i].data.u64);
+        if (c == NULL) {
+            continue;
+        }
+        if (events & EPOLLOUT) {
+            io_flush(io, c);
+            if (c->out.data_size == 0) {
+                epoll_watch(io, c, epoll_interest(c));
+            }
+        }
+        if (!c->dead && !c->paused && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            if (c->listening) {
+                io_accept(io, c);
+            } else {
+                io_read(io, c);
+            }
+        }
+    }
+}
+
+const io_backend_t io_backend_epoll = {
+    "epoll",
+    epoll_init,
+    epoll_release,
+    epoll_add,
+    epoll_remove,
+    epoll_update,
+    epoll_wait_io,
+    NULL,
+};
+
+#else
+
+static int epoll_init(rdts_io_t *io)
+{
+    return -1;
+}
+
+const io_backend_t io_backend_epoll = {"epoll", epoll_init};
+
+#endif
@@ -0,0 +1,110 @@
+//internals of the network I/O thread, shared by its core (rdts_io.c) and the backends
+#ifndef __RDTS_IO_IMPL_H__
+#define __RDTS_IO_IMPL_H__
+
+#include "rdts_io.h"
+#include "rdts_spsc.h"
+#include "mbuf.h"
+
+#include <pthread.h>
+
+//id = generation << IO_FD_BITS | fd
+#define IO_FD_BITS 20
+#define IO_FD_MAX (1 << IO_FD_BITS)
+#define IO_ID_FD(id) ((id) & (IO_FD_MAX - 1))
+#define IO_CONN_FD(io, c) ((int)((c) - (io)->conns))
+
+#define IO_READ_SIZE (16 * 1024)
+
+typedef struct io_conn_s {
+    int id;         //0 if the slot is free
+    int listening;
+    int closing;    //close once the output is written
+    int dead;       //input is over, RDTS_IO_CLOSED still to be queued
+    int err;        //errno behind 'dead', 0 for EOF
+    int announce;   //accepted, RDTS_IO_ACCEPT still to be queued
+    int paused;     //input stops until the logic thread has taken the packets
+    int dirty;      //on the step list
+    mbuf_t in;
+    mbuf_t out;
+
+    //backend state
+    uint32_t watch; //epoll: registered events, 0 if not registered
+    int armed;      //uring: multishot recv/accept in flight
+    int canceling;  //uring: cancel of it in flight
+    int sending;    //uring: fixed buffer chunk being written, -1 if none
+} io_conn_t;
+
+typedef struct io_backend_s {
+    const char *name;
+    //0, or -1 if the system can't run it. called on the I/O thread
+    int (*init)(rdts_io_t *io);
+    void (*release)(rdts_io_t *io);
+    //start reading (accepting) 'c', -1 on failure
+    int (*add)(rdts_io_t *io, io_conn_t *c);
+    //'c' is about to be closed
+    void (*remove)(rdts_io_t *io, io_conn_t *c);
+    //'c->paused', 'c->dead' or its output changed
+    void (*update)(rdts_io_t *io, io_conn_t *c);
+    //wait for I/O up to 'timeout_ms' (-1 forever, 0 not at all) and handle it
+    void (*wait)(rdts_io_t *io, int timeout_ms);
+    //'c' still has output in flight outside c->out, NULL if it never has
+    int (*busy)(rdts_io_t *io, io_conn_t *c);
+} io_backend_t;
+
+extern const io_backend_t io_backend_uring;
+extern const io_backend_t io_backend_epoll;
+extern const io_backend_t io_backend_poll;
+
+#ifdef RDTS_TEST
+//the next n io_uring sqes are refused as if the SQ were full
+extern int io_uring_sqe_fail;
+#endif
+
+struct rdts_io_s
+{
+    rdts_spsc_t *events;    //I/O -> logic
+    rdts_spsc_t *cmds;      //logic -> I/O
+    int wake[2];
+    int notify[2];
+    int io_sleeping;
+    int logic_sleeping;
+    int stop;
+    int gen;
+    int kind;               //RDTS_IO_BACKEND_*, as asked for
+    const io_backend_t *backend;
+    int started;            //backend up, or -1 if none could start
+    int err;                //errno of the failed start
+
+    //I/O thread only
+    io_conn_t *conns;       //by fd
+    int conn_cap;
+    int *dirty;             //ids of connections with work besides I/O readiness
+    int dirty_count;
+    int dirty_cap;
+    int events_full;        //the event ring ran full this round
+    int cmds_blocked;       //a command waits for room in the event ring
+    int events_added;       //notify the logic thread after this round
+    void *bd;               //backend data
+    pthread_t thread;
+    char rbuf[IO_READ_SIZE];
+};
+
+//the connection 'id' refers to, NULL if it is gone
+io_conn_t *io_conn_get(rdts_io_t *io, int id);
+//step 'c' again before the next wait
+void io_touch(rdts_io_t *io, io_conn_t *c);
+//bytes received on 'c', framed into packets for the logic thread
+void io_input(rdts_io_t *io, io_conn_t *c, const char *data, uint32_t len);
+//input of 'c' is over, 'err' is 0 for EOF
+void io_fail(rdts_io_t *io, io_conn_t *c, int err);
+//take over a socket accepted on a listening connection
+void io_accepted(rdts_io_t *io, int fd);
+void io_drain_wake(rdts_io_t *io);
+
+//for readiness based backends: one recv(), accept() until EAGAIN, write what the socket takes
+void io_read(rdts_io_t *io, io_conn_t *c);
+void io_accept(rdts_io_t *io, io_conn_t *c);
+void io_flush(rdts_io_t *io, io_conn_t *c);
+
+#endif //__RDTS_IO_IMPL_H__
@@ -0,0 +1,121 @@
+//poll() backend of the I/O thread: runs everywhere, but builds the whole pollfd array
+//again each round
+#include "rdts_io_impl.h"
+
+#include <poll.h>
+#include <stdlib.h>
+
+typedef struct io_poll_s {
+    struct pollfd *pfds;
+    int cap;
+} io_poll_t;
+
+static int poll_init(rdts_io_t *io)
+{
+    io->bd = calloc(1, sizeof(io_poll_t));
+    return io->bd ? 0 : -1;
+}
+
+static void poll_release(rdts_io_t *io)
+{
+    io_poll_t *p = (io_poll_t *)io->bd;
+    free(p->pfds);
+    free(p);
+}
+
+static int poll_add(rdts_io_t *io, io_conn_t *c)
+{
+    return 0;
+}
+
+static void poll_remove(rdts_io_t *io, io_conn_t *c)
+{
+}
+
+//the next round picks the state up, output is tried right away
+static void poll_update(rdts_io_t *io, io_conn_t *c)
+{
+    if (c->out.data_size > 0) {
+        io_flush(io, c);
+    }
+}
+
+static int build_pollfds(rdts_io_t *io, io_poll_t *p)
+{
+    int i, n = 1;
+
+    if (p->cap < io->conn_cap + 1) {
+        struct pollfd *pfds = (struct pollfd *)realloc(p->pfds, (io->conn_cap + 1) * sizeof(struct pollfd));
+        if (pfds == NULL) {
+            return 1;
+        }
+        p->pfds = pfds;
+        p->cap = io->conn_cap + 1;
+    }
+
+    p->pfds[0].fd = io->wake[0];
+    p->pfds[0].events = POLLIN;
+    for (i = 0; i < io->conn_cap; i++) {
+        io_conn_t *c = &io->conns[i];
+        short events = 0;
+        if (c->id == 0) {
+            continue;
+        }
+        //input waits while the logic thread catches up
+        if (!c->dead && !c->paused) {
+            events |= POLLIN;
+        }
+        if (c->out.data_size > 0) {
+            events |= POLLOUT;
+        }
+        if (events) {
+            p->pfds[n].fd = i;
+            p->pfds[n].events = events;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static void poll_wait(rdts_io_t *io, int timeout_ms)
+{
+    io_poll_t *p = (io_poll_t *)io->bd;
+    int i, count = build_pollfds(io, p);
+
+    if (poll(p->pfds, count, timeout_ms) <= 0) {
+        return;
+    }
+
+    if (p->pfds[0].revents) {
+        io_drain_wake(io);
+    }
+    for (i = 1; i < count; i++) {
+        struct pollfd *pfd = &p->pfds[i];
+        io_conn_t *c = &io->conns[pfd->fd];
+        if (pfd->revents == 0) {
+            continue;
+        }
+        if (pfd->revents & POLLOUT) {
+            io_flush(io, c);
+        }
+        if (c->id && !c->dead && !c->paused && (pfd->revents & (POLLIN | POLLHUP | POLLERR))) {
+            if (c->listening) {
+                io_accept(io, c);
+            } else {
+                io_read(io, c);
+            }
+        }
+    }
+}
+
+const io_backend_t io_backend_poll = {
+    "poll",
+    poll_init,
+    poll_release,
+    poll_add,
+    poll_remove,
+    poll_update,
+    poll_wait,
+    NULL,
+};
@@ -0,0 +1,658 @@
+//io_uring backend of the I/O thread. each connection has one multishot recv (accept for a
+//listening one) that stays armed: the kernel picks a buffer from a provided buffer ring
+//for each completion, the data is framed straight from it and the buffer goes back at
+//once. output is copied into registered fixed buffers and written with WRITE_FIXED, one
+//write in flight per connection. the sqes of a round (re-arms, writes of all the sends
+//the commands queued, cancels) go to the kernel with the wait, one syscall per round.
+//
+//user_data is id << 32 | op << 16 | chunk: a completion for a connection that is gone
+//only gives its buffer or chunk back. Linux 6.0 brought multishot recv, it is told
+//apart by IORING_SETUP_SINGLE_ISSUER which came with it.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "rdts_io_impl.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_RECV_MULTISHOT)
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define IO_URING_ENTRIES 1024
+//provided receive buffers, a power of two
+#define IO_URING_BUFS 256
+#define IO_URING_BUF_SIZE IO_READ_SIZE
+#define IO_URING_BGID 0
+//registered output buffers, they are pinned and count against RLIMIT_MEMLOCK
+#define IO_URING_CHUNKS 32
+#define IO_URING_CHUNK_SIZE (32 * 1024)
+
+enum {
+    URING_OP_WAKE = 1,
+    URING_OP_RECV,
+    URING_OP_ACCEPT,
+    URING_OP_WRITE,
+    URING_OP_CANCEL,
+};
+
+#define URING_DATA(id, op, chunk) ((uint64_t)(uint32_t)(id) << 32 | (uint64_t)(op) << 16 | (uint64_t)(chunk))
+
+typedef struct uring_chunk_s {
+    int id;         //connection it is written for
+    uint32_t len;
+    uint32_t off;   //written so far
+    int unsent;     //its write found no sqe, the next update submits it
+    int next;       //free list
+} uring_chunk_t;
+
+typedef struct io_uring_s {
+    int fd;
+    void *ring;
+    size_t ring_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local;      //filled, not yet published
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    char *bufs;
+    uint16_t br_tail;
+
+    char *chunk_mem;
+    uring_chunk_t chunks[IO_URING_CHUNKS];
+    int chunk_free;
+
+    int wake_armed;
+} io_uring_t;
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_uring_register(int fd, unsigned op, void *arg, unsigned nr)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+//publish the filled sqes and, with 'min_complete', wait up to 'timeout_ms' (-1 forever)
+static void uring_enter(io_uring_t *u, unsigned min_complete, int timeout_ms)
+{
+    unsigned submit = u->sq_local - *u->sq_tail;
+    struct io_uring_getevents_arg arg;
+    struct timespec ts;
+
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+    if (min_complete && timeout_ms > 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        sys_uring_enter(u->fd, submit, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        sys_uring_enter(u->fd, submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+
+#ifdef RDTS_TEST
+int io_uring_sqe_fail;
+#endif
+
+static struct io_uring_sqe *uring_sqe(io_uring_t *u)
+{
+    struct io_uring_sqe *sqe;
+
+#ifdef RDTS_TEST
+    if (__atomic_load_n(&io_uring_sqe_fail, __ATOMIC_RELAXED) > 0) {
+        __atomic_sub_fetch(&io_uring_sqe_fail, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+#endif
+
+    if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+        uring_enter(u, 0, 0);
+        if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+            return NULL;
+        }
+    }
+    sqe = &u->sqes[u->sq_local & u->sq_mask];
+    u->sq_local++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void buf_put(io_uring_t *u, unsigned bid)
+{
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (IO_URING_BUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * IO_URING_BUF_SIZE);
+    b->len = IO_URING_BUF_SIZE;
+    b->bid = (uint16_t)bid;
+    u->br_tail++;
+}
+
+static void buf_publish(io_uring_t *u)
+{
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_arm_wake(rdts_io_t *io, io_uring_t *u)
+{
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = io->wake[0];
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_DATA(0, URING_OP_WAKE, 0);
+    u->wake_armed = 1;
+}
+
+static void uring_arm(rdts_io_t *io, io_uring_t *u, io_conn_t *c)
+{
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    //the next update tries again
+    if (sqe == NULL) {
+        io_touch(io, c);
+        return;
+    }
+    sqe->fd = IO_CONN_FD(io, c);
+    if (c->listening) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = URING_DATA(c->id, URING_OP_ACCEPT, 0);
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = IO_URING_BGID;
+        sqe->user_data = URING_DATA(c->id, URING_OP_RECV, 0);
+    }
+    c->armed = 1;
+}
+
+static void uring_cancel(rdts_io_t *io, io_uring_t *u, io_conn_t *c)
+{
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    if (sqe == NULL) {
+        io_touch(io, c);
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_DATA(c->id, c->listening ? URING_OP_ACCEPT : URING_OP_RECV, 0);
+    sqe->user_data = URING_DATA(0, URING_OP_CANCEL, 0);
+    c->canceling = 1;
+}
+
+static void uring_write(rdts_io_t *io, io_uring_t *u, io_conn_t *c, int chunk)
+{
+    uring_chunk_t *k = &u->chunks[chunk];
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    //the chunk stays with 'c', its bytes are no longer in c->out
+    c->sending = chunk;
+    if (sqe == NULL) {
+        k->unsent = 1;
+        io_touch(io, c);
+        return;
+    }
+    k->unsent = 0;
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = IO_CONN_FD(io, c);
+    sqe->addr = (uint64_t)(uintptr_t)(u->chunk_mem + (size_t)chunk * IO_URING_CHUNK_SIZE + k->off);
+    sqe->len = k->len - k->off;
+    sqe->buf_index = 0;
+    sqe->user_data = URING_DATA(c->id, URING_OP_WRITE, chunk);
+}
+
+//the next part of the output into a free chunk
+static void uring_send(rdts_io_t *io, io_uring_t *u, io_conn_t *c)
+{
+    uring_chunk_t *k;
+    uint32_t len;
+    int chunk;
+
+    if (c->sending >= 0) {
+        if (u->chunks[c->sending].unsent) {
+            uring_write(io, u, c, c->sending);
+        }
+        return;
+    }
+    if (c->out.data_size == 0) {
+        return;
+    }
+    chunk = u->chunk_free;
+    if (chunk < 0) {
+        //all in flight, a completion frees one
+        io_touch(io, c);
+        return;
+    }
+    k = &u->chunks[chunk];
+    u->chunk_free = k->next;
+    k->id = c->id;
+    k->off = 0;
+    //never ask for more than is buffered
+    len = c->out.data_size < IO_URING_CHUNK_SIZE ? c->out.data_size : IO_URING_CHUNK_SIZE;
+    k->len = mbuf_deq(&c->out, u->chunk_mem + (size_t)chunk * IO_URING_CHUNK_SIZE, len);
+    uring_write(io, u, c, chunk);
+}
+
+static void on_recv(rdts_io_t *io, io_uring_t *u, int id, struct io_uring_cqe *cqe)
+{
+    io_conn_t *c = io_conn_get(io, id);
+    int res = cqe->res;
+    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    int has_buf = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+
+    if (c) {
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            c->armed = 0;
+            c->canceling = 0;
+        }
+        if (res > 0 && has_buf) {
+            io_input(io, c, u->bufs + (size_t)bid * IO_URING_BUF_SIZE, (uint32_t)res);
+        } else if (res == 0) {
+            io_fail(io, c, 0);
+        } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+            io_fail(io, c, -res);
+        }
+        //ran out of buffers: they are all back by the time the sqe goes in
+        if (!c->armed && !c->dead && !c->paused) {
+            uring_arm(io, u, c);
+        }
+    }
+    if (has_buf) {
+        buf_put(u, bid);
+    }
+}
+
+static void on_accept(rdts_io_t *io, io_uring_t *u, int id, struct io_uring_cqe *cqe)
+{
+    io_conn_t *c;
+
+    if (cqe->res >= 0) {
+        if (io_conn_get(io, id)) {
+            io_accepted(io, cqe->res);
+        } else {
+            close(cqe->res);
+        }
+    }
+    //io_accepted() may move the table
+    c = io_conn_get(io, id);
+    if (c && !(cqe->flags & IORING_CQE_F_MORE)) {
+        c->armed = 0;
+        c->canceling = 0;
+        if (!c->dead) {
+            uring_arm(io, u, c);
+        }
+    }
+}
+
+static void on_write(rdts_io_t *io, io_uring_t *u, int id, int chunk, int res)
+{
+    uring_chunk_t *k = &u->chunks[chunk];
+    io_conn_t *c = io_conn_get(io, id);
+
+    if (c && res > 0) {
+        k->off += (uint32_t)res;
+        if (k->off < k->len) {
+            uring_write(io, u, c, chunk);
+            return;
+        }
+    } else if (c) {
+        //the read side reports it
+        mbuf_drain(&c->out, c->out.data_size);
+    }
+
+    k->next = u->chunk_free;
+    u->chunk_free = chunk;
+    if (c) {
+        c->sending = -1;
+        uring_send(io, u, c);
+        if (c->closing && c->sending < 0) {
+            io_touch(io, c);
+        }
+    }
+}
+
+static void uring_complete(rdts_io_t *io, io_uring_t *u, struct io_uring_cqe *cqe)
+{
+    int id = (int)(uint32_t)(cqe->user_data >> 32);
+    int op = (int)((cqe->user_data >> 16) & 0xffff);
+    int chunk = (int)(cqe->user_data & 0xffff);
+
+    switch (op) {
+    case URING_OP_WAKE:
+        io_drain_wake(io);
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            u->wake_armed = 0;
+        }
+        break;
+    case URING_OP_RECV:
+        on_recv(io, u, id, cqe);
+        break;
+    case URING_OP_ACCEPT:
+        on_accept(io, u, id, cqe);
+        break;
+    case URING_OP_WRITE:
+        on_write(io, u, id, chunk, cqe->res);
+        break;
+    }
+}
+
+static void uring_reap(rdts_io_t *io, io_uring_t *u)
+{
+    unsigned head = *u->cq_head;
+    unsigned tail;
+
+    while ((tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) != head) {
+        while (head != tail) {
+            uring_complete(io, u, &u->cqes[head & u->cq_mask]);
+            head++;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    buf_publish(u);
+}
+
+static int uring_probe(int fd)
+{
+    static const int ops[] = {
+        IORING_OP_RECV, IORING_OP_ACCEPT, IORING_OP_WRITE_FIXED,
+        IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL,
+    };
+    struct io_uring_probe *probe;
+    size_t i;
+    int ok = 0;
+
+    probe = (struct io_uring_probe *)calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        return -1;
+    }
+    if (sys_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        ok = 1;
+        for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                ok = 0;
+            }
+        }
+    }
+    free(probe);
+    return ok ? 0 : -1;
+}
+
+static void uring_free(io_uring_t *u)
+{
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    if (u->ring) {
+        munmap(u->ring, u->ring_len);
+    }
+    if (u->sqes) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if (u->br) {
+        munmap(u->br, u->br_len);
+    }
+    if (u->chunk_mem) {
+        munmap(u->chunk_mem, (size_t)IO_URING_CHUNKS * IO_URING_CHUNK_SIZE);
+    }
+    free(u->bufs);
+    free(u);
+}
+
+static int uring_map(io_uring_t *u, struct io_uring_params *p)
+{
+    size_t sq_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    size_t cq_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    char *ring;
+    unsigned *array;
+    unsigned i;
+
+    u->ring_len = sq_len > cq_len ? sq_len : cq_len;
+    ring = (char *)mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        return -1;
+    }
+    u->ring = ring;
+    u->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        return -1;
+    }
+
+    u->sq_head = (unsigned *)(ring + p->sq_off.head);
+    u->sq_tail = (unsigned *)(ring + p->sq_off.tail);
+    u->sq_mask = *(unsigned *)(ring + p->sq_off.ring_mask);
+    u->sq_entries = p->sq_entries;
+    u->sq_local = *u->sq_tail;
+    //sqe i is always at slot i
+    array = (unsigned *)(ring + p->sq_off.array);
+    for (i = 0; i < p->sq_entries; i++) {
+        array[i] = i;
+    }
+
+    u->cq_head = (unsigned *)(ring + p->cq_off.head);
+    u->cq_tail = (unsigned *)(ring + p->cq_off.tail);
+    u->cq_mask = *(unsigned *)(ring + p->cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(ring + p->cq_off.cqes);
+    return 0;
+}
+
+static int uring_buffers(io_uring_t *u)
+{
+    struct io_uring_buf_reg reg;
+    struct iovec iov;
+    unsigned i;
+
+    u->br_len = IO_URING_BUFS * sizeof(struct io_uring_buf);
+    u->br = (struct io_uring_buf_ring *)mmap(NULL, u->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        return -1;
+    }
+    u->bufs = (char *)malloc((size_t)IO_URING_BUFS * IO_URING_BUF_SIZE);
+    if (u->bufs == NULL) {
+        return -1;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = IO_URING_BUFS;
+    reg.bgid = IO_URING_BGID;
+    if (sys_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return -1;
+    }
+    for (i = 0; i < IO_URING_BUFS; i++) {
+        buf_put(u, i);
+    }
+    buf_publish(u);
+
+    u->chunk_mem = (char *)mmap(NULL, (size_t)IO_URING_CHUNKS * IO_URING_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->chunk_mem == MAP_FAILED) {
+        u->chunk_mem = NULL;
+        return -1;
+    }
+    iov.iov_base = u->chunk_mem;
+    iov.iov_len = (size_t)IO_URING_CHUNKS * IO_URING_CHUNK_SIZE;
+    if (sys_uring_register(u->fd, IORING_REGISTER_BUFFERS, &iov, 1) != 0) {
+        return -1;
+    }
+    for (i = 0; i < IO_URING_CHUNKS; i++) {
+        u->chunks[i].next = (int)i + 1 < IO_URING_CHUNKS ? (int)i + 1 : -1;
+    }
+    u->chunk_free = 0;
+    return 0;
+}
+
+static int uring_init(rdts_io_t *io)
+{
+    io_uring_t *u = (io_uring_t *)calloc(1, sizeof(io_uring_t));
+    struct io_uring_params p;
+    int err;
+
+    if (u == NULL) {
+        return -1;
+    }
+    //completions run only when this thread waits: no task work interrupting it
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    p.cq_entries = IO_URING_ENTRIES * 4;
+    u->fd = sys_uring_setup(IO_URING_ENTRIES, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        //6.0 has no DEFER_TASKRUN yet
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+        p.cq_entries = IO_URING_ENTRIES * 4;
+        u->fd = sys_uring_setup(IO_URING_ENTRIES, &p);
+    }
+    if (u->fd < 0) {
+        goto fail;
+    }
+    if ((p.features & (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG))
+        != (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)) {
+        errno = ENOSYS;
+        goto fail;
+    }
+    if (uring_map(u, &p) != 0 || uring_probe(u->fd) != 0 || uring_buffers(u) != 0) {
+        goto fail;
+    }
+
+    io->bd = u;
+    uring_arm_wake(io, u);
+    return 0;
+
+fail:
+    err = errno;
+    uring_free(u);
+    errno = err;
+    return -1;
+}
+
+static void uring_release(rdts_io_t *io)
+{
+    //closing the ring cancels what is still in flight
+    uring_free((io_uring_t *)io->bd);
+}
+
+static int uring_add(rdts_io_t *io, io_conn_t *c)
+{
+    uring_arm(io, (io_uring_t *)io->bd, c);
+    return c->armed ? 0 : -1;
+}
+
+//a multishot op holds the socket open, it is canceled rather than left to close()
+static void uring_remove(rdts_io_t *io, io_conn_t *c)
+{
+    io_uring_t *u = (io_uring_t *)io->bd;
+
+    if (c->armed && !c->canceling) {
+        uring_cancel(io, u, c);
+    }
+    //a chunk in flight comes back with its completion, an unsent one never would
+    if (c->sending >= 0 && u->chunks[c->sending].unsent) {
+        u->chunks[c->sending].unsent = 0;
+        u->chunks[c->sending].next = u->chunk_free;
+        u->chunk_free = c->sending;
+        c->sending = -1;
+    }
+}
+
+static void uring_update(rdts_io_t *io, io_conn_t *c)
+{
+    io_uring_t *u = (io_uring_t *)io->bd;
+
+    if (c->paused || c->dead) {
+        if (c->armed && !c->canceling) {
+            uring_cancel(io, u, c);
+        }
+    } else if (!c->armed) {
+        uring_arm(io, u, c);
+    }
+    uring_send(io, u, c);
+}
+
+static void uring_wait(rdts_io_t *io, int timeout_ms)
+{
+    io_uring_t *u = (io_uring_t *)io->bd;
+
+    if (!u->wake_armed) {
+        uring_arm_wake(io, u);
+    }
+    uring_enter(u, timeout_ms != 0 ? 1 : 0, timeout_ms);
+    uring_reap(io, u);
+}
+
+static int uring_busy(rdts_io_t *io, io_conn_t *c)
+{
+    return c->sending >= 0;
+}
+
+const io_backend_t io_backend_uring = {
+    "uring",
+    uring_init,
+    uring_release,
+    uring_add,
+    uring_remove,
+    uring_update,
+    uring_wait,
+    uring_busy,
+};
+
+#else
+
+#include <errno.h>
+
+#ifdef RDTS_TEST
+int io_uring_sqe_fail;
+#endif
+
+static int uring_init(rdts_io_t *io)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+const io_backend_t io_backend_uring = {"uring", uring_init};
+
+#endif
@@ -1,6 +1,8 @@
 //rdt session manager
 
 #include "rdts_manager.h"
+#include "rdts_table.h"
+#include "rdts_shm.h"
 
 #include "lua.h"
 #include "lualib.h"
@@ -8,28 +10,88 @@
 
 #include <string.h>
 #include <stdlib.h>
-#define MAXSOCKET 16384
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//initial session table size, it grows on demand
+#define SESSION_TABLE_HINT 1024
+//disabled sessions are released after this long without a reconnect
+#define SESSION_GRACE_DEFAULT (300 * 1000)
+#define SESSION_TIMER_RESOLUTION 100
+//delayed acks and buffer shrinks of enabled sessions, driven by update_sessions()
+#define SESSION_UPDATE_RESOLUTION 10
+//buffers of enabled sessions shrink after holding little data this long, see rdts_set_shrink()
+#define SESSION_SHRINK_IDLE (10 * 1000)
+
+//session dump file: this header, then one rdts_serialize() image per session,
+//each starting on an 8 byte boundary
+#define DUMP_MAGIC 0x4d544452 //"RDTM"
+#define DUMP_VERSION 1
+#define DUMP_ALIGN(n) (((uint64_t)(n) + 7) & ~(uint64_t)7)
+
+typedef struct dump_header_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t len;   //whole file
+} dump_header_t;
 
 lua_State *gL;
 
 struct rdt_manager_s
 {
-    rdt_session_t *ctx[MAXSOCKET];
+    rdts_table_t *sessions;
+
+    //sessions with output to send or input to read, oldest first
+    rdt_session_t *ready_head;
+    rdt_session_t *ready_tail;
+    int ready_count;
+
+    //expiry of disabled sessions, driven by rdt_manager_tick()
+    rdts_wheel_t *wheel;
+    uint64_t now_ms;
+    uint32_t grace_ms;
+
+    //enabled sessions whose rdts_update() has work later, driven by update_sessions()
+    rdts_wheel_t *update_wheel;
+    uint64_t update_ms;
+
+    //buffer bytes of all sessions, each session counter hangs under it
+    mbuf_acct_t mem;
+    uint64_t mem_budget;
+    uint64_t mem_evicted;
+    uint64_t mem_refused;
+    //disabled sessions, oldest first: the eviction order
+    rdt_session_t *disabled_head;
+    rdt_session_t *disabled_tail;
+    uint32_t disabled_count;
+
+    //sessions handed over between processes, adopted by SESSION_FIND_ADOPT lookups. NULL if none
+    rdts_shm_t *store;
+
+    //scratch sids of the poll calls, grown on demand
+    int *sid_buf;
+    int sid_cap;
 };
 
-static rdt_session_t *find_by_id(rdt_manager_t *mng, int id)
-{
-    if (id == 0) {
-        return NULL;
-    }
+static rdt_session_t *adopt_stored(rdt_manager_t *mng, int sid);
+static void session_on_update(rdts_timer_t *timer, void *ud);
 
-    int slot = id % MAXSOCKET;
-    rdt_session_t *rdts = mng->ctx[slot];
-    if (rdts && rdts->sid == id) {
-        return rdts;
+//'adopt': a local miss takes the session from the store, which locks it across processes
+static rdt_session_t *find_by_id(rdt_manager_t *mng, int id, int adopt)
+{
+    rdt_session_t *rdts = rdts_table_find(mng->sessions, id);
+    if (rdts == NULL && adopt && mng->store) {
+        rdts = adopt_stored(mng, id);
     }
 
-    return NULL;
+    return rdts;
 }
 
 static void session_on_ack(uint64_t offset, void *session)
@@ -46,15 +108,87 @@ static void session_on_ack(uint64_t offset, void *session)
     }
 }
 
-rdt_session_t *find_session(rdt_manager_t *mng, int sid, int enable)
+static void session_on_watermark(int event, uint32_t unacked, void *session)
+{
+    rdt_session_t *rdts = (rdt_session_t *)session;
+
+    //optional: OnSessionWatermark(sid, event), event 1 = stop sending, 0 = resume
+    lua_getglobal(gL, "OnSessionWatermark");
+    if (!lua_isfunction(gL, -1)) {
+        lua_pop(gL, 1);
+        return;
+    }
+    lua_pushinteger(gL, rdts->sid);
+    lua_pushinteger(gL, event);
+    lua_pcall(gL, 2, 0, 0);
+}
+
+static void expire_session(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    int sid = rdts->sid;
+
+    delete_session(mng, sid);
+
+    //optional: OnSessionExpired(sid), the session is already released
+    lua_getglobal(gL, "OnSessionExpired");
+    if (!lua_isfunction(gL, -1)) {
+        lua_pop(gL, 1);
+        return;
+    }
+    lua_pushinteger(gL, sid);
+    lua_pcall(gL, 1, 0, 0);
+}
+
+static void session_on_expire(rdts_timer_t *timer, void *ud)
+{
+    rdt_session_t *rdts = (rdt_session_t *)((char *)timer - offsetof(rdt_session_t, expire_timer));
+    expire_session((rdt_manager_t *)ud, rdts);
+}
+
+static void disabled_unlink(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    if (rdts->disabled_prev == NULL && mng->disabled_head != rdts) {
+        return;
+    }
+
+    if (rdts->disabled_prev) {
+        rdts->disabled_prev->disabled_next = rdts->disabled_next;
+    } else {
+        mng->disabled_head = rdts->disabled_next;
+    }
+    if (rdts->disabled_next) {
+        rdts->disabled_next->disabled_prev = rdts->disabled_prev;
+    } else {
+        mng->disabled_tail = rdts->disabled_prev;
+    }
+    rdts->disabled_prev = rdts->disabled_next = NULL;
+    mng->disabled_count--;
+}
+
+static void disabled_append(rdt_manager_t *mng, rdt_session_t *rdts)
 {
-    rdt_session_t *rdts = find_by_id(mng, sid);
+    rdts->disabled_prev = mng->disabled_tail;
+    rdts->disabled_next = NULL;
+    if (mng->disabled_tail) {
+        mng->disabled_tail->disabled_next = rdts;
+    } else {
+        mng->disabled_head = rdts;
+    }
+    mng->disabled_tail = rdts;
+    mng->disabled_count++;
+}
+
+rdt_session_t *find_session(rdt_manager_t *mng, int sid, int flags)
+{
+    rdt_session_t *rdts = find_by_id(mng, sid, flags & SESSION_FIND_ADOPT);
     if (rdts == NULL) {
-        printf("session not found: %d\n", sid);
+        if (!(flags & SESSION_FIND_QUIET)) {
+            printf("session not found: %d\n", sid);
+        }
         return NULL;
     }
 
-    if (enable && !rdts_check_enable(rdts)) {
+    if ((flags & SESSION_FIND_ENABLED) && !rdts_check_enable(rdts)) {
         printf("session disable: %d\n", sid);
         return NULL;
     }
@@ -64,15 +198,51 @@ rdt_session_t *find_session(rdt_manager_t *mng, int sid, int enable)
 
 rdt_manager_t *rdt_manager_create()
 {
-    int i;
     rdt_manager_t *mng = (rdt_manager_t *)malloc(sizeof(*mng));
-    for (i = 0; i < MAXSOCKET; i++) {
-        mng->ctx[i] = NULL;
-    }
+    mng->sessions = rdts_table_create(SESSION_TABLE_HINT);
+    mng->ready_head = NULL;
+    mng->ready_tail = NULL;
+    mng->ready_count = 0;
+    mng->wheel = rdts_wheel_create(0, SESSION_TIMER_RESOLUTION);
+    mng->now_ms = 0;
+    mng->grace_ms = SESSION_GRACE_DEFAULT;
+    mng->update_wheel = rdts_wheel_create(0, SESSION_UPDATE_RESOLUTION);
+    mng->update_ms = 0;
+    mng->mem.parent = NULL;
+    mng->mem.bytes = 0;
+    mng->mem_budget = 0;
+    mng->mem_evicted = 0;
+    mng->mem_refused = 0;
+    mng->disabled_head = NULL;
+    mng->disabled_tail = NULL;
+    mng->disabled_count = 0;
+    mng->store = NULL;
+    mng->sid_buf = NULL;
+    mng->sid_cap = 0;
 
     return mng;
 }
 
+//put a new session under the manager, it is released on failure
+static rdt_session_t *adopt_session(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    if (rdts == NULL) {
+        return NULL;
+    }
+
+    if (rdts_table_insert(mng->sessions, rdts) != 0) {
+        printf("session insert failed: %d\n", rdts->sid);
+        rdts_release(rdts);
+        return NULL;
+    }
+    rdts_set_mem_parent(rdts, &mng->mem);
+    rdts_set_shrink(rdts, SESSION_SHRINK_IDLE);
+    rdts_timer_init(&rdts->update_timer, session_on_update, mng);
+    rdts_set_onwatermark(rdts, rdts->max_raw_snd_buf_size / 4, rdts->max_raw_snd_buf_size / 4 * 3, session_on_watermark, (void *)rdts);
+
+    return rdts;
+}
+
 rdt_session_t *create_session(rdt_manager_t *mng, int sid)
 {
     rdt_session_t *rdts = find_session(mng, sid, 0);
@@ -80,19 +250,23 @@ rdt_session_t *create_session(rdt_manager_t *mng, int sid)
         delete_session(mng, sid);
     }
 
-    rdts = rdts_create(sid, NULL);
-    int slot = sid % MAXSOCKET;
-    mng->ctx[slot] = rdts;
+    if (reserve_memory(mng, 0) != 0) {
+        printf("session refused, over memory budget: %d\n", sid);
+        return NULL;
+    }
 
-    return rdts;
+    return adopt_session(mng, rdts_create(sid, NULL));
 }
 
 int delete_session(rdt_manager_t *mng, int sid)
 {
     rdt_session_t *rdts = find_session(mng, sid, 0);
     if (rdts) {
-        int slot = sid % MAXSOCKET;
-        mng->ctx[slot] = NULL;
+        set_session_ready(mng, rdts, 0);
+        rdts_wheel_del(mng->wheel, &rdts->expire_timer);
+        rdts_wheel_del(mng->update_wheel, &rdts->update_timer);
+        disabled_unlink(mng, rdts);
+        rdts_table_remove(mng->sessions, sid);
         rdts_release(rdts);
 
         return 0;
@@ -103,13 +277,22 @@ int delete_session(rdt_manager_t *mng, int sid)
 
 int disable_session(rdt_manager_t *mng, int sid)
 {
-    rdt_session_t *rdts = find_session(mng, sid, 1);
-    if (rdts) {
-        rdts_set_enable(rdts, RDTS_DISABLE);
+    rdt_session_t *rdts = find_session(mng, sid, 0);
+    if (rdts == NULL) {
+        return -1;
+    }
 
-        return 0;
+    //already disabled: keep the running grace period
+    if (rdts_check_enable(rdts)) {
+        rdts_set_enable(rdts, RDTS_DISABLE);
+        set_session_ready(mng, rdts, 0);
+        rdts_wheel_del(mng->update_wheel, &rdts->update_timer);
+        rdts_timer_init(&rdts->expire_timer, session_on_expire, mng);
+        rdts_wheel_add(mng->wheel, &rdts->expire_timer, mng->now_ms + mng->grace_ms);
+        disabled_append(mng, rdts);
     }
-    return -1;
+
+    return 0;
 }
 
 int ack_session(rdt_manager_t *mng, int sid)
@@ -125,18 +308,22 @@ int ack_session(rdt_manager_t *mng, int sid)
 
 int reconnect_session(rdt_manager_t *mng, int sid)
 {
-    rdt_session_t *rdts = find_by_id(mng, sid);
+    rdt_session_t *rdts = find_by_id(mng, sid, 1);
     if (rdts == NULL) {
         printf("no such session: %d\n", sid);
 
         return -1;
     }
 
+    rdts_wheel_del(mng->wheel, &rdts->expire_timer);
+    disabled_unlink(mng, rdts);
     rdts_set_enable(rdts, RDTS_ENABLE);
     rdts_set_needack(rdts, RDTS_ACK);
     rdts_drain_snd_buf(rdts, rdts_get_snd_buf_length(rdts));
     rdts_send_ack(rdts);
     rdts_set_onack(rdts, session_on_ack, (void *)rdts);
+    set_session_ready(mng, rdts, 1);
+    schedule_session(mng, rdts);
 
     return 0;
 }
@@ -146,6 +333,421 @@ void on_session_reconnect(rdt_session_t *session)
 
 }
 
+void update_session(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    rdts_update(rdts, mng->update_ms);
+}
+
+void schedule_session(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    uint64_t due = rdts_check_enable(rdts) ? rdts_next_update(rdts) : 0;
+    if (due == 0) {
+        rdts_wheel_del(mng->update_wheel, &rdts->update_timer);
+    } else {
+        rdts_wheel_add(mng->update_wheel, &rdts->update_timer, due);
+    }
+}
+
+static void session_on_update(rdts_timer_t *timer, void *ud)
+{
+    rdt_manager_t *mng = (rdt_manager_t *)ud;
+    rdt_session_t *rdts = (rdt_session_t *)((char *)timer - offsetof(rdt_session_t, update_timer));
+
+    rdts_update(rdts, mng->update_ms);
+    if (rdts_has_output(rdts)) {
+        set_session_ready(mng, rdts, 1);
+    }
+    schedule_session(mng, rdts);
+}
+
+void update_sessions(rdt_manager_t *mng, uint64_t now_ms)
+{
+    mng->update_ms = now_ms;
+    rdts_wheel_tick(mng->update_wheel, now_ms);
+}
+
+void set_session_grace(rdt_manager_t *mng, uint32_t grace_ms)
+{
+    mng->grace_ms = grace_ms;
+}
+
+static int memory_fits(rdt_manager_t *mng, uint32_t extra)
+{
+    return mng->mem_budget == 0 || mng->mem.bytes + extra <= mng->mem_budget;
+}
+
+//release disabled sessions holding buffers, oldest first, until 'extra' more bytes fit
+static void evict_disabled(rdt_manager_t *mng, uint32_t extra)
+{
+    rdt_session_t *rdts = mng->disabled_head;
+
+    while (rdts && !memory_fits(mng, extra)) {
+        int next_sid = rdts->disabled_next ? rdts->disabled_next->sid : 0;
+        if (rdts_get_mem(rdts) == 0) {
+            rdts = rdts->disabled_next;
+            continue;
+        }
+
+        mng->mem_evicted++;
+        expire_session(mng, rdts);
+
+        //OnSessionExpired may have changed the list, pick the next one up by id
+        rdts = find_by_id(mng, next_sid, 0);
+        if (rdts == NULL || rdts_check_enable(rdts)) {
+            rdts = mng->disabled_head;
+        }
+    }
+}
+
+void rdt_manager_tick(rdt_manager_t *mng, uint64_t now_ms)
+{
+    mng->now_ms = now_ms;
+    rdts_wheel_tick(mng->wheel, now_ms);
+
+    //received data can't be refused, so that is where it gets trimmed
+    evict_disabled(mng, 0);
+}
+
+void set_memory_budget(rdt_manager_t *mng, uint64_t budget)
+{
+    mng->mem_budget = budget;
+    evict_disabled(mng, 0);
+}
+
+void get_memory_stat(rdt_manager_t *mng, rdt_mem_stat_t *stat)
+{
+    stat->bytes = mng->mem.bytes;
+    stat->budget = mng->mem_budget;
+    stat->sessions = rdts_table_count(mng->sessions);
+    stat->disabled = mng->disabled_count;
+    stat->evicted = mng->mem_evicted;
+    stat->refused = mng->mem_refused;
+}
+
+static void compact_one(rdt_session_t *rdts, void *ud)
+{
+    *(uint64_t *)ud += rdts_shrink(rdts);
+}
+
+uint64_t compact_all(rdt_manager_t *mng)
+{
+    uint64_t released = 0;
+    rdts_table_foreach(mng->sessions, compact_one, &released);
+    return released;
+}
+
+int reserve_memory(rdt_manager_t *mng, uint32_t extra)
+{
+    evict_disabled(mng, extra);
+    if (!memory_fits(mng, extra)) {
+        mng->mem_refused++;
+        return -1;
+    }
+
+    return 0;
+}
+
+typedef struct dump_ctx_s {
+    char *p;
+    char *end;
+    uint64_t len;
+    uint32_t count;
+} dump_ctx_t;
+
+static void dump_size(rdt_session_t *rdts, void *ud)
+{
+    ((dump_ctx_t *)ud)->len += DUMP_ALIGN(rdts_serialize_size(rdts));
+}
+
+static void dump_one(rdt_session_t *rdts, void *ud)
+{
+    dump_ctx_t *ctx = (dump_ctx_t *)ud;
+    int n = rdts_serialize(rdts, ctx->p, (uint32_t)(ctx->end - ctx->p));
+    if (n > 0) {
+        ctx->p += DUMP_ALIGN(n);
+        ctx->count++;
+    }
+}
+
+int dump_sessions(rdt_manager_t *mng, const char *path)
+{
+    char tmp[PATH_MAX];
+    dump_header_t hdr;
+    dump_ctx_t ctx;
+    char *base;
+    int fd;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.len = sizeof(hdr);
+    rdts_table_foreach(mng->sessions, dump_size, &ctx);
+
+    //written in place through a shared mapping, then renamed over 'path'
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)ctx.len) < 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    base = (char *)mmap(NULL, ctx.len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    ctx.p = base + sizeof(hdr);
+    ctx.end = base + ctx.len;
+    rdts_table_foreach(mng->sessions, dump_one, &ctx);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DUMP_MAGIC;
+    hdr.version = DUMP_VERSION;
+    hdr.count = ctx.count;
+    hdr.len = ctx.len;
+    memcpy(base, &hdr, sizeof(hdr));
+
+    munmap(base, ctx.len);
+    if (fsync(fd) < 0 || close(fd) < 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    return (int)ctx.count;
+}
+
+int load_sessions(rdt_manager_t *mng, const char *path)
+{
+    dump_header_t hdr;
+    struct stat st;
+    const char *base, *p, *end;
+    uint32_t i, used;
+    int n = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(hdr)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    base = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    memcpy(&hdr, base, sizeof(hdr));
+    if (hdr.magic != DUMP_MAGIC || hdr.version != DUMP_VERSION || hdr.len != (uint64_t)st.st_size) {
+        munmap((void *)base, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    p = base + sizeof(hdr);
+    end = base + hdr.len;
+    for (i = 0; i < hdr.count && p < end; i++) {
+        rdt_session_t *rdts = rdts_deserialize(p, (uint32_t)(end - p), &used, NULL);
+        if (rdts == NULL) {
+            printf("session dump corrupt: %s, %u of %u loaded\n", path, i, hdr.count);
+            break;
+        }
+        p += DUMP_ALIGN(used);
+
+        if (find_by_id(mng, rdts->sid, 0)) {
+            delete_session(mng, rdts->sid);
+        }
+        if (adopt_session(mng, rdts) == NULL) {
+            continue;
+        }
+
+        //no connection yet: wait for the reconnect, or expire after the grace period
+        rdts->enable = RDTS_ENABLE;
+        disable_session(mng, rdts->sid);
+        n++;
+    }
+    munmap((void *)base, st.st_size);
+
+    return n;
+}
+
+//a session from the store comes in disabled, like one from a dump
+static rdt_session_t *adopt_stored(rdt_manager_t *mng, int sid)
+{
+    rdt_session_t *rdts = rdts_shm_take(mng->store, sid, NULL);
+    if (adopt_session(mng, rdts) == NULL) {
+        return NULL;
+    }
+
+    rdts->enable = RDTS_ENABLE;
+    disable_session(mng, sid);
+
+    return rdts;
+}
+
+typedef struct collect_ctx_s {
+    int *sids;
+    int count;
+} collect_ctx_t;
+
+static void collect_sid(rdt_session_t *rdts, void *ud)
+{
+    collect_ctx_t *ctx = (collect_ctx_t *)ud;
+    ctx->sids[ctx->count++] = rdts->sid;
+}
+
+int handover_sessions(rdt_manager_t *mng, const char *name, uint32_t max_sessions, uint64_t size)
+{
+    collect_ctx_t ctx = {NULL, 0};
+    int i, n = 0;
+
+    if (mng->store == NULL) {
+        mng->store = rdts_shm_create(name, max_sessions, size);
+        if (mng->store == NULL) {
+            return -1;
+        }
+    }
+
+    //collect the ids first, the table can't change under rdts_table_foreach()
+    ctx.sids = (int *)malloc(sizeof(int) * (rdts_table_count(mng->sessions) + 1));
+    if (ctx.sids == NULL) {
+        return -1;
+    }
+    rdts_table_foreach(mng->sessions, collect_sid, &ctx);
+
+    //a session that does not fit stays here
+    for (i = 0; i < ctx.count; i++) {
+        rdt_session_t *rdts = rdts_table_find(mng->sessions, ctx.sids[i]);
+        if (rdts && rdts_shm_put(mng->store, rdts) == 0) {
+            delete_session(mng, ctx.sids[i]);
+            n++;
+        }
+    }
+    free(ctx.sids);
+
+    return n;
+}
+
+int attach_session_store(rdt_manager_t *mng, const char *name)
+{
+    rdts_shm_t *shm = rdts_shm_open(name);
+    if (shm == NULL) {
+        return -1;
+    }
+
+    detach_session_store(mng, NULL);
+    mng->store = shm;
+
+    return 0;
+}
+
+void detach_session_store(rdt_manager_t *mng, const char *unlink_name)
+{
+    if (mng->store) {
+        rdts_shm_close(mng->store);
+        mng->store = NULL;
+    }
+    if (unlink_name) {
+        rdts_shm_unlink(unlink_name);
+    }
+}
+
+static void ready_unlink(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    if (rdts->ready_prev) {
+        rdts->ready_prev->ready_next = rdts->ready_next;
+    } else {
+        mng->ready_head = rdts->ready_next;
+    }
+    if (rdts->ready_next) {
+        rdts->ready_next->ready_prev = rdts->ready_prev;
+    } else {
+        mng->ready_tail = rdts->ready_prev;
+    }
+    rdts->ready_prev = rdts->ready_next = NULL;
+}
+
+static void ready_append(rdt_manager_t *mng, rdt_session_t *rdts)
+{
+    rdts->ready_prev = mng->ready_tail;
+    rdts->ready_next = NULL;
+    if (mng->ready_tail) {
+        mng->ready_tail->ready_next = rdts;
+    } else {
+        mng->ready_head = rdts;
+    }
+    mng->ready_tail = rdts;
+}
+
+void set_session_ready(rdt_manager_t *mng, rdt_session_t *rdts, int ready)
+{
+    ready = ready ? 1 : 0;
+    if (rdts->ready == ready) {
+        return;
+    }
+
+    if (ready) {
+        ready_append(mng, rdts);
+        mng->ready_count++;
+    } else {
+        ready_unlink(mng, rdts);
+        mng->ready_count--;
+    }
+    rdts->ready = ready;
+}
+
+int *session_sid_buffer(rdt_manager_t *mng, int n)
+{
+    if (n > mng->sid_cap) {
+        int *buf = (int *)realloc(mng->sid_buf, sizeof(int) * n);
+        if (buf == NULL) {
+            return NULL;
+        }
+        mng->sid_buf = buf;
+        mng->sid_cap = n;
+    }
+
+    return mng->sid_buf;
+}
+
+int poll_ready_sessions(rdt_manager_t *mng, int *sids, int max)
+{
+    int n = 0, i;
+    rdt_session_t *rdts = mng->ready_head, *next;
+    rdt_session_t *last = mng->ready_tail;
+
+    while (rdts && n < max) {
+        next = rdts->ready_next;
+        if (!rdts_check_enable(rdts)) {
+            set_session_ready(mng, rdts, 0);
+        } else {
+            sids[n++] = rdts->sid;
+        }
+        if (rdts == last) {
+            break;
+        }
+        rdts = next;
+    }
+
+    //returned sessions go to the back, so a small 'max' still reaches everyone
+    for (i = 0; i < n && mng->ready_head && mng->ready_head != mng->ready_tail; i++) {
+        rdts = mng->ready_head;
+        ready_unlink(mng, rdts);
+        ready_append(mng, rdts);
+    }
+
+    return n;
+}
+
 
 
 // rdt_session_t * SessionManager::GetSession(int sid)
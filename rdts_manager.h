@@ -8,7 +8,12 @@ struct rdt_manager_s;
 typedef struct rdt_manager_s rdt_manager_t;
 
 rdt_manager_t *rdt_manager_create();
-rdt_session_t *find_session(rdt_manager_t *mng, int sid, int enable);
+//find_session() flags
+#define SESSION_FIND_ENABLED 1  //NULL if the session is disabled
+#define SESSION_FIND_ADOPT 2    //a local miss adopts the session from the attached store
+#define SESSION_FIND_QUIET 4    //no log line on a miss
+
+rdt_session_t *find_session(rdt_manager_t *mng, int sid, int flags);
 rdt_session_t *get_disable_session(rdt_manager_t *mng, int sid);
 
 rdt_session_t *create_session(rdt_manager_t *mng, int sid);
@@ -17,6 +22,72 @@ int disable_session(rdt_manager_t *mng, int sid);
 int ack_session(rdt_manager_t *mng, int sid);
 int reconnect_session(rdt_manager_t *mng, int sid);
 void on_session_reconnect(rdt_session_t *session);
+//drive the session timers (delayed ack, buffer shrink): only sessions that have one due
+//are visited, O(due) plus one step per elapsed 10ms
+void update_sessions(rdt_manager_t *mng, uint64_t now_ms);
+//bring the session clock to the last update_sessions(), call it before input to 'rdts'
+void update_session(rdt_manager_t *mng, rdt_session_t *rdts);
+//after input or output on 'rdts': put it on the wheel if rdts_update() has work for it later
+void schedule_session(rdt_manager_t *mng, rdt_session_t *rdts);
+
+//disabled sessions are deleted once disabled for 'grace_ms' (default 5 minutes),
+//then the lua global OnSessionExpired(sid) is called if defined
+void set_session_grace(rdt_manager_t *mng, uint32_t grace_ms);
+//advance the manager clock and expire sessions, O(expired) plus one step per elapsed 100ms.
+//grace periods start from the last tick, so call it from startup on
+void rdt_manager_tick(rdt_manager_t *mng, uint64_t now_ms);
+
+//buffer memory of all sessions. blocks are allocated on first use, so an idle session costs
+//next to nothing. once over the budget, disabled sessions are evicted oldest first
+//(expired early, OnSessionExpired is called) and new sessions and sends are refused
+typedef struct rdt_mem_stat_s {
+    uint64_t bytes;      //allocated by all session buffers
+    uint64_t budget;     //0 = unlimited
+    uint32_t sessions;
+    uint32_t disabled;
+    uint64_t evicted;    //disabled sessions released to stay under budget
+    uint64_t refused;    //creates and sends turned down
+} rdt_mem_stat_t;
+
+void set_memory_budget(rdt_manager_t *mng, uint64_t budget);
+void get_memory_stat(rdt_manager_t *mng, rdt_mem_stat_t *stat);
+//make room for 'extra' more bytes, evicting disabled sessions if needed.
+//returns -1 (and counts a refusal) if it still does not fit
+int reserve_memory(rdt_manager_t *mng, uint32_t extra);
+//shrink the buffers of every session, disabled ones included, so memory follows the live
+//data rather than the peak. enabled sessions also do it by themselves after 10s of little
+//data. O(sessions), returns the bytes released
+uint64_t compact_all(rdt_manager_t *mng);
+
+//write every session into 'path' (through 'path'.tmp and a rename), the file is read back
+//with mmap by load_sessions(). returns the session count, -1 with errno set on failure
+int dump_sessions(rdt_manager_t *mng, const char *path);
+//restore the sessions of a dump as disabled: clients resume them with the usual reconnect,
+//the rest expire after the grace period. a live session with the same id is replaced.
+//the dump is only readable by the same build. returns the count, -1 with errno set on failure
+int load_sessions(rdt_manager_t *mng, const char *path);
+
+//rolling deploy: the old process moves its sessions into the shared memory store 'name'
+//(see rdts_shm.h), the new one attaches it. both keep the store attached, so a reconnect
+//or receive (SESSION_FIND_ADOPT) that misses locally adopts the session from the store,
+//disabled and waiting for the reconnect; other lookups stay local. handover creates the
+//store for 'max_sessions' and 'size' bytes of session data unless one is attached already.
+//returns the count moved, -1 with errno set on failure
+int handover_sessions(rdt_manager_t *mng, const char *name, uint32_t max_sessions, uint64_t size);
+//returns -1 with errno set if there is no such store
+int attach_session_store(rdt_manager_t *mng, const char *name);
+//stop looking into the store, and remove it if 'unlink_name' is not NULL
+void detach_session_store(rdt_manager_t *mng, const char *unlink_name);
+
+//ready list: the bindings mark a session ready when it has frames to send or
+//complete messages to read, and not ready once polled empty
+void set_session_ready(rdt_manager_t *mng, rdt_session_t *rdts, int ready);
+//copy up to 'max' ready session ids into 'sids', returns the count.
+//costs O(ready sessions), disabled sessions are dropped from the list
+int poll_ready_sessions(rdt_manager_t *mng, int *sids, int max);
+//room for 'n' sids owned by the manager, so polling makes no garbage. it is shared by all
+//callers and valid until the next call, NULL if it can't grow
+int *session_sid_buffer(rdt_manager_t *mng, int n);
 
 // class SessionManager {
 
@@ -0,0 +1,320 @@
+//sharded session group. every shard thread owns a session table and a mailbox; the mailbox
+//is a lock-free stack that posting threads push onto with a compare-and-swap, and the
+//owner takes whole with one exchange and reverses into posting order. the mutex and
+//condition are only used to sleep when the mailbox is empty.
+
+#include "rdts_shard.h"
+#include "rdts_table.h"
+#include "mbuf.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SHARD_TABLE_HINT 1024
+#define SHARD_CACHELINE 64
+
+struct rdts_shard_s
+{
+    //written by posting threads, on a line of its own
+    rdts_shard_msg_t *inbox __attribute__((aligned(SHARD_CACHELINE)));
+    int sleeping;
+
+    //the owner thread's
+    rdts_table_t *sessions __attribute__((aligned(SHARD_CACHELINE)));
+    rdts_group_t *group;
+    int index;
+    uint64_t now_ms;
+    uint64_t next_tick;
+
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct rdts_group_s
+{
+    rdts_shard_t *shards;
+    int count;
+    int started;
+    uint32_t tick_ms;
+    void *ud;
+};
+
+static uint64_t clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//the session tables index by the low hash bits, so shards are picked by the high ones
+static uint32_t hash_sid(int sid)
+{
+    uint32_t h = (uint32_t)sid * 0x9e3779b1u;
+    return h ^ (h >> 16);
+}
+
+int rdts_group_shard_of(rdts_group_t *group, int sid)
+{
+    return (int)(((uint64_t)hash_sid(sid) * (uint32_t)group->count) >> 32);
+}
+
+int rdts_group_count(rdts_group_t *group)
+{
+    return group->count;
+}
+
+void rdts_group_post(rdts_group_t *group, rdts_shard_msg_t *msg)
+{
+    rdts_shard_t *shard = &group->shards[rdts_group_shard_of(group, msg->sid)];
+    rdts_shard_msg_t *head = __atomic_load_n(&shard->inbox, __ATOMIC_RELAXED);
+
+    do {
+        msg->next = head;
+    } while (!__atomic_compare_exchange_n(&shard->inbox, &head, msg, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    //pairs with the store in shard_wait(): either it sees the message or we see it asleep
+    if (__atomic_load_n(&shard->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&shard->lock);
+        pthread_cond_signal(&shard->cond);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+//run everything in the mailbox, oldest first. returns the count
+static int shard_drain(rdts_shard_t *shard)
+{
+    rdts_shard_msg_t *list = __atomic_exchange_n(&shard->inbox, NULL, __ATOMIC_ACQUIRE);
+    rdts_shard_msg_t *fifo = NULL, *msg;
+    int n = 0;
+
+    while (list) {
+        msg = list;
+        list = msg->next;
+        msg->next = fifo;
+        fifo = msg;
+    }
+
+    //the callback owns the message, step past it first
+    while (fifo) {
+        msg = fifo;
+        fifo = msg->next;
+        msg->fn(shard, msg);
+        n++;
+    }
+
+    return n;
+}
+
+static void shard_wait(rdts_shard_t *shard)
+{
+    uint32_t tick_ms = shard->group->tick_ms;
+
+    pthread_mutex_lock(&shard->lock);
+    __atomic_store_n(&shard->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shard->inbox, __ATOMIC_SEQ_CST) == NULL && !__atomic_load_n(&shard->stop, __ATOMIC_ACQUIRE)) {
+        if (tick_ms > 0) {
+            struct timespec ts;
+            ts.tv_sec = shard->next_tick / 1000;
+            ts.tv_nsec = (shard->next_tick % 1000) * 1000000;
+            pthread_cond_timedwait(&shard->cond, &shard->lock, &ts);
+        } else {
+            pthread_cond_wait(&shard->cond, &shard->lock);
+        }
+    }
+    __atomic_store_n(&shard->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static void update_one(rdt_session_t *rdts, void *ud)
+{
+    rdts_update(rdts, ((rdts_shard_t *)ud)->now_ms);
+}
+
+static void release_one(rdt_session_t *rdts, void *ud)
+{
+    rdts_release(rdts);
+}
+
+static void *shard_main(void *arg)
+{
+    rdts_shard_t *shard = (rdts_shard_t *)arg;
+    uint32_t tick_ms = shard->group->tick_ms;
+
+    shard->now_ms = clock_ms();
+    shard->next_tick = shard->now_ms + tick_ms;
+
+    while (1) {
+        int n;
+        shard->now_ms = clock_ms();
+        n = shard_drain(shard);
+
+        if (tick_ms > 0 && shard->now_ms >= shard->next_tick) {
+            rdts_table_foreach(shard->sessions, update_one, shard);
+            shard->next_tick = shard->now_ms + tick_ms;
+        }
+        if (n > 0) {
+            continue;
+        }
+        if (__atomic_load_n(&shard->stop, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&shard->inbox, __ATOMIC_ACQUIRE) == NULL) {
+                break;
+            }
+            continue;
+        }
+        shard_wait(shard);
+    }
+
+    rdts_table_foreach(shard->sessions, release_one, NULL);
+    rdts_table_release(shard->sessions);
+    shard->sessions = NULL;
+    //the buffer pool is per thread, hand its blocks back before the thread is gone
+    mbuf_pool_clear();
+
+    return NULL;
+}
+
+static int shard_init(rdts_group_t *group, rdts_shard_t *shard, int index)
+{
+    pthread_condattr_t attr;
+
+    memset(shard, 0, sizeof(*shard));
+    shard->group = group;
+    shard->index = index;
+    shard->sessions = rdts_table_create(SHARD_TABLE_HINT);
+    if (shard->sessions == NULL) {
+        return -1;
+    }
+
+    //timed waits run on the same clock as the ticks
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&shard->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&shard->lock, NULL);
+
+    if (pthread_create(&shard->thread, NULL, shard_main, shard) != 0) {
+        pthread_cond_destroy(&shard->cond);
+        pthread_mutex_destroy(&shard->lock);
+        rdts_table_release(shard->sessions);
+        return -1;
+    }
+
+    return 0;
+}
+
+rdts_group_t *rdts_group_create(int count, uint32_t tick_ms, void *ud)
+{
+    rdts_group_t *group;
+    void *shards;
+
+    if (count <= 0) {
+        return NULL;
+    }
+    group = (rdts_group_t *)malloc(sizeof(*group));
+    if (group == NULL) {
+        return NULL;
+    }
+    if (posix_memalign(&shards, SHARD_CACHELINE, count * sizeof(rdts_shard_t)) != 0) {
+        free(group);
+        return NULL;
+    }
+
+    group->shards = (rdts_shard_t *)shards;
+    group->count = count;
+    group->tick_ms = tick_ms;
+    group->ud = ud;
+    for (group->started = 0; group->started < count; group->started++) {
+        if (shard_init(group, &group->shards[group->started], group->started) != 0) {
+            rdts_group_release(group);
+            return NULL;
+        }
+    }
+
+    return group;
+}
+
+void rdts_group_release(rdts_group_t *group)
+{
+    int i;
+
+    for (i = 0; i < group->started; i++) {
+        rdts_shard_t *shard = &group->shards[i];
+        __atomic_store_n(&shard->stop, 1, __ATOMIC_RELEASE);
+        pthread_mutex_lock(&shard->lock);
+        pthread_cond_signal(&shard->cond);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    for (i = 0; i < group->started; i++) {
+        rdts_shard_t *shard = &group->shards[i];
+        pthread_join(shard->thread, NULL);
+        pthread_cond_destroy(&shard->cond);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    free(group->shards);
+    free(group);
+}
+
+rdt_session_t *rdts_shard_create_session(rdts_shard_t *shard, int sid)
+{
+    rdt_session_t *rdts;
+
+    if (rdts_group_shard_of(shard->group, sid) != shard->index) {
+        return NULL;
+    }
+    rdts_shard_delete_session(shard, sid);
+
+    rdts = rdts_create(sid, NULL);
+    if (rdts && rdts_table_insert(shard->sessions, rdts) != 0) {
+        rdts_release(rdts);
+        return NULL;
+    }
+
+    return rdts;
+}
+
+rdt_session_t *rdts_shard_find(rdts_shard_t *shard, int sid)
+{
+    return rdts_table_find(shard->sessions, sid);
+}
+
+int rdts_shard_delete_session(rdts_shard_t *shard, int sid)
+{
+    rdt_session_t *rdts = rdts_table_remove(shard->sessions, sid);
+    if (rdts == NULL) {
+        return -1;
+    }
+
+    rdts_release(rdts);
+    return 0;
+}
+
+uint32_t rdts_shard_count(rdts_shard_t *shard)
+{
+    return rdts_table_count(shard->sessions);
+}
+
+int rdts_shard_index(rdts_shard_t *shard)
+{
+    return shard->index;
+}
+
+uint64_t rdts_shard_now(rdts_shard_t *shard)
+{
+    return shard->now_ms;
+}
+
+rdts_group_t *rdts_shard_get_group(rdts_shard_t *shard)
+{
+    return shard->group;
+}
+
+void *rdts_shard_get_ud(rdts_shard_t *shard)
+{
+    return shard->group->ud;
+}
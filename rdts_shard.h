@@ -0,0 +1,57 @@
+//sharded session group: sessions are spread over worker threads by sid
+#ifndef __RDTS_SHARD_H__
+#define __RDTS_SHARD_H__
+
+#include "rdt_session.h"
+
+struct rdts_group_s;
+typedef struct rdts_group_s rdts_group_t;
+struct rdts_shard_s;
+typedef struct rdts_shard_s rdts_shard_t;
+
+//each shard is one thread that owns the sessions whose sid maps to it and is the only one
+//to touch them, so nothing on the session path takes a lock. everything else reaches a
+//session by posting a message to its shard, e.g. a reconnect that arrived on another
+//thread's connection. mailboxes are lock-free: a post is one compare-and-swap, plus a
+//wakeup only when the shard sleeps.
+//the lua manager (rdts_manager.h) stays single threaded, lua states can't be shared
+
+typedef struct rdts_shard_msg_s rdts_shard_msg_t;
+//runs on the shard thread that owns 'msg->sid', and owns 'msg' from then on
+typedef void (*rdts_shard_fn)(rdts_shard_t *shard, rdts_shard_msg_t *msg);
+
+//embed it in the message, set 'sid' and 'fn' before posting
+struct rdts_shard_msg_s {
+    struct rdts_shard_msg_s *next; //mailbox link
+    int sid;
+    rdts_shard_fn fn;
+};
+
+//start 'count' shards. every 'tick_ms' each shard calls rdts_update() on its sessions,
+//0 only wakes shards for messages. 'ud' is returned by rdts_shard_get_ud()
+rdts_group_t *rdts_group_create(int count, uint32_t tick_ms, void *ud);
+//run the messages posted so far, stop the threads and release all sessions.
+//nothing may be posted once it is called
+void rdts_group_release(rdts_group_t *group);
+
+//shard index of 'sid', fixed for the life of the group
+int rdts_group_shard_of(rdts_group_t *group, int sid);
+int rdts_group_count(rdts_group_t *group);
+//queue 'msg' for the shard owning msg->sid, safe from any thread, shard threads included.
+//messages from one thread to one shard run in the order they were posted
+void rdts_group_post(rdts_group_t *group, rdts_shard_msg_t *msg);
+
+//the calls below are for the shard's own thread only, i.e. from message callbacks
+
+//create a session for 'sid', replacing an older one. NULL if 'sid' belongs to another shard
+rdt_session_t *rdts_shard_create_session(rdts_shard_t *shard, int sid);
+rdt_session_t *rdts_shard_find(rdts_shard_t *shard, int sid);
+int rdts_shard_delete_session(rdts_shard_t *shard, int sid);
+uint32_t rdts_shard_count(rdts_shard_t *shard);
+int rdts_shard_index(rdts_shard_t *shard);
+//the shard clock in milliseconds, as last passed to rdts_update()
+uint64_t rdts_shard_now(rdts_shard_t *shard);
+rdts_group_t *rdts_shard_get_group(rdts_shard_t *shard);
+void *rdts_shard_get_ud(rdts_shard_t *shard);
+
+#endif //__RDTS_SHARD_H__
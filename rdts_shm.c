@@ -0,0 +1,403 @@
+//shared memory session store. the segment is a header, an open addressing index of
+//sid -> image offset, and an image area: images (rdts_serialize()) are appended with a
+//small record header, taken or replaced ones are marked dead and compacted away when
+//the area runs full. a robust process shared mutex in the header serializes all
+//processes, one that dies holding it leaves the store to be checked by the next.
+
+#include "rdts_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC 0x53534452 //"RDSS"
+#define SHM_VERSION 2
+#define SHM_MIN_SLOTS 64
+#define SHM_ALIGN(n) (((uint64_t)(n) + 7) & ~(uint64_t)7)
+
+//sid values of free index slots, real sids are > 0
+#define SID_EMPTY 0
+#define SID_DELETED -1
+
+typedef struct shm_header_s {
+    uint32_t magic;
+    uint32_t version;
+    pthread_mutex_t lock;
+    uint32_t count;     //live images
+    uint32_t slot_mask;
+    uint32_t slot_used; //live + deleted index slots
+    uint64_t size;      //whole segment
+    uint64_t data_off;  //image area, from the segment start
+    uint64_t data_size;
+    uint64_t data_used;
+} shm_header_t;
+
+typedef struct shm_slot_s {
+    int32_t sid;
+    uint32_t reserved;
+    uint64_t off;       //record offset in the image area
+} shm_slot_t;
+
+//in front of every image, sid is SID_EMPTY once the image is dead
+typedef struct shm_record_s {
+    int32_t sid;
+    uint32_t len;
+} shm_record_t;
+
+struct rdts_shm_s
+{
+    shm_header_t *hdr;
+    shm_slot_t *slots;
+    char *data;
+};
+
+static uint32_t hash_sid(int sid)
+{
+    uint32_t h = (uint32_t)sid * 0x9e3779b1u;
+    return h ^ (h >> 16);
+}
+
+static shm_slot_t *slot_find(rdts_shm_t *shm, int sid)
+{
+    uint32_t mask = shm->hdr->slot_mask;
+    uint32_t i = hash_sid(sid) & mask, n;
+
+    for (n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        shm_slot_t *s = &shm->slots[i];
+        if (s->sid == sid) {
+            return s;
+        }
+        if (s->sid == SID_EMPTY) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+//'sid' must not be in the index, which always has a free slot
+static void slot_put(rdts_shm_t *shm, int sid, uint64_t off)
+{
+    uint32_t mask = shm->hdr->slot_mask;
+    uint32_t i = hash_sid(sid) & mask;
+
+    while (shm->slots[i].sid > 0) {
+        i = (i + 1) & mask;
+    }
+
+    if (shm->slots[i].sid == SID_EMPTY) {
+        shm->hdr->slot_used++;
+    }
+    shm->slots[i].sid = sid;
+    shm->slots[i].off = off;
+}
+
+static void image_drop(rdts_shm_t *shm, shm_slot_t *slot)
+{
+    shm_record_t *rec = (shm_record_t *)(shm->data + slot->off);
+    rec->sid = SID_EMPTY;
+    slot->sid = SID_DELETED;
+    shm->hdr->count--;
+}
+
+//move live images together and rebuild the index without tombstones
+static void shm_compact(rdts_shm_t *shm)
+{
+    shm_header_t *hdr = shm->hdr;
+    uint64_t rd = 0, wr = 0;
+
+    memset(shm->slots, 0, (size_t)(hdr->slot_mask + 1) * sizeof(shm_slot_t));
+    hdr->slot_used = 0;
+
+    while (rd < hdr->data_used) {
+        shm_record_t *rec = (shm_record_t *)(shm->data + rd);
+        uint64_t len = SHM_ALIGN(sizeof(*rec) + rec->len);
+        if (rec->sid > 0) {
+            if (wr != rd) {
+                memmove(shm->data + wr, rec, len);
+            }
+            slot_put(shm, ((shm_record_t *)(shm->data + wr))->sid, wr);
+            wr += len;
+        }
+        rd += len;
+    }
+    hdr->data_used = wr;
+}
+
+//after a crash: drop a torn tail, rebuild the index and the count from the records.
+//a put that died after writing keeps the newer of two records for a sid
+static void shm_recover(rdts_shm_t *shm)
+{
+    shm_header_t *hdr = shm->hdr;
+    uint64_t rd = 0;
+
+    memset(shm->slots, 0, (size_t)(hdr->slot_mask + 1) * sizeof(shm_slot_t));
+    hdr->slot_used = 0;
+    hdr->count = 0;
+
+    while (rd + sizeof(shm_record_t) <= hdr->data_used) {
+        shm_record_t *rec = (shm_record_t *)(shm->data + rd);
+        uint64_t len = SHM_ALIGN(sizeof(*rec) + rec->len);
+        shm_slot_t *slot;
+        if (len > hdr->data_used - rd) {
+            break;
+        }
+        if (rec->sid > 0) {
+            slot = slot_find(shm, rec->sid);
+            if (slot) {
+                ((shm_record_t *)(shm->data + slot->off))->sid = SID_EMPTY;
+                slot->off = rd;
+            } else if ((hdr->count + 1) * 2 <= hdr->slot_mask + 1) {
+                slot_put(shm, rec->sid, rd);
+                hdr->count++;
+            } else {
+                rec->sid = SID_EMPTY;
+            }
+        }
+        rd += len;
+    }
+    hdr->data_used = rd;
+    shm_compact(shm);
+}
+
+static int shm_mutex_init(pthread_mutex_t *lock)
+{
+    pthread_mutexattr_t attr;
+    int err = pthread_mutexattr_init(&attr);
+
+    if (err == 0) {
+        err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        if (err == 0) {
+            err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        }
+        if (err == 0) {
+            err = pthread_mutex_init(lock, &attr);
+        }
+        pthread_mutexattr_destroy(&attr);
+    }
+    errno = err;
+    return err ? -1 : 0;
+}
+
+static void shm_lock(rdts_shm_t *shm)
+{
+    if (pthread_mutex_lock(&shm->hdr->lock) == EOWNERDEAD) {
+        shm_recover(shm);
+        pthread_mutex_consistent(&shm->hdr->lock);
+    }
+}
+
+static void shm_unlock(rdts_shm_t *shm)
+{
+    pthread_mutex_unlock(&shm->hdr->lock);
+}
+
+static rdts_shm_t *shm_map(int fd, uint64_t size)
+{
+    rdts_shm_t *shm;
+    char *base = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    shm = (rdts_shm_t *)malloc(sizeof(*shm));
+    if (shm == NULL) {
+        munmap(base, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    shm->hdr = (shm_header_t *)base;
+    shm->slots = (shm_slot_t *)(base + SHM_ALIGN(sizeof(shm_header_t)));
+
+    return shm;
+}
+
+rdts_shm_t *rdts_shm_create(const char *name, uint32_t max_sessions, uint64_t data_size)
+{
+    rdts_shm_t *shm;
+    shm_header_t *hdr;
+    uint32_t cap = SHM_MIN_SLOTS;
+    uint64_t index_size, size;
+    int fd;
+
+    //the index stays at most half full
+    while (cap < 0x80000000u && cap / 2 < max_sessions) {
+        cap *= 2;
+    }
+    index_size = (uint64_t)cap * sizeof(shm_slot_t);
+    data_size = SHM_ALIGN(data_size);
+    size = SHM_ALIGN(sizeof(shm_header_t)) + index_size + data_size;
+
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    shm = shm_map(fd, size);
+    close(fd);
+    if (shm == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    //the segment starts zeroed: empty index
+    hdr = shm->hdr;
+    if (shm_mutex_init(&hdr->lock) != 0) {
+        munmap(hdr, size);
+        free(shm);
+        shm_unlink(name);
+        return NULL;
+    }
+    hdr->version = SHM_VERSION;
+    hdr->slot_mask = cap - 1;
+    hdr->size = size;
+    hdr->data_off = SHM_ALIGN(sizeof(shm_header_t)) + index_size;
+    hdr->data_size = data_size;
+    shm->data = (char *)hdr + hdr->data_off;
+    //openers check the magic, so it goes last
+    __sync_synchronize();
+    hdr->magic = SHM_MAGIC;
+
+    return shm;
+}
+
+rdts_shm_t *rdts_shm_open(const char *name)
+{
+    rdts_shm_t *shm;
+    shm_header_t *hdr;
+    struct stat st;
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(shm_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    shm = shm_map(fd, st.st_size);
+    close(fd);
+    if (shm == NULL) {
+        return NULL;
+    }
+
+    hdr = shm->hdr;
+    if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION || hdr->size != (uint64_t)st.st_size) {
+        munmap(hdr, st.st_size);
+        free(shm);
+        errno = EINVAL;
+        return NULL;
+    }
+    shm->data = (char *)hdr + hdr->data_off;
+
+    return shm;
+}
+
+void rdts_shm_close(rdts_shm_t *shm)
+{
+    munmap(shm->hdr, shm->hdr->size);
+    free(shm);
+}
+
+int rdts_shm_unlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+#ifdef RDTS_TEST
+//the process dies in the next put, holding the lock
+int shm_put_die;
+#endif
+
+int rdts_shm_put(rdts_shm_t *shm, rdt_session_t *rdts)
+{
+    shm_header_t *hdr = shm->hdr;
+    shm_slot_t *slot;
+    shm_record_t *rec;
+    uint32_t len = rdts_serialize_size(rdts);
+    uint64_t need = SHM_ALIGN(sizeof(shm_record_t) + len);
+    int r = -1;
+
+    shm_lock(shm);
+    //a replaced image keeps its slot, the older copy stays until the new one is written
+    slot = slot_find(shm, rdts->sid);
+    if (slot == NULL && (hdr->count + 1) * 2 > hdr->slot_mask + 1) {
+        goto done;
+    }
+    if (hdr->data_used + need > hdr->data_size || (slot == NULL && (hdr->slot_used + 1) * 4 > (hdr->slot_mask + 1) * 3)) {
+        shm_compact(shm);
+        if (hdr->data_used + need > hdr->data_size) {
+            goto done;
+        }
+        slot = slot_find(shm, rdts->sid);
+    }
+
+    rec = (shm_record_t *)(shm->data + hdr->data_used);
+    rec->sid = rdts->sid;
+    rec->len = len;
+    rdts_serialize(rdts, (char *)(rec + 1), len);
+    hdr->data_used += need;
+#ifdef RDTS_TEST
+    if (shm_put_die) {
+        _exit(1);
+    }
+#endif
+    if (slot) {
+        ((shm_record_t *)(shm->data + slot->off))->sid = SID_EMPTY;
+        slot->off = (char *)rec - shm->data;
+    } else {
+        slot_put(shm, rdts->sid, (char *)rec - shm->data);
+        hdr->count++;
+    }
+    r = 0;
+
+done:
+    shm_unlock(shm);
+    return r;
+}
+
+rdt_session_t *rdts_shm_take(rdts_shm_t *shm, int sid, void *user)
+{
+    shm_header_t *hdr = shm->hdr;
+    rdt_session_t *rdts = NULL;
+    shm_slot_t *slot;
+    shm_record_t *rec;
+
+    if (sid <= 0) {
+        return NULL;
+    }
+
+    shm_lock(shm);
+    slot = slot_find(shm, sid);
+    if (slot) {
+        rec = (shm_record_t *)(shm->data + slot->off);
+        rdts = rdts_deserialize((const char *)(rec + 1), rec->len, NULL, user);
+        //out of memory: the image stays for the next try
+        if (rdts) {
+            image_drop(shm, slot);
+            //emptied: start over instead of compacting later
+            if (hdr->count == 0) {
+                shm_compact(shm);
+            }
+        }
+    }
+    shm_unlock(shm);
+
+    return rdts;
+}
+
+uint32_t rdts_shm_count(rdts_shm_t *shm)
+{
+    return shm->hdr->count;
+}
@@ -0,0 +1,31 @@
+//shared memory session store: session images in a named segment, indexed by sid
+#ifndef __RDTS_SHM_H__
+#define __RDTS_SHM_H__
+
+#include "rdt_session.h"
+
+struct rdts_shm_s;
+typedef struct rdts_shm_s rdts_shm_t;
+
+//the segment only holds offsets, so any process can map it at any address and take
+//sessions out of it without a file in between. 'name' is a shm_open() name, e.g. "/rdts".
+//all calls lock the segment, the store is safe to share between processes
+
+//create the segment 'name' for up to 'max_sessions' images of 'data_size' bytes in total,
+//an existing one of that name is replaced. NULL with errno set on failure
+rdts_shm_t *rdts_shm_create(const char *name, uint32_t max_sessions, uint64_t data_size);
+//map an existing segment, NULL with errno set if there is none or it is not a store
+rdts_shm_t *rdts_shm_open(const char *name);
+//unmap, the segment stays until rdts_shm_unlink()
+void rdts_shm_close(rdts_shm_t *shm);
+int rdts_shm_unlink(const char *name);
+
+//store a copy of the session under its sid, replacing an older copy. -1 if the store
+//is full, an older copy is then kept
+int rdts_shm_put(rdts_shm_t *shm, rdt_session_t *rdts);
+//rebuild the session stored under 'sid' and drop it from the store. NULL if there is none,
+//or if it could not be rebuilt, which leaves it stored
+rdt_session_t *rdts_shm_take(rdts_shm_t *shm, int sid, void *user);
+uint32_t rdts_shm_count(rdts_shm_t *shm);
+
+#endif //__RDTS_SHM_H__
@@ -0,0 +1,167 @@
+//spsc ring: head and tail are byte counters that only grow, the ring offset is counter & mask.
+//a record that would run past the end is put at the start, behind a pad record that the
+//consumer skips. each side keeps a copy of the other side's counter and reloads it only
+//when that copy says the ring is full (or empty), so the shared lines move rarely.
+
+#include "rdts_spsc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SPSC_CACHELINE 64
+#define SPSC_MIN_SIZE 4096
+#define SPSC_ALIGN(n) (((uint64_t)(n) + 15) & ~(uint64_t)15)
+//type of the record that fills the end of the ring before a wrap
+#define SPSC_PAD -1
+
+typedef struct spsc_record_s {
+    uint32_t len;
+    int32_t id;
+    int32_t type;
+    uint32_t reserved;
+} spsc_record_t;
+
+struct rdts_spsc_s
+{
+    //producer
+    uint64_t tail __attribute__((aligned(SPSC_CACHELINE)));
+    uint64_t head_cache;
+    uint64_t pad;       //pad bytes in front of the reservation
+
+    //consumer
+    uint64_t head __attribute__((aligned(SPSC_CACHELINE)));
+    uint64_t tail_cache;
+
+    char *buf __attribute__((aligned(SPSC_CACHELINE)));
+    uint32_t size;
+    uint32_t mask;
+};
+
+rdts_spsc_t *rdts_spsc_create(uint32_t size)
+{
+    rdts_spsc_t *ring;
+    void *p;
+    uint32_t cap = SPSC_MIN_SIZE;
+
+    while (cap < size && cap < 0x80000000u) {
+        cap *= 2;
+    }
+    if (posix_memalign(&p, SPSC_CACHELINE, sizeof(rdts_spsc_t)) != 0) {
+        return NULL;
+    }
+    ring = (rdts_spsc_t *)p;
+    memset(ring, 0, sizeof(*ring));
+    ring->buf = (char *)malloc(cap);
+    if (ring->buf == NULL) {
+        free(ring);
+        return NULL;
+    }
+    ring->size = cap;
+    ring->mask = cap - 1;
+
+    return ring;
+}
+
+void rdts_spsc_release(rdts_spsc_t *ring)
+{
+    free(ring->buf);
+    free(ring);
+}
+
+//half the ring: it then always fits once the ring drains, whatever the wrap costs
+uint32_t rdts_spsc_max(rdts_spsc_t *ring)
+{
+    return ring->size / 2 - sizeof(spsc_record_t);
+}
+
+char *rdts_spsc_reserve(rdts_spsc_t *ring, uint32_t len)
+{
+    uint64_t need, pos, to_end, total;
+
+    if (len > rdts_spsc_max(ring)) {
+        return NULL;
+    }
+
+    need = SPSC_ALIGN(sizeof(spsc_record_t) + len);
+    pos = ring->tail & ring->mask;
+    to_end = ring->size - pos;
+    ring->pad = need > to_end ? to_end : 0;
+    total = ring->pad + need;
+
+    if (ring->tail + total - ring->head_cache > ring->size) {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->tail + total - ring->head_cache > ring->size) {
+            return NULL;
+        }
+    }
+
+    if (ring->pad) {
+        spsc_record_t *rec = (spsc_record_t *)(ring->buf + pos);
+        rec->len = (uint32_t)(to_end - sizeof(spsc_record_t));
+        rec->type = SPSC_PAD;
+        pos = 0;
+    }
+
+    return ring->buf + pos + sizeof(spsc_record_t);
+}
+
+void rdts_spsc_commit(rdts_spsc_t *ring, int id, int type, uint32_t len)
+{
+    uint64_t pos = (ring->tail + ring->pad) & ring->mask;
+    spsc_record_t *rec = (spsc_record_t *)(ring->buf + pos);
+
+    rec->len = len;
+    rec->id = id;
+    rec->type = type;
+    __atomic_store_n(&ring->tail, ring->tail + ring->pad + SPSC_ALIGN(sizeof(*rec) + len), __ATOMIC_RELEASE);
+    ring->pad = 0;
+}
+
+int rdts_spsc_push(rdts_spsc_t *ring, int id, int type, const char *data, uint32_t len)
+{
+    char *p = rdts_spsc_reserve(ring, len);
+    if (p == NULL) {
+        return -1;
+    }
+
+    if (len > 0) {
+        memcpy(p, data, len);
+    }
+    rdts_spsc_commit(ring, id, type, len);
+    return 0;
+}
+
+const char *rdts_spsc_peek(rdts_spsc_t *ring, int *id, int *type, uint32_t *len)
+{
+    spsc_record_t *rec;
+
+    if (ring->head == ring->tail_cache) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->head == ring->tail_cache) {
+            return NULL;
+        }
+    }
+
+    rec = (spsc_record_t *)(ring->buf + (ring->head & ring->mask));
+    //a pad is always committed together with the record behind it
+    if (rec->type == SPSC_PAD) {
+        __atomic_store_n(&ring->head, ring->head + sizeof(*rec) + rec->len, __ATOMIC_RELEASE);
+        rec = (spsc_record_t *)ring->buf;
+    }
+
+    *id = rec->id;
+    *type = rec->type;
+    *len = rec->len;
+    return (const char *)(rec + 1);
+}
+
+void rdts_spsc_pop(rdts_spsc_t *ring)
+{
+    spsc_record_t *rec = (spsc_record_t *)(ring->buf + (ring->head & ring->mask));
+    __atomic_store_n(&ring->head, ring->head + SPSC_ALIGN(sizeof(*rec) + rec->len), __ATOMIC_RELEASE);
+}
+
+int rdts_spsc_empty(rdts_spsc_t *ring)
+{
+    return ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
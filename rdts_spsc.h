@@ -0,0 +1,33 @@
+//single producer single consumer ring of variable length records
+#ifndef __RDTS_SPSC_H__
+#define __RDTS_SPSC_H__
+
+#include <stdint.h>
+
+struct rdts_spsc_s;
+typedef struct rdts_spsc_s rdts_spsc_t;
+
+//one thread pushes and one other thread pops, neither takes a lock: each side only
+//writes its own index, and reads the other one again only when the ring looks full
+//(or empty). a record is contiguous, so it is written and read in place
+
+//'size' is rounded up to a power of two, a record takes its length plus 16 bytes
+rdts_spsc_t *rdts_spsc_create(uint32_t size);
+void rdts_spsc_release(rdts_spsc_t *ring);
+//the largest record 'ring' takes
+uint32_t rdts_spsc_max(rdts_spsc_t *ring);
+
+//producer: reserve 'len' bytes, fill them and commit. NULL if the ring is full for now
+char *rdts_spsc_reserve(rdts_spsc_t *ring, uint32_t len);
+//publish the last reservation, 'len' may be smaller than reserved
+void rdts_spsc_commit(rdts_spsc_t *ring, int id, int type, uint32_t len);
+//reserve, copy and commit, -1 if the ring is full for now
+int rdts_spsc_push(rdts_spsc_t *ring, int id, int type, const char *data, uint32_t len);
+
+//consumer: the oldest record, NULL if the ring is empty. it stays valid until rdts_spsc_pop()
+const char *rdts_spsc_peek(rdts_spsc_t *ring, int *id, int *type, uint32_t *len);
+void rdts_spsc_pop(rdts_spsc_t *ring);
+//consumer side too
+int rdts_spsc_empty(rdts_spsc_t *ring);
+
+#endif //__RDTS_SPSC_H__
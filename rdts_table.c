@@ -0,0 +1,244 @@
+//session table: open addressing hash keyed by sid, linear probing.
+//growing allocates the new array and moves REHASH_STEP old slots per insert/remove,
+//lookups check both arrays until the old one is empty.
+
+#include "rdts_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_MIN_CAP 64
+#define REHASH_STEP 64
+
+//sid values of free slots, real sids are > 0
+#define SID_EMPTY 0
+#define SID_DELETED -1
+
+typedef struct table_entry_s {
+    int sid;
+    rdt_session_t *rdts;
+} table_entry_t;
+
+typedef struct table_array_s {
+    table_entry_t *slots;
+    uint32_t mask;
+    uint32_t count; //live entries
+    uint32_t used;  //live entries + tombstones
+} table_array_t;
+
+struct rdts_table_s
+{
+    table_array_t cur;
+    table_array_t old; //slots != NULL while growing
+    uint32_t rehash_pos;
+};
+
+static uint32_t hash_sid(int sid)
+{
+    uint32_t h = (uint32_t)sid * 0x9e3779b1u;
+    return h ^ (h >> 16);
+}
+
+static int array_init(table_array_t *a, uint32_t cap)
+{
+    a->slots = (table_entry_t *)calloc(cap, sizeof(table_entry_t));
+    if (a->slots == NULL) {
+        return -1;
+    }
+    a->mask = cap - 1;
+    a->count = 0;
+    a->used = 0;
+
+    return 0;
+}
+
+static table_entry_t *array_find(table_array_t *a, int sid)
+{
+    uint32_t i = hash_sid(sid) & a->mask;
+    while (1) {
+        table_entry_t *e = &a->slots[i];
+        if (e->sid == sid) {
+            return e;
+        }
+        if (e->sid == SID_EMPTY) {
+            return NULL;
+        }
+        i = (i + 1) & a->mask;
+    }
+}
+
+//'sid' must not be in the array yet
+static void array_put(table_array_t *a, int sid, rdt_session_t *rdts)
+{
+    uint32_t i = hash_sid(sid) & a->mask;
+    while (a->slots[i].sid > 0) {
+        i = (i + 1) & a->mask;
+    }
+
+    if (a->slots[i].sid == SID_EMPTY) {
+        a->used++;
+    }
+    a->slots[i].sid = sid;
+    a->slots[i].rdts = rdts;
+    a->count++;
+}
+
+static void array_del(table_array_t *a, table_entry_t *e)
+{
+    e->sid = SID_DELETED;
+    e->rdts = NULL;
+    a->count--;
+}
+
+static void rehash_step(rdts_table_t *tab, uint32_t n)
+{
+    table_array_t *old = &tab->old;
+    if (old->slots == NULL) {
+        return;
+    }
+
+    while (n-- > 0 && tab->rehash_pos <= old->mask) {
+        table_entry_t *e = &old->slots[tab->rehash_pos++];
+        if (e->sid > 0) {
+            array_put(&tab->cur, e->sid, e->rdts);
+            array_del(old, e);
+        }
+    }
+
+    if (tab->rehash_pos > old->mask) {
+        free(old->slots);
+        old->slots = NULL;
+    }
+}
+
+//start moving to a bigger array, or a same sized one if it is mostly tombstones
+static int table_grow(rdts_table_t *tab)
+{
+    table_array_t next;
+    uint32_t cap = tab->cur.mask + 1;
+
+    //sized so the previous move is always done by now, finish it just in case
+    if (tab->old.slots) {
+        rehash_step(tab, UINT32_MAX);
+    }
+
+    if (tab->cur.count * 2 >= cap) {
+        cap *= 2;
+    }
+    if (array_init(&next, cap) != 0) {
+        return -1;
+    }
+
+    tab->old = tab->cur;
+    tab->cur = next;
+    tab->rehash_pos = 0;
+
+    return 0;
+}
+
+rdts_table_t *rdts_table_create(uint32_t cap)
+{
+    uint32_t n = TABLE_MIN_CAP;
+    rdts_table_t *tab = (rdts_table_t *)malloc(sizeof(*tab));
+    if (tab == NULL) {
+        return NULL;
+    }
+
+    //keep the load factor under 3/4
+    while (n < 0x80000000u && n / 4 * 3 < cap) {
+        n *= 2;
+    }
+    if (array_init(&tab->cur, n) != 0) {
+        free(tab);
+        return NULL;
+    }
+    memset(&tab->old, 0, sizeof(tab->old));
+    tab->rehash_pos = 0;
+
+    return tab;
+}
+
+void rdts_table_release(rdts_table_t *tab)
+{
+    free(tab->cur.slots);
+    free(tab->old.slots);
+    free(tab);
+}
+
+rdt_session_t *rdts_table_find(rdts_table_t *tab, int sid)
+{
+    table_entry_t *e;
+    if (sid <= 0) {
+        return NULL;
+    }
+
+    e = array_find(&tab->cur, sid);
+    if (e == NULL && tab->old.slots) {
+        e = array_find(&tab->old, sid);
+    }
+
+    return e ? e->rdts : NULL;
+}
+
+int rdts_table_insert(rdts_table_t *tab, rdt_session_t *rdts)
+{
+    if (rdts->sid <= 0 || rdts_table_find(tab, rdts->sid)) {
+        return -1;
+    }
+
+    if ((tab->cur.used + 1) * 4 > (tab->cur.mask + 1) * 3 && table_grow(tab) != 0) {
+        return -1;
+    }
+    array_put(&tab->cur, rdts->sid, rdts);
+    rehash_step(tab, REHASH_STEP);
+
+    return 0;
+}
+
+rdt_session_t *rdts_table_remove(rdts_table_t *tab, int sid)
+{
+    table_entry_t *e = NULL;
+    table_array_t *a = &tab->cur;
+    rdt_session_t *rdts = NULL;
+    if (sid <= 0) {
+        return NULL;
+    }
+
+    e = array_find(a, sid);
+    if (e == NULL && tab->old.slots) {
+        a = &tab->old;
+        e = array_find(a, sid);
+    }
+
+    if (e) {
+        rdts = e->rdts;
+        array_del(a, e);
+    }
+    rehash_step(tab, REHASH_STEP);
+
+    return rdts;
+}
+
+uint32_t rdts_table_count(rdts_table_t *tab)
+{
+    return tab->cur.count + (tab->old.slots ? tab->old.count : 0);
+}
+
+void rdts_table_foreach(rdts_table_t *tab, void (*fn)(rdt_session_t *rdts, void *ud), void *ud)
+{
+    uint32_t i;
+    for (i = 0; i <= tab->cur.mask; i++) {
+        if (tab->cur.slots[i].sid > 0) {
+            fn(tab->cur.slots[i].rdts, ud);
+        }
+    }
+
+    if (tab->old.slots) {
+        for (i = tab->rehash_pos; i <= tab->old.mask; i++) {
+            if (tab->old.slots[i].sid > 0) {
+                fn(tab->old.slots[i].rdts, ud);
+            }
+        }
+    }
+}
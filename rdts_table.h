@@ -0,0 +1,26 @@
+//session table: open addressing hash keyed by sid
+#ifndef __RDTS_TABLE_H__
+#define __RDTS_TABLE_H__
+
+#include "rdt_session.h"
+
+struct rdts_table_s;
+typedef struct rdts_table_s rdts_table_t;
+
+//'cap' is a size hint, the table grows on demand. growing is incremental:
+//entries move to the bigger array a few at a time on each later operation
+rdts_table_t *rdts_table_create(uint32_t cap);
+//release the table, not the sessions in it
+void rdts_table_release(rdts_table_t *tab);
+
+rdt_session_t *rdts_table_find(rdts_table_t *tab, int sid);
+//add a session under rdts->sid, returns -1 if the sid is taken or sid <= 0
+int rdts_table_insert(rdts_table_t *tab, rdt_session_t *rdts);
+//remove and return the session, NULL if not found
+rdt_session_t *rdts_table_remove(rdts_table_t *tab, int sid);
+
+uint32_t rdts_table_count(rdts_table_t *tab);
+//call 'fn' on every session, 'fn' must not insert or remove
+void rdts_table_foreach(rdts_table_t *tab, void (*fn)(rdt_session_t *rdts, void *ud), void *ud);
+
+#endif //__RDTS_TABLE_H__
@@ -0,0 +1,235 @@
+//hierarchical timer wheel: 256 one tick slots, then 3 levels of 64 slots each
+//covering 2^26 ticks. far timers cascade down a level when their slot comes up.
+
+#include "rdts_timer.h"
+
+#include <stdlib.h>
+
+#define WHEEL_NEAR_BITS 8
+#define WHEEL_NEAR (1 << WHEEL_NEAR_BITS)
+#define WHEEL_NEAR_MASK (WHEEL_NEAR - 1)
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVEL (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL - 1)
+#define WHEEL_LEVELS 3
+#define WHEEL_RANGE (1ULL << (WHEEL_NEAR_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS))
+
+struct rdts_wheel_s
+{
+    //list heads, slots are circular lists
+    rdts_timer_t near[WHEEL_NEAR];
+    rdts_timer_t far[WHEEL_LEVELS][WHEEL_LEVEL];
+    uint64_t tick;
+    uint32_t resolution_ms;
+    uint32_t count;
+};
+
+static void list_init(rdts_timer_t *head)
+{
+    head->prev = head->next = head;
+}
+
+static void list_append(rdts_timer_t *head, rdts_timer_t *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_unlink(rdts_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+void rdts_timer_init(rdts_timer_t *timer, rdts_timer_cb cb, void *ud)
+{
+    timer->prev = timer->next = NULL;
+    timer->expire = 0;
+    timer->cb = cb;
+    timer->ud = ud;
+}
+
+int rdts_timer_pending(rdts_timer_t *timer)
+{
+    return timer->next != NULL;
+}
+
+static void wheel_place(rdts_wheel_t *w, rdts_timer_t *t)
+{
+    uint64_t e = t->expire, cur = w->tick;
+    int i, shift = WHEEL_NEAR_BITS;
+
+    if ((e | WHEEL_NEAR_MASK) == (cur | WHEEL_NEAR_MASK)) {
+        list_append(&w->near[e & WHEEL_NEAR_MASK], t);
+        return;
+    }
+
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        uint64_t mask = (1ULL << (shift + WHEEL_LEVEL_BITS)) - 1;
+        if ((e | mask) == (cur | mask)) {
+            list_append(&w->far[i][(e >> shift) & WHEEL_LEVEL_MASK], t);
+            return;
+        }
+        shift += WHEEL_LEVEL_BITS;
+    }
+
+    //out of range: park it in the top slot that comes up last, it is placed again from there
+    shift -= WHEEL_LEVEL_BITS;
+    list_append(&w->far[WHEEL_LEVELS - 1][((cur >> shift) - 1) & WHEEL_LEVEL_MASK], t);
+}
+
+static void wheel_cascade(rdts_wheel_t *w, rdts_timer_t *head)
+{
+    rdts_timer_t list;
+    if (head->next == head) {
+        return;
+    }
+
+    //move the slot aside first, wheel_place() may put timers back into it
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    list_init(head);
+
+    while (list.next != &list) {
+        rdts_timer_t *t = list.next;
+        list_unlink(t);
+        wheel_place(w, t);
+    }
+}
+
+static void wheel_step(rdts_wheel_t *w)
+{
+    rdts_timer_t *head;
+    int i, shift = WHEEL_NEAR_BITS;
+
+    w->tick++;
+    if ((w->tick & WHEEL_NEAR_MASK) == 0) {
+        for (i = 0; i < WHEEL_LEVELS; i++) {
+            uint32_t idx = (w->tick >> shift) & WHEEL_LEVEL_MASK;
+            wheel_cascade(w, &w->far[i][idx]);
+            if (idx != 0) {
+                break;
+            }
+            shift += WHEEL_LEVEL_BITS;
+        }
+    }
+
+    //one at a time, a callback may delete the next timer
+    head = &w->near[w->tick & WHEEL_NEAR_MASK];
+    while (head->next != head) {
+        rdts_timer_t *t = head->next;
+        list_unlink(t);
+        w->count--;
+        t->cb(t, t->ud);
+    }
+}
+
+//jump to 'tick' at once: every timer is placed again, the overdue ones on the next tick
+static void wheel_rebase(rdts_wheel_t *w, uint64_t tick)
+{
+    rdts_timer_t list;
+    int i, j;
+
+    list_init(&list);
+    for (i = 0; i < WHEEL_NEAR; i++) {
+        while (w->near[i].next != &w->near[i]) {
+            rdts_timer_t *t = w->near[i].next;
+            list_unlink(t);
+            list_append(&list, t);
+        }
+    }
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_LEVEL; j++) {
+            while (w->far[i][j].next != &w->far[i][j]) {
+                rdts_timer_t *t = w->far[i][j].next;
+                list_unlink(t);
+                list_append(&list, t);
+            }
+        }
+    }
+
+    w->tick = tick;
+    while (list.next != &list) {
+        rdts_timer_t *t = list.next;
+        list_unlink(t);
+        if (t->expire <= tick) {
+            t->expire = tick + 1;
+        }
+        wheel_place(w, t);
+    }
+}
+
+rdts_wheel_t *rdts_wheel_create(uint64_t now_ms, uint32_t resolution_ms)
+{
+    int i, j;
+    rdts_wheel_t *w = (rdts_wheel_t *)malloc(sizeof(*w));
+    if (w == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < WHEEL_NEAR; i++) {
+        list_init(&w->near[i]);
+    }
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_LEVEL; j++) {
+            list_init(&w->far[i][j]);
+        }
+    }
+    w->resolution_ms = resolution_ms > 0 ? resolution_ms : 1;
+    w->tick = now_ms / w->resolution_ms;
+    w->count = 0;
+
+    return w;
+}
+
+void rdts_wheel_release(rdts_wheel_t *wheel)
+{
+    free(wheel);
+}
+
+void rdts_wheel_add(rdts_wheel_t *wheel, rdts_timer_t *timer, uint64_t expire_ms)
+{
+    uint64_t e = (expire_ms + wheel->resolution_ms - 1) / wheel->resolution_ms;
+
+    rdts_wheel_del(wheel, timer);
+    timer->expire = e > wheel->tick ? e : wheel->tick + 1;
+    wheel_place(wheel, timer);
+    wheel->count++;
+}
+
+void rdts_wheel_del(rdts_wheel_t *wheel, rdts_timer_t *timer)
+{
+    if (timer->next) {
+        list_unlink(timer);
+        wheel->count--;
+    }
+}
+
+void rdts_wheel_tick(rdts_wheel_t *wheel, uint64_t now_ms)
+{
+    uint64_t target = now_ms / wheel->resolution_ms;
+
+    //a gap longer than the wheel: stepping through it would take too long
+    if (target > wheel->tick + WHEEL_RANGE && wheel->count > 0) {
+        wheel_rebase(wheel, target - 1);
+    }
+
+    while (wheel->tick < target) {
+        //nothing pending, nothing to walk
+        if (wheel->count == 0) {
+            wheel->tick = target;
+            break;
+        }
+        wheel_step(wheel);
+    }
+}
+
+uint32_t rdts_wheel_count(rdts_wheel_t *wheel)
+{
+    return wheel->count;
+}
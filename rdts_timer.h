@@ -0,0 +1,39 @@
+//hierarchical timer wheel with intrusive timers
+#ifndef __RDTS_TIMER_H__
+#define __RDTS_TIMER_H__
+
+#include <stdint.h>
+
+struct rdts_timer_s;
+typedef void (*rdts_timer_cb)(struct rdts_timer_s *timer, void *ud);
+
+//embed it in the owning object, rdts_timer_init() it once before use
+typedef struct rdts_timer_s {
+    struct rdts_timer_s *prev;
+    struct rdts_timer_s *next;
+    uint64_t expire; //in wheel ticks
+    rdts_timer_cb cb;
+    void *ud;
+} rdts_timer_t;
+
+struct rdts_wheel_s;
+typedef struct rdts_wheel_s rdts_wheel_t;
+
+void rdts_timer_init(rdts_timer_t *timer, rdts_timer_cb cb, void *ud);
+int rdts_timer_pending(rdts_timer_t *timer);
+
+//'resolution_ms' is the length of one tick
+rdts_wheel_t *rdts_wheel_create(uint64_t now_ms, uint32_t resolution_ms);
+//release the wheel, pending timers are just forgotten
+void rdts_wheel_release(rdts_wheel_t *wheel);
+
+//(re)arm 'timer' to fire at 'expire_ms', rounded up to a tick. O(1)
+void rdts_wheel_add(rdts_wheel_t *wheel, rdts_timer_t *timer, uint64_t expire_ms);
+//cancel a pending timer, does nothing if it is not pending. O(1)
+void rdts_wheel_del(rdts_wheel_t *wheel, rdts_timer_t *timer);
+//advance to 'now_ms' and fire the expired timers. callbacks may add or delete any timer
+void rdts_wheel_tick(rdts_wheel_t *wheel, uint64_t now_ms);
+
+uint32_t rdts_wheel_count(rdts_wheel_t *wheel);
+
+#endif //__RDTS_TIMER_H__
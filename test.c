@@ -1,10 +1,26 @@
 
 #include "rdt_session.h"
 #include "mbuf.h"
+#include "rdts_table.h"
+#include "rdts_timer.h"
+#include "rdts_shm.h"
+#include "rdts_shard.h"
+#include "rdts_spsc.h"
+#include "rdts_io.h"
+#include "rdts_io_impl.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 static int g_count = 0;
 
@@ -28,7 +44,8 @@ static int dump(const char *str, size_t sz, const char *buffer)
 
 static void sendto_peer(rdt_session_t *rdts, int n)
 {
-	uint8_t *buf = (uint8_t *)malloc(n * 4);
+	//odd batches go through rdts_send, even ones are encoded in place
+	uint8_t *buf = (n / 10) % 2 ? (uint8_t *)malloc(n * 4) : (uint8_t *)rdts_send_reserve(rdts, n * 4);
 	int i;
 	int *p = (int *)buf;
 	for (i = 0; i < n; i++) {
@@ -36,24 +53,33 @@ static void sendto_peer(rdt_session_t *rdts, int n)
 		p++;
 	}
 
-	rdts_send(rdts, (const char *)buf, n * 4);
-	free(buf);
+	if ((n / 10) % 2) {
+		rdts_send(rdts, (const char *)buf, n * 4);
+		free(buf);
+	} else {
+		rdts_send_commit(rdts, n * 4);
+	}
 }
 
 static int dispatch_client(rdt_session_t *client, rdt_session_t *server)
 {
 	int n = 0;
 	mbuf_t *raw_rcv_buf = client->raw_rcv_buf;
-	mbuf_t *snd_buf = client->snd_buf;
 	if (raw_rcv_buf->data_size > 0) {
 		n++;
 		dump("server->client: ", raw_rcv_buf->data_size, mbuf_pullup(raw_rcv_buf));
 		mbuf_drain(raw_rcv_buf, raw_rcv_buf->data_size);
-	} else if (snd_buf->data_size) {
+	} else if (rdts_has_output(client)) {
+		//feed the server straight from the block chain
+		struct iovec iov[8];
+		int i, cnt = rdts_peek_snd_iov(client, iov, 8);
+		uint32_t total = 0;
 		n++;
-		const char *send_data = mbuf_pullup(snd_buf);
-		rdts_input(server, send_data, snd_buf->data_size);
-		mbuf_drain(snd_buf, snd_buf->data_size);
+		for (i = 0; i < cnt; i++) {
+			rdts_input(server, iov[i].iov_base, iov[i].iov_len);
+			total += iov[i].iov_len;
+		}
+		rdts_drain_snd_buf(client, total);
 	} else {
 
 	}
@@ -66,16 +92,16 @@ static int dispatch_server(rdt_session_t *client, rdt_session_t *server)
 	int cnt = -1;
 	int n = 0;
 	mbuf_t *raw_rcv_buf = server->raw_rcv_buf;
-	mbuf_t *snd_buf = server->snd_buf;
 	if (raw_rcv_buf->data_size > 0) {
 		n++;
 		cnt = dump("client->server: ", raw_rcv_buf->data_size, mbuf_pullup(raw_rcv_buf));
 		mbuf_drain(raw_rcv_buf, raw_rcv_buf->data_size);
-	} else if (snd_buf->data_size) {
+	} else if (rdts_has_output(server)) {
 		n++;
-		const char *send_data = mbuf_pullup(snd_buf);
-		rdts_input(client, send_data, snd_buf->data_size);
-		mbuf_drain(snd_buf, snd_buf->data_size);
+		const char *send_data = rdts_pullup_snd_buf(server);
+		uint32_t len = rdts_get_snd_buf_length(server);
+		rdts_input(client, send_data, len);
+		rdts_drain_snd_buf(server, len);
 	} else {
 
 	}
@@ -98,11 +124,11 @@ static void dispatch(rdt_session_t *client, rdt_session_t *server)
 
 static void rdts_reconnect(rdt_session_t *client, rdt_session_t *server)
 {
-    mbuf_reset(client->snd_buf, 10240);
+	rdts_drain_snd_buf(client, rdts_get_snd_buf_length(client));
 	rdts_send_ack(client);
 	rdts_push_raw(client);
 
-	mbuf_reset(server->snd_buf, 10240);
+	rdts_drain_snd_buf(server, rdts_get_snd_buf_length(server));
 	rdts_send_ack(server);
 	rdts_push_raw(server);
 }
@@ -123,27 +149,988 @@ static void test_rdt(rdt_session_t *client, rdt_session_t *server)
 	sendto_peer(client, 40);
 	dispatch(client, server);
 
+	//three messages, one frame
+	uint64_t frames = rdts_get_stat(client)->frames;
+	rdts_cork(client);
+	sendto_peer(client, 10);
+	sendto_peer(client, 20);
+	sendto_peer(client, 10);
+	rdts_uncork(client);
+	assert(rdts_get_stat(client)->frames == frames + 1);
+	assert(rdts_get_stat(client)->hdr_saved == 4);
+	dispatch(client, server);
+
+	//the server always has an ack pending when it echoes
+	assert(rdts_get_stat(server)->acks_piggybacked > 0);
+
 	rdts_dump(client);
 	rdts_dump(server);
 	assert(client->rcv_raw_offset == server->remote_rcv_raw_offset && client->remote_rcv_raw_offset == server->rcv_raw_offset);
 }
 
-int main()
+static void test_pool()
+{
+	mbuf_pool_stat_t st0, st1;
+	mbuf_t mbuf;
+	char out[32];
+	int i;
+
+	mbuf_pool_get_stat(&st0);
+	for (i = 0; i < 4; i++) {
+		mbuf_init(&mbuf, 10240);
+		mbuf_enq(&mbuf, NULL, 20000);
+		assert(mbuf.blk_count == 2);
+		mbuf_pullup(&mbuf);
+		mbuf_free(&mbuf);
+	}
+
+	//asking for more than is buffered must not skip what is written next
+	mbuf_init(&mbuf, 1024);
+	mbuf_enq(&mbuf, "0123456789", 10);
+	assert(mbuf_deq(&mbuf, out, sizeof(out)) == 10);
+	mbuf_enq(&mbuf, "abcde", 5);
+	assert(mbuf_deq(&mbuf, out, sizeof(out)) == 5 && memcmp(out, "abcde", 5) == 0);
+	mbuf_free(&mbuf);
+
+	mbuf_pool_get_stat(&st1);
+	assert(st1.hits > st0.hits);
+	assert(st1.cached_bytes <= st1.limit);
+
+	mbuf_pool_clear();
+	mbuf_pool_get_stat(&st1);
+	assert(st1.cached_blocks == 0 && st1.cached_bytes == 0);
+	printf("pool: hits=%lu,misses=%lu,releases=%lu,drops=%lu\n", st1.hits, st1.misses, st1.releases, st1.drops);
+}
+
+static void test_ring()
+{
+	mbuf_t mbuf;
+	char in[3000], out[3000];
+	int i, round;
+
+	for (i = 0; i < (int)sizeof(in); i++) {
+		in[i] = (char)i;
+	}
+
+	if (mbuf_init_ring(&mbuf, 4096) < 0) {
+		printf("ring: not supported, block mode\n");
+	}
+
+	//every round wraps around the end of the ring
+	for (round = 0; round < 8; round++) {
+		mbuf_enq(&mbuf, in, sizeof(in));
+		assert(memcmp(mbuf_pullup(&mbuf), in, sizeof(in)) == 0);
+		assert(mbuf_deq(&mbuf, out, sizeof(out)) == sizeof(out));
+		assert(memcmp(out, in, sizeof(in)) == 0);
+		mbuf_enq(&mbuf, in, 1000 + round);
+		mbuf_drain(&mbuf, 1000 + round);
+	}
+
+	//grow while holding data
+	mbuf_enq(&mbuf, in, 100);
+	mbuf_enq(&mbuf, in, sizeof(in));
+	mbuf_enq(&mbuf, in, sizeof(in));
+	assert(mbuf.data_size == 100 + 2 * sizeof(in));
+	assert(memcmp(mbuf_pullup(&mbuf) + 100 + sizeof(in), in, sizeof(in)) == 0);
+	mbuf_free(&mbuf);
+
+	//a ring that can't grow (no fd for the memfd here) goes on in blocks
+	if (mbuf_init_ring(&mbuf, 4096) == 0) {
+		struct rlimit rl;
+		mbuf_enq(&mbuf, in, 1000);
+		mbuf_drain(&mbuf, 1000);
+		mbuf_enq(&mbuf, in, sizeof(in));
+		getrlimit(RLIMIT_NOFILE, &rl);
+		rlim_t cur = rl.rlim_cur;
+		rl.rlim_cur = 0;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		mbuf_enq(&mbuf, in, sizeof(in));
+		rl.rlim_cur = cur;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		assert(mbuf.ring == NULL && mbuf.data_size == 2 * sizeof(in) && mbuf.alloc_size >= mbuf.data_size);
+		assert(memcmp(mbuf_pullup(&mbuf), in, sizeof(in)) == 0 && memcmp(mbuf_pullup(&mbuf) + sizeof(in), in, sizeof(in)) == 0);
+		mbuf_free(&mbuf);
+	}
+}
+
+//pullup first: it frames a pending ack, which the length then counts
+static void deliver(rdt_session_t *from, rdt_session_t *to)
+{
+	const char *p = rdts_pullup_snd_buf(from);
+	rdts_input(to, p, rdts_get_snd_buf_length(from));
+	rdts_drain_snd_buf(from, rdts_get_snd_buf_length(from));
+}
+
+static void test_ack_delay()
+{
+	rdt_session_t *client = rdts_create(1, NULL);
+	rdt_session_t *server = rdts_create(1, NULL);
+	rdts_init(server, 1024 * 10, 1024);
+	rdts_set_ack_delay(server, 50);
+
+	rdts_update(client, 1000);
+	rdts_update(server, 1000);
+	sendto_peer(client, 10);
+	deliver(client, server);
+
+	//below the byte limit, so only the timer can ack it
+	assert(rdts_next_update(server) == 1050 && rdts_next_update(client) == 0);
+	rdts_update(server, 1049);
+	assert(!rdts_has_output(server));
+	rdts_update(server, 1050);
+	//a length query does not frame the ack, nor does a pending one block a mode change
+	assert(rdts_has_output(server) && rdts_get_snd_buf_length(server) == 0);
+	assert(rdts_set_snd_mode(server, RDTS_SND_REF) == RDTS_SND_COPY && rdts_has_output(server));
+	rdts_flush_ack(server);
+	assert(rdts_get_snd_buf_length(server) > 0);
+	assert(rdts_get_stat(server)->acks_timer == 1 && rdts_get_stat(server)->ack_bytes == 40);
+	assert(rdts_next_update(server) == 0);
+
+	rdts_input(client, rdts_pullup_snd_buf(server), rdts_get_snd_buf_length(server));
+	assert(client->remote_rcv_raw_offset == 40 && client->raw_snd_buf->data_size == 0);
+
+	rdts_release(client);
+	rdts_release(server);
+}
+
+static void on_watermark(int event, uint32_t unacked, void *userdata)
+{
+	int *wm = (int *)userdata;
+	*wm = event;
+}
+
+static void test_window()
+{
+	char buf[64] = {0}, stale[32];
+	uint32_t stale_len;
+	int wm = -1;
+	rdt_session_t *client = rdts_create(1, NULL);
+	rdt_session_t *server = rdts_create(1, NULL);
+	rdts_init(client, 1024 * 10, 1024);
+	rdts_init(server, 1024 * 10, 1024);
+	rdts_set_rcv_window(server, 100);
+	rdts_set_onwatermark(client, 10, 50, on_watermark, &wm);
+
+	sendto_peer(client, 10);
+	deliver(client, server);
+	rdts_send_ack(server);
+	rdts_flush_ack(server);
+	stale_len = rdts_get_snd_buf_length(server);
+	assert(stale_len > 0 && stale_len <= sizeof(stale));
+	memcpy(stale, rdts_pullup_snd_buf(server), stale_len);
+	deliver(server, client);
+	//40 bytes unread of 100
+	assert(client->remote_wnd_limit == 100 && rdts_get_writable(client) == 60);
+
+	assert(rdts_send(client, buf, 60) == 0 && wm == RDTS_WM_HIGH);
+	assert(rdts_get_writable(client) == 0 && rdts_send(client, buf, 1) < 0);
+	deliver(client, server);
+	rdts_send_ack(server);
+	deliver(server, client);
+	//acked but still unread, the window stays closed
+	assert(client->raw_snd_buf->data_size == 0 && rdts_get_writable(client) == 0 && wm == RDTS_WM_HIGH);
+
+	//reading reopens the window
+	rdts_drain_raw_rcv_buf(server, rdts_get_raw_rcv_buf_length(server));
+	deliver(server, client);
+	assert(rdts_get_writable(client) == 100 && wm == RDTS_WM_LOW);
+
+	//a replayed old ack is rejected, its window too
+	rdts_input(client, stale, stale_len);
+	assert(client->remote_wnd_limit == 200 && rdts_get_writable(client) == 100);
+
+	//a batch that does not fit queues nothing
+	struct iovec msgs[2] = {{buf, 60}, {buf, 60}};
+	assert(rdts_send_batch(client, msgs, 2) < 0 && client->raw_snd_buf->data_size == 0);
+	msgs[1].iov_len = 40;
+	assert(rdts_send_batch(client, msgs, 2) == 0 && client->raw_snd_buf->data_size == 100);
+
+	rdts_release(client);
+	rdts_release(server);
+}
+
+//many tiny frames fed in odd sized chunks, so headers are cut at every position
+static void test_split_input()
+{
+	rdt_session_t *client = rdts_create(1, NULL);
+	rdt_session_t *server = rdts_create(1, NULL);
+	const char *p;
+	uint32_t i, len, n;
+	char c, big[300];
+
+	//give the client something to ack
+	sendto_peer(server, 10);
+	deliver(server, client);
+
+	for (i = 0; i < 300; i++) {
+		c = (char)i;
+		rdts_send(client, &c, 1);
+		if (i % 7 == 0) {
+			rdts_send_ack(client);
+			rdts_flush_ack(client);
+		}
+	}
+	//one frame with a 2 byte length
+	memset(big, 7, sizeof(big));
+	rdts_send(client, big, sizeof(big));
+
+	p = rdts_pullup_snd_buf(client);
+	len = rdts_get_snd_buf_length(client);
+	for (i = 0; len > 0; i++) {
+		n = 1 + i % 5;
+		n = n > len ? len : n;
+		assert(rdts_input(server, p, n) == 0);
+		p += n;
+		len -= n;
+	}
+
+	assert(rdts_get_raw_rcv_buf_length(server) == 600);
+	assert(server->remote_rcv_raw_offset == 40);
+	p = rdts_pullup_raw_rcv_buf(server);
+	for (i = 0; i < 300; i++) {
+		assert(p[i] == (char)i && p[300 + i] == 7);
+	}
+
+	rdts_release(client);
+	rdts_release(server);
+}
+
+//consume whole 4 byte groups only, checking the byte sequence
+static uint32_t on_recv_groups(const char *data, uint32_t len, void *userdata)
+{
+	uint32_t *seen = (uint32_t *)userdata;
+	uint32_t i, n = len / 4 * 4;
+
+	for (i = 0; i < n; i++) {
+		assert(data[i] == (char)(*seen)++);
+	}
+	return n;
+}
+
+static void test_onrecv()
+{
+	rdt_session_t *client = rdts_create(1, NULL);
+	rdt_session_t *server = rdts_create(1, NULL);
+	uint32_t i, seen = 0;
+	char c;
+
+	rdts_set_onrecv(server, on_recv_groups, &seen);
+	for (i = 0; i < 301; i++) {
+		c = (char)i;
+		rdts_send(client, &c, 1);
+		if (i % 3 == 2) {
+			deliver(client, server);
+			//at most the unconsumed tail is buffered
+			assert(rdts_get_raw_rcv_buf_length(server) == (i + 1) % 4);
+		}
+	}
+	deliver(client, server);
+	assert(seen == 300 && rdts_get_raw_rcv_buf_length(server) == 1);
+	assert(rdts_get_rcv_raw_offset(server) == 301);
+
+	//back to buffering
+	rdts_set_onrecv(server, NULL, NULL);
+	c = 1;
+	rdts_send(client, &c, 1);
+	deliver(client, server);
+	assert(seen == 300 && rdts_get_raw_rcv_buf_length(server) == 2);
+
+	rdts_release(client);
+	rdts_release(server);
+}
+
+static void count_session(rdt_session_t *rdts, void *ud)
+{
+	(*(int *)ud)++;
+}
+
+static void test_table()
+{
+	const int n = 100000;
+	rdts_table_t *tab = rdts_table_create(0);
+	rdt_session_t *s = (rdt_session_t *)calloc(n, sizeof(rdt_session_t));
+	int i, cnt = 0;
+
+	//all equal modulo 16384, they used to overwrite each other in the manager
+	for (i = 0; i < n; i++) {
+		s[i].sid = 10000 + i * 16384;
+		assert(rdts_table_insert(tab, &s[i]) == 0);
+	}
+	assert(rdts_table_count(tab) == n && rdts_table_insert(tab, &s[5]) < 0);
+	for (i = 0; i < n; i++) {
+		assert(rdts_table_find(tab, s[i].sid) == &s[i]);
+	}
+	assert(rdts_table_find(tab, 10001) == NULL && rdts_table_find(tab, 0) == NULL);
+
+	for (i = 0; i < n; i += 2) {
+		assert(rdts_table_remove(tab, s[i].sid) == &s[i]);
+	}
+	assert(rdts_table_remove(tab, s[0].sid) == NULL && rdts_table_count(tab) == n / 2);
+	for (i = 0; i < n; i++) {
+		assert(rdts_table_find(tab, s[i].sid) == (i % 2 ? &s[i] : NULL));
+	}
+	rdts_table_foreach(tab, count_session, &cnt);
+	assert(cnt == n / 2);
+
+	//churn through tombstones
+	for (i = 0; i < n * 4; i++) {
+		rdt_session_t *p = &s[(i % (n / 2)) * 2];
+		assert(rdts_table_insert(tab, p) == 0);
+		assert(rdts_table_remove(tab, p->sid) == p);
+	}
+	assert(rdts_table_count(tab) == n / 2);
+
+	rdts_table_release(tab);
+	free(s);
+}
+
+typedef struct fired_s {
+	rdts_wheel_t *wheel;
+	uint64_t now;
+	uint64_t want;
+	int count;
+	rdts_timer_t *victim;
+} fired_t;
+
+static void on_timer(rdts_timer_t *timer, void *ud)
+{
+	fired_t *f = (fired_t *)ud;
+	//late by at most one clock step plus one tick
+	assert(f->now >= f->want && f->now < f->want + 20 + 10);
+	f->count++;
+	if (f->victim) {
+		rdts_wheel_del(f->wheel, f->victim);
+	}
+}
+
+static void test_timer()
+{
+	static const uint64_t delays[] = {1, 9, 10, 2550, 2560, 2570, 655360, 167772160, 1ULL << 40};
+	const int n = sizeof(delays) / sizeof(delays[0]);
+	rdts_wheel_t *wheel = rdts_wheel_create(12345, 10);
+	rdts_timer_t timers[sizeof(delays) / sizeof(delays[0])], a, b;
+	fired_t f[sizeof(delays) / sizeof(delays[0])], fa = {0}, fb = {0};
+	uint64_t now = 12345;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		f[i].wheel = wheel;
+		f[i].want = now + delays[i];
+		f[i].count = 0;
+		f[i].victim = NULL;
+		rdts_timer_init(&timers[i], on_timer, &f[i]);
+		rdts_wheel_add(wheel, &timers[i], f[i].want);
+	}
+	//re-adding moves the timer
+	rdts_wheel_add(wheel, &timers[0], now + 5);
+	f[0].want = now + 5;
+
+	//a callback deleting a timer due on the same tick
+	fa.wheel = fb.wheel = wheel;
+	fa.want = fb.want = now + 3000;
+	fa.victim = &b;
+	rdts_timer_init(&a, on_timer, &fa);
+	rdts_timer_init(&b, on_timer, &fb);
+	rdts_wheel_add(wheel, &a, fa.want);
+	rdts_wheel_add(wheel, &b, fb.want);
+	assert(rdts_wheel_count(wheel) == n + 2);
+
+	//step with a coarse, uneven clock
+	for (; rdts_wheel_count(wheel) > 1; now += 7 + now % 13) {
+		for (i = 0; i < n; i++) {
+			f[i].now = now;
+		}
+		fa.now = fb.now = now;
+		rdts_wheel_tick(wheel, now);
+		if (now > 12345 + 200000000) {
+			break;
+		}
+	}
+	for (i = 0; i < n - 1; i++) {
+		assert(f[i].count == 1 && !rdts_timer_pending(&timers[i]));
+	}
+	assert(fa.count == 1 && fb.count == 0);
+	assert(rdts_timer_pending(&timers[n - 1]) && rdts_wheel_count(wheel) == 1);
+
+	//a jump far beyond the wheel range fires the overdue timer at once
+	f[n - 1].now = f[n - 1].want + 10;
+	rdts_wheel_add(wheel, &timers[0], f[n - 1].now + 100000);
+	f[0].count = 0;
+	rdts_wheel_tick(wheel, f[n - 1].now);
+	assert(f[n - 1].count == 1 && f[0].count == 0 && rdts_wheel_count(wheel) == 1);
+
+	rdts_wheel_del(wheel, &timers[0]);
+	assert(rdts_wheel_count(wheel) == 0);
+	rdts_wheel_release(wheel);
+}
+
+//buffers are allocated on first use and counted per session and in a shared total
+static void test_mem()
+{
+	mbuf_acct_t total = {NULL, 0};
+	rdt_session_t *client = rdts_create(1, NULL);
+	rdt_session_t *server = rdts_create(1, NULL);
+	uint64_t before;
+
+	assert(rdts_get_mem(client) == 0 && client->snd_buf->blk_count == 0);
+	rdts_set_snd_mode(client, RDTS_SND_REF);
+	rdts_set_rcv_ring(server);
+	rdts_set_mem_parent(client, &total);
+	rdts_set_mem_parent(server, &total);
+	assert(rdts_get_mem(client) == 0 && total.bytes == rdts_get_mem(server));
+
+	//a reset keeps untouched buffers unallocated
+	rdts_reset(client);
+	rdts_init(client, 1024 * 10, 1024);
+	assert(rdts_get_mem(client) == 0);
+
+	sendto_peer(client, 100);
+	deliver(client, server);
+	assert(rdts_get_mem(client) > 0 && server->rcv_buf->data_size == 0);
+	assert(total.bytes == rdts_get_mem(client) + rdts_get_mem(server));
+
+	before = rdts_get_mem(server);
+	rdts_release(server);
+	assert(total.bytes == rdts_get_mem(client) && before > 0);
+
+	rdts_set_mem_parent(client, NULL);
+	assert(total.bytes == 0);
+	rdts_release(client);
+}
+
+//buffers grown by a burst go back to the hint size once the data is small again
+static void test_shrink()
+{
+	mbuf_t mbuf;
+	mbuf_acct_t acct = {NULL, 0};
+	char in[3000];
+	int i;
+
+	for (i = 0; i < (int)sizeof(in); i++) {
+		in[i] = (char)i;
+	}
+
+	mbuf_init_lazy(&mbuf, 4096);
+	mbuf_set_acct(&mbuf, &acct);
+	for (i = 0; i < 40; i++) {
+		mbuf_enq(&mbuf, in, sizeof(in));
+	}
+	assert(mbuf.blk_count > 1 && acct.bytes == mbuf.alloc_size);
+	assert(mbuf_shrink(&mbuf) == 0);
+
+	//small data is moved into one hint sized block
+	mbuf_drain(&mbuf, 39 * sizeof(in) + 100);
+	assert(mbuf_shrink(&mbuf) > 0 && mbuf.blk_count == 1 && mbuf.alloc_size < 2 * 4096);
+	assert(mbuf.data_size == sizeof(in) - 100 && memcmp(mbuf_pullup(&mbuf), in + 100, sizeof(in) - 100) == 0);
+	assert(acct.bytes == mbuf.alloc_size);
+
+	//a single huge block left by pullup
+	mbuf_enq(&mbuf, NULL, 50000);
+	mbuf_pullup(&mbuf);
+	mbuf_drain(&mbuf, mbuf.data_size);
+	assert(mbuf.alloc_size > 50000 && mbuf_shrink(&mbuf) > 50000);
+	assert(mbuf.alloc_size == 0 && mbuf.blk_count == 0 && acct.bytes == 0);
+	mbuf_enq(&mbuf, in, 10);
+	assert(mbuf.data_size == 10 && acct.bytes == mbuf.alloc_size);
+	mbuf_free(&mbuf);
+	assert(acct.bytes == 0);
+
+	if (mbuf_init_ring(&mbuf, 4096) == 0) {
+		uint32_t size = mbuf.alloc_size;
+		mbuf_set_acct(&mbuf, &acct);
+		mbuf_enq(&mbuf, NULL, 100000);
+		mbuf_drain(&mbuf, 100000 - 10);
+		assert(mbuf_shrink(&mbuf) > 0 && mbuf.alloc_size == size && mbuf.data_size == 10);
+		assert(acct.bytes == size);
+		mbuf_free(&mbuf);
+	}
+
+	//sessions shrink by themselves from rdts_update()
+	rdt_session_t *client = rdts_create(1, NULL);
+	rdt_session_t *server = rdts_create(1, NULL);
+	rdts_init(client, 1024 * 1024, 1024 * 1024);
+	rdts_set_shrink(server, 1000);
+	for (i = 0; i < 20; i++) {
+		rdts_send(client, in, sizeof(in));
+	}
+	deliver(client, server);
+	rdts_update(server, 100);
+	rdts_drain_raw_rcv_buf(server, rdts_get_raw_rcv_buf_length(server));
+	assert(rdts_get_mem(server) > 40000 && rdts_next_update(server) == 1100);
+	rdts_update(server, 1099);
+	assert(rdts_get_mem(server) > 0);
+	rdts_update(server, 1100);
+	assert(rdts_get_mem(server) == 0 && rdts_next_update(server) == 0);
+
+	//raw_snd_buf holds unacked data, the rest goes
+	assert(rdts_shrink(client) > 0 && client->snd_buf->alloc_size == 0);
+	assert(client->raw_snd_buf->data_size == 20 * sizeof(in));
+	rdts_release(client);
+	rdts_release(server);
+}
+
+//sessions carried over a restart keep offsets, unacked and unread data and a partial frame
+static void test_snapshot()
+{
+	rdt_session_t *client = rdts_create(7, NULL);
+	rdt_session_t *server = rdts_create(7, NULL);
+	char data[1000], img[8192];
+	const char *p;
+	uint32_t len, used = 0;
+	int i, n;
+
+	for (i = 0; i < (int)sizeof(data); i++) {
+		data[i] = (char)(i * 7);
+	}
+	rdts_init(client, 1024 * 64, 1024 * 64);
+	rdts_init(server, 1024 * 64, 1024 * 64);
+	rdts_set_snd_mode(client, RDTS_SND_REF);
+	rdts_set_rcv_window(server, 4096);
+
+	rdts_send(client, data, 600);
+	rdts_send(client, data + 600, 400);
+	//the last frame arrives cut short
+	p = rdts_pullup_snd_buf(client);
+	len = rdts_get_snd_buf_length(client);
+	rdts_input(server, p, len - 5);
+	memcpy(img, p + len - 5, 5);
+	rdts_drain_snd_buf(client, len);
+	assert(rdts_get_raw_rcv_buf_length(server) == 600 && server->rcv_buf->data_size > 0);
+
+	n = rdts_serialize(server, img + 5, sizeof(img) - 5);
+	assert(n == (int)rdts_serialize_size(server) && rdts_serialize(server, img + 5, n - 1) < 0);
+	rdts_release(server);
+	server = rdts_deserialize(img + 5, n, &used, NULL);
+	assert(server && (int)used == n && server->sid == 7 && server->rcv_window == 4096);
+	assert(rdts_get_raw_rcv_buf_length(server) == 600 && rdts_get_rcv_raw_offset(server) == 600);
+
+	rdts_input(server, img, 5);
+	assert(rdts_get_raw_rcv_buf_length(server) == 1000 && memcmp(rdts_pullup_raw_rcv_buf(server), data, 1000) == 0);
+
+	n = rdts_serialize(client, img, sizeof(img));
+	rdts_release(client);
+	img[0] ^= 1;
+	assert(rdts_deserialize(img, n, NULL, NULL) == NULL);
+	img[0] ^= 1;
+	assert(rdts_deserialize(img, n - 1, NULL, NULL) == NULL);
+	client = rdts_deserialize(img, n, NULL, NULL);
+	assert(client && client->snd_mode == RDTS_SND_REF && client->raw_snd_buf->data_size == 1000);
+
+	//the ack after the reconnect releases the unacked data
+	rdts_send_ack(server);
+	deliver(server, client);
+	assert(client->raw_snd_buf->data_size == 0 && client->remote_rcv_raw_offset == 1000);
+
+	rdts_release(client);
+	rdts_release(server);
+}
+
+//two mappings of one store stand in for two processes
+//rdts_shm.c: the next put dies holding the lock
+extern int shm_put_die;
+
+static void test_shm()
+{
+	char name[64], data[500];
+	rdts_shm_t *a, *b;
+	rdt_session_t *rdts;
+	int i, status;
+	pid_t pid;
+
+	snprintf(name, sizeof(name), "/rdts_test_%d", (int)getpid());
+	a = rdts_shm_create(name, 4, 4096);
+	if (a == NULL) {
+		printf("shm not available, skipped\n");
+		return;
+	}
+	b = rdts_shm_open(name);
+	assert(b && rdts_shm_open("/rdts_test_none") == NULL);
+
+	memset(data, 'x', sizeof(data));
+	for (i = 1; i <= 3; i++) {
+		rdts = rdts_create(i, NULL);
+		rdts_send(rdts, data, 100 * i);
+		assert(rdts_shm_put(a, rdts) == 0);
+		rdts_release(rdts);
+	}
+	assert(rdts_shm_count(b) == 3);
+
+	rdts = rdts_shm_take(b, 2, NULL);
+	assert(rdts && rdts->sid == 2 && rdts->raw_snd_buf->data_size == 200);
+	assert(rdts_shm_take(a, 2, NULL) == NULL && rdts_shm_count(a) == 2);
+
+	//replacing the same sid, then filling the area: dead images are compacted away
+	for (i = 0; i < 20; i++) {
+		assert(rdts_shm_put(b, rdts) == 0);
+	}
+	assert(rdts_shm_count(a) == 3);
+	for (i = 0; i < 8; i++) {
+		rdts_send(rdts, data, sizeof(data));
+	}
+	//a put that does not fit keeps the older copy
+	assert(rdts_shm_put(a, rdts) < 0 && rdts_shm_count(a) == 3);
+	rdts_release(rdts);
+	rdts = rdts_shm_take(a, 2, NULL);
+	assert(rdts && rdts->raw_snd_buf->data_size == 200);
+	rdts_release(rdts);
+
+	rdts = rdts_shm_take(a, 3, NULL);
+	assert(rdts && rdts->raw_snd_buf->data_size == 300);
+	rdts_release(rdts);
+	rdts = rdts_shm_take(a, 1, NULL);
+	assert(rdts && rdts->raw_snd_buf->data_size == 100 && rdts_shm_count(b) == 0);
+	rdts_release(rdts);
+
+	//a process that dies holding the lock: the next one checks the store and goes on
+	rdts = rdts_create(7, NULL);
+	rdts_send(rdts, data, 100);
+	assert(rdts_shm_put(a, rdts) == 0);
+	rdts_send(rdts, data, 100);
+	pid = fork();
+	if (pid == 0) {
+		shm_put_die = 1;
+		rdts_shm_put(b, rdts);
+		_exit(0);
+	}
+	assert(pid > 0 && waitpid(pid, &status, 0) == pid && WEXITSTATUS(status) == 1);
+	rdts_release(rdts);
+	rdts = rdts_shm_take(a, 7, NULL);
+	assert(rdts && rdts->raw_snd_buf->data_size == 200 && rdts_shm_count(a) == 0);
+	rdts_release(rdts);
+
+	//the index holds at most half its slots
+	rdts = rdts_create(1, NULL);
+	for (i = 1; i <= 33; i++) {
+		rdts->sid = i;
+		assert(rdts_shm_put(a, rdts) == (i <= 32 ? 0 : -1));
+	}
+	//a full index still takes a replacement
+	rdts->sid = 5;
+	assert(rdts_shm_put(a, rdts) == 0 && rdts_shm_count(a) == 32);
+	rdts_release(rdts);
+
+	rdts_shm_close(b);
+	rdts_shm_close(a);
+	rdts_shm_unlink(name);
+	assert(rdts_shm_open(name) == NULL);
+}
+
+//sessions spread over shard threads. routed jobs are posted from inside a shard to the
+//shard that owns the target sid, like a reconnect arriving on another thread's connection
+enum { JOB_CREATE, JOB_SEND, JOB_ROUTE, JOB_RECONNECT };
+
+typedef struct shard_job_s {
+	rdts_shard_msg_t msg;
+	int op;
+	int target;
+} shard_job_t;
+
+typedef struct shard_count_s {
+	int done;
+	int misrouted;
+	int resent;
+} shard_count_t;
+
+static void shard_job(rdts_shard_t *shard, rdts_shard_msg_t *msg);
+
+static void shard_post(rdts_group_t *group, int sid, int op, int target)
+{
+	shard_job_t *job = (shard_job_t *)malloc(sizeof(*job));
+	job->msg.sid = sid;
+	job->msg.fn = shard_job;
+	job->op = op;
+	job->target = target;
+	rdts_group_post(group, &job->msg);
+}
+
+static void shard_job(rdts_shard_t *shard, rdts_shard_msg_t *msg)
+{
+	shard_job_t *job = (shard_job_t *)msg;
+	shard_count_t *count = (shard_count_t *)rdts_shard_get_ud(shard);
+	rdts_group_t *group = rdts_shard_get_group(shard);
+	rdt_session_t *rdts = rdts_shard_find(shard, msg->sid);
+	char data[100] = {0};
+
+	if (rdts_group_shard_of(group, msg->sid) != rdts_shard_index(shard)) {
+		__sync_fetch_and_add(&count->misrouted, 1);
+	}
+
+	switch (job->op) {
+	case JOB_CREATE:
+		assert(rdts == NULL && rdts_shard_create_session(shard, msg->sid));
+		//a sid of another shard is turned down
+		assert(rdts_shard_create_session(shard, msg->sid + 1) == NULL || rdts_group_shard_of(group, msg->sid + 1) == rdts_shard_index(shard));
+		rdts_shard_delete_session(shard, msg->sid + 1);
+		break;
+	case JOB_SEND:
+		assert(rdts && rdts_send(rdts, data, sizeof(data)) >= 0);
+		rdts_drain_snd_buf(rdts, rdts_get_snd_buf_length(rdts));
+		break;
+	case JOB_ROUTE:
+		shard_post(group, job->target, JOB_RECONNECT, 0);
+		break;
+	case JOB_RECONNECT:
+		assert(rdts && rdts_push_raw(rdts) >= 0);
+		__sync_fetch_and_add(&count->resent, rdts_get_snd_buf_length(rdts));
+		break;
+	}
+
+	free(job);
+	__sync_fetch_and_add(&count->done, 1);
+}
+
+static void test_shards()
+{
+	shard_count_t count = {0, 0, 0};
+	rdts_group_t *group = rdts_group_create(4, 5, &count);
+	int i, n = 200, per[4] = {0};
+
+	assert(group && rdts_group_count(group) == 4);
+	for (i = 1; i <= n; i++) {
+		per[rdts_group_shard_of(group, i * 2)]++;
+		shard_post(group, i * 2, JOB_CREATE, 0);
+		shard_post(group, i * 2, JOB_SEND, 0);
+	}
+	for (i = 0; i < 4; i++) {
+		assert(per[i] > 0);
+	}
+	//the route job lands on one shard and forwards the reconnect to another
+	for (i = 1; i <= n; i++) {
+		shard_post(group, i * 2, JOB_ROUTE, (n + 1 - i) * 2);
+	}
+
+	while (__sync_fetch_and_add(&count.done, 0) < n * 4) {
+		usleep(1000);
+	}
+	assert(count.misrouted == 0);
+	//every session resends its unacked 100 bytes, framed with a 2 byte header
+	assert(count.resent == n * 102);
+
+	rdts_group_release(group);
+}
+
+//records of every size through a small ring, so it wraps at every offset
+static void test_spsc()
+{
+	rdts_spsc_t *ring = rdts_spsc_create(100);
+	char buf[2048];
+	const char *p;
+	uint32_t len, i, pushed = 0, popped = 0;
+	int id, type;
+
+	assert(ring && rdts_spsc_max(ring) == 4096 / 2 - 16);
+	assert(rdts_spsc_reserve(ring, rdts_spsc_max(ring) + 1) == NULL);
+	assert(rdts_spsc_peek(ring, &id, &type, &len) == NULL && rdts_spsc_empty(ring));
+
+	while (popped < 3000) {
+		//push until full, then take half of it
+		len = pushed % 700;
+		memset(buf, (char)pushed, len);
+		if (rdts_spsc_push(ring, pushed, 1, buf, len) == 0) {
+			pushed++;
+			continue;
+		}
+		for (i = 0; i < 3; i++) {
+			p = rdts_spsc_peek(ring, &id, &type, &len);
+			assert(p && id == (int)popped && type == 1 && len == popped % 700);
+			assert(len == 0 || (p[0] == (char)popped && p[len - 1] == (char)popped));
+			rdts_spsc_pop(ring);
+			popped++;
+		}
+	}
+
+	//a shorter commit than reserved
+	while (rdts_spsc_peek(ring, &id, &type, &len)) {
+		rdts_spsc_pop(ring);
+	}
+	p = rdts_spsc_reserve(ring, 1000);
+	memcpy((char *)p, "abc", 3);
+	rdts_spsc_commit(ring, 7, 2, 3);
+	p = rdts_spsc_peek(ring, &id, &type, &len);
+	assert(p && id == 7 && len == 3 && memcmp(p, "abc", 3) == 0);
+	rdts_spsc_release(ring);
+}
+
+static int io_next(rdts_io_t *io, int *id, int *type, char *buf, uint32_t *len)
+{
+	const char *p;
+
+	if (!rdts_io_wait(io, 2000)) {
+		return -1;
+	}
+	p = rdts_io_peek(io, id, type, len);
+	memcpy(buf, p, *len);
+	buf[*len] = 0;
+	rdts_io_pop(io);
+	return 0;
+}
+
+static void read_packet(int fd, char *buf, uint32_t *len)
+{
+	uint32_t got = 0;
+
+	while (got < 4) {
+		got += read(fd, buf + got, 4 - got);
+	}
+	memcpy(len, buf, 4);
+	got = 0;
+	while (got < *len) {
+		got += read(fd, buf + got, *len - got);
+	}
+	buf[*len] = 0;
+}
+
+static void test_io(int backend)
+{
+	rdts_io_t *io = rdts_io_create(64 * 1024, backend);
+	static char buf[32 * 1024], big[30000 + 4];
+	char pending[9];
+	uint32_t len, n = 5;
+	int i, sv[2], id, type, conn, lfd, cfd, peer;
+	struct sockaddr_in addr;
+	socklen_t slen = sizeof(addr);
+
+	//io_uring needs a recent kernel
+	if (io == NULL && backend == RDTS_IO_BACKEND_URING) {
+		printf("io backend uring not available: %s\n", strerror(errno));
+		return;
+	}
+	assert(io && socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(backend == RDTS_IO_BACKEND_AUTO || strcmp(rdts_io_backend(io), backend == RDTS_IO_BACKEND_URING ? "uring" : backend == RDTS_IO_BACKEND_EPOLL ? "epoll" : "poll") == 0);
+
+	//part of the first packet was read before the handover
+	memcpy(pending, &n, 4);
+	memcpy(pending + 4, "hel", 3);
+	conn = rdts_io_add(io, sv[0], 0, pending, 7);
+	assert(conn > 0);
+	n = 1;
+	assert(write(sv[1], "lo\1\0\0\0x", 7) == 7);
+	assert(io_next(io, &id, &type, buf, &len) == 0 && id == conn && type == RDTS_IO_DATA && strcmp(buf, "hello") == 0);
+	assert(io_next(io, &id, &type, buf, &len) == 0 && id == conn && strcmp(buf, "x") == 0);
+
+	assert(rdts_io_send(io, conn, "pong", 4) == 0);
+	read_packet(sv[1], buf, &len);
+	assert(len == 4 && strcmp(buf, "pong") == 0);
+
+	//packets larger than one read, and output larger than one write
+	n = sizeof(big) - 4;
+	memcpy(big, &n, 4);
+	memset(big + 4, 'b', n);
+	assert(write(sv[1], big, sizeof(big)) == sizeof(big));
+	assert(io_next(io, &id, &type, buf, &len) == 0 && id == conn && len == n && buf[n - 1] == 'b');
+	for (i = 0; i < 4; i++) {
+		//the command ring takes two at a time
+		while (rdts_io_send(io, conn, big + 4, n) != 0) {
+			usleep(1000);
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		read_packet(sv[1], buf, &len);
+		assert(len == n && buf[0] == 'b' && buf[n - 1] == 'b');
+	}
+
+	//writes that find the SQ full are submitted again, nothing is lost or reordered
+	if (backend == RDTS_IO_BACKEND_URING) {
+		__atomic_store_n(&io_uring_sqe_fail, 8, __ATOMIC_RELAXED);
+	}
+	for (i = 0; i < 4; i++) {
+		memset(big + 4, 'c' + i, n);
+		while (rdts_io_send(io, conn, big + 4, n) != 0) {
+			usleep(1000);
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		uint32_t j;
+		read_packet(sv[1], buf, &len);
+		assert(len == n);
+		for (j = 0; j < n; j++) {
+			assert(buf[j] == 'c' + i);
+		}
+	}
+	assert(__atomic_load_n(&io_uring_sqe_fail, __ATOMIC_RELAXED) == 0);
+
+	//queued output is written before the close
+	assert(rdts_io_send(io, conn, "bye", 3) == 0 && rdts_io_close(io, conn) == 0);
+	read_packet(sv[1], buf, &len);
+	assert(strcmp(buf, "bye") == 0 && read(sv[1], buf, 1) == 0);
+	close(sv[1]);
+	//a stale id is ignored
+	assert(rdts_io_send(io, conn, "lost", 4) == 0);
+
+	//accepted connections are added by themselves, a peer close is reported
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(lfd, 5) == 0);
+	getsockname(lfd, (struct sockaddr *)&addr, &slen);
+	assert(rdts_io_add(io, lfd, 1, NULL, 0) > 0);
+
+	cfd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(connect(cfd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	assert(io_next(io, &peer, &type, buf, &len) == 0 && type == RDTS_IO_ACCEPT && len == sizeof(struct sockaddr_in));
+	assert(((struct sockaddr_in *)buf)->sin_family == AF_INET);
+	assert(write(cfd, "\2\0\0\0hi", 6) == 6);
+	assert(io_next(io, &id, &type, buf, &len) == 0 && id == peer && type == RDTS_IO_DATA && strcmp(buf, "hi") == 0);
+	assert(rdts_io_send(io, peer, "ok", 2) == 0);
+	read_packet(cfd, buf, &len);
+	assert(strcmp(buf, "ok") == 0);
+
+	close(cfd);
+	assert(io_next(io, &id, &type, buf, &len) == 0 && id == peer && type == RDTS_IO_CLOSED && len == 0);
+
+	//a handover the backend refuses is reported too, epoll takes no regular files
+	if (backend == RDTS_IO_BACKEND_EPOLL) {
+		conn = rdts_io_add(io, open("/dev/null", O_RDONLY), 0, NULL, 0);
+		assert(conn > 0 && io_next(io, &id, &type, buf, &len) == 0 && id == conn && type == RDTS_IO_CLOSED && len > 0);
+	}
+
+	rdts_io_release(io);
+}
+
+static void test_session(int snd_mode)
 {
     int sid = 10000;
 	rdt_session_t *client = rdts_create(sid, NULL);
 	rdts_init(client, 1024 * 10, 1);
 	client->writelog = writelog;
 	client->logmask = RDTS_LOG_DEBUG;
+	rdts_set_snd_mode(client, snd_mode);
 
 	rdt_session_t *server = rdts_create(sid, NULL);
 	rdts_init(server, 1024 * 10, 1);
 	server->writelog = writelog;
 	server->logmask = RDTS_LOG_DEBUG;
+	rdts_set_snd_mode(server, snd_mode);
+	rdts_set_rcv_ring(server);
 	test_rdt(client, server);
 
 	rdts_release(client);
 	rdts_release(server);
+}
+
+int main()
+{
+	test_session(RDTS_SND_COPY);
+	test_session(RDTS_SND_REF);
+
+	test_ack_delay();
+	test_window();
+	test_split_input();
+	test_onrecv();
+	test_table();
+	test_timer();
+	test_mem();
+	test_shrink();
+	test_snapshot();
+	test_shm();
+	test_shards();
+	test_spsc();
+	test_io(RDTS_IO_BACKEND_URING);
+	test_io(RDTS_IO_BACKEND_EPOLL);
+	test_io(RDTS_IO_BACKEND_POLL);
+	test_pool();
+	test_ring();
 
     return 0;
 }
\ No newline at end of file